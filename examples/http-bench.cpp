@@ -0,0 +1,387 @@
+/*
+ * QDjango
+ * Copyright (C) 2010-2011 Bolloré telecom
+ * See AUTHORS file for a full list of contributors.
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <QAtomicInt>
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QSemaphore>
+#include <QStringList>
+#include <QTcpSocket>
+#include <QTemporaryFile>
+#include <QThread>
+#include <QVector>
+
+#include "QDjangoAllocCounter.h"
+#include "QDjangoHttpController.h"
+#include "QDjangoHttpRequest.h"
+#include "QDjangoHttpResponse.h"
+#include "QDjangoHttpServer.h"
+
+// time to wait for the server before a connection is considered failed
+#define TIMEOUT 10000
+
+/** Serves the requests sent by the load generator.
+ */
+class BenchController : public QDjangoHttpController
+{
+public:
+    BenchController(const QString &staticPath)
+        : m_staticPath(staticPath)
+    {
+    }
+
+    QDjangoHttpResponse* respondToRequest(const QDjangoHttpRequest &request)
+    {
+        if (request.path() == QLatin1String("/tiny")) {
+            QDjangoHttpResponse *response = new QDjangoHttpResponse;
+            response->setHeader("Content-Type", "text/plain");
+            response->setBody("ok");
+            return response;
+        } else if (request.path() == QLatin1String("/static")) {
+            return serveStatic(request, m_staticPath);
+        } else if (request.path() == QLatin1String("/upload")) {
+            QDjangoHttpResponse *response = new QDjangoHttpResponse;
+            response->setHeader("Content-Type", "text/plain");
+            response->setBody(QByteArray::number(request.body().size()));
+            return response;
+        }
+        return serveNotFound(request);
+    }
+
+private:
+    QString m_staticPath;
+};
+
+/** Runs a QDjangoHttpServer on loopback with its own event loop, so that
+ *  it does not compete with the clients.
+ */
+class ServerThread : public QThread
+{
+public:
+    ServerThread(const QString &staticPath)
+        : allocations(0),
+        bytes(0),
+        port(0),
+        m_staticPath(staticPath)
+    {
+    }
+
+    void run()
+    {
+        BenchController controller(m_staticPath);
+        QDjangoHttpServer server;
+        server.setController(&controller);
+        if (server.listen(QHostAddress::LocalHost, 0))
+            port = server.serverPort();
+        ready.release();
+
+        // the server has this thread to itself, so its allocations are
+        // those made to serve requests
+        QDjangoAllocCounter counter;
+        exec();
+        allocations = counter.allocations();
+        bytes = counter.bytes();
+    }
+
+    qint64 allocations;
+    qint64 bytes;
+    quint16 port;
+    QSemaphore ready;
+
+private:
+    QString m_staticPath;
+};
+
+/** State shared by the client connections.
+ */
+class BenchState
+{
+public:
+    QString host;
+    quint16 port;
+    int total;
+    int pipeline;
+    QList<QByteArray> schedule;
+    QAtomicInt next;
+    QAtomicInt errors;
+};
+
+/** A keep-alive connection which sends requests until the total number
+ *  of requests has been claimed.
+ */
+class ClientThread : public QThread
+{
+public:
+    ClientThread(BenchState *state)
+        : m_state(state)
+    {
+    }
+
+    void run()
+    {
+        QTcpSocket socket;
+        socket.connectToHost(m_state->host, m_state->port);
+        if (!socket.waitForConnected(TIMEOUT)) {
+            m_state->errors.fetchAndAddRelaxed(1);
+            return;
+        }
+
+        QElapsedTimer timer;
+        timer.start();
+        QByteArray buffer;
+        forever {
+            // claim a batch of requests, several if they are pipelined
+            const int first = m_state->next.fetchAndAddRelaxed(m_state->pipeline);
+            if (first >= m_state->total)
+                break;
+            const int count = qMin(m_state->pipeline, m_state->total - first);
+
+            const qint64 sent = timer.nsecsElapsed();
+            for (int i = first; i < first + count; ++i)
+                socket.write(m_state->schedule.at(i % m_state->schedule.size()));
+            while (socket.bytesToWrite() > 0) {
+                if (!socket.waitForBytesWritten(TIMEOUT)) {
+                    m_state->errors.fetchAndAddRelaxed(count);
+                    return;
+                }
+            }
+
+            for (int i = 0; i < count; ++i) {
+                int status = 0;
+                if (!readResponse(socket, buffer, status)) {
+                    m_state->errors.fetchAndAddRelaxed(count - i);
+                    return;
+                }
+                if (status < 200 || status >= 300)
+                    m_state->errors.fetchAndAddRelaxed(1);
+                latencies << (timer.nsecsElapsed() - sent) / 1000;
+            }
+        }
+    }
+
+    // latencies in microseconds
+    QVector<qint64> latencies;
+
+private:
+    bool readResponse(QTcpSocket &socket, QByteArray &buffer, int &status)
+    {
+        int headerEnd;
+        while ((headerEnd = buffer.indexOf("\r\n\r\n")) < 0) {
+            if (!socket.waitForReadyRead(TIMEOUT))
+                return false;
+            buffer += socket.readAll();
+        }
+
+        // parse status line and body length
+        const QList<QByteArray> lines = buffer.left(headerEnd).split('\n');
+        status = lines.first().split(' ').value(1).toInt();
+        int length = 0;
+        foreach (const QByteArray &line, lines) {
+            if (line.toLower().startsWith("content-length:"))
+                length = line.mid(15).trimmed().toInt();
+        }
+
+        const int size = headerEnd + 4 + length;
+        while (buffer.size() < size) {
+            if (!socket.waitForReadyRead(TIMEOUT))
+                return false;
+            buffer += socket.readAll();
+        }
+        buffer.remove(0, size);
+        return true;
+    }
+
+    BenchState *m_state;
+};
+
+/** Returns the given percentile of sorted values, in milliseconds.
+ */
+static double percentile(const QVector<qint64> &sorted, double fraction)
+{
+    if (sorted.isEmpty())
+        return 0.0;
+    const int index = qMin(sorted.size() - 1, int(fraction * sorted.size()));
+    return sorted.at(index) / 1000.0;
+}
+
+/** Display program usage.
+ */
+static void usage()
+{
+    fprintf(stderr, "Usage: qdjango-http-bench [options]\n"
+        "  -a <host:port>  benchmark an existing server instead of a local one\n"
+        "  -b <bytes>      size of POST bodies (default: 65536)\n"
+        "  -c <count>      number of keep-alive connections (default: 16)\n"
+        "  -m <mix>        weighted request mix (default: tiny=80,static=15,post=5)\n"
+        "  -n <count>      total number of requests (default: 10000)\n"
+        "  -p <depth>      number of pipelined requests per connection (default: 1)\n"
+        "  -s <bytes>      size of the static file (default: 16384)\n");
+}
+
+int main(int argc, char* argv[])
+{
+    QCoreApplication app(argc, argv);
+
+    // parse command line arguments
+    QString address;
+    QString mix = "tiny=80,static=15,post=5";
+    int bodySize = 65536;
+    int connections = 16;
+    int pipeline = 1;
+    int staticSize = 16384;
+    int total = 10000;
+    if (!(argc % 2)) {
+        usage();
+        return EXIT_FAILURE;
+    }
+    for (int i = 1; i < argc; i += 2) {
+        const QString value = QString::fromLocal8Bit(argv[i + 1]);
+        if (!strcmp(argv[i], "-a"))
+            address = value;
+        else if (!strcmp(argv[i], "-b"))
+            bodySize = value.toInt();
+        else if (!strcmp(argv[i], "-c"))
+            connections = value.toInt();
+        else if (!strcmp(argv[i], "-m"))
+            mix = value;
+        else if (!strcmp(argv[i], "-n"))
+            total = value.toInt();
+        else if (!strcmp(argv[i], "-p"))
+            pipeline = value.toInt();
+        else if (!strcmp(argv[i], "-s"))
+            staticSize = value.toInt();
+        else {
+            usage();
+            return EXIT_FAILURE;
+        }
+    }
+    if (bodySize < 0 || connections < 1 || pipeline < 1 || staticSize < 0 || total < 1) {
+        usage();
+        return EXIT_FAILURE;
+    }
+
+    // build the request schedule from the weighted mix
+    BenchState state;
+    state.total = total;
+    state.pipeline = pipeline;
+    foreach (const QString &item, mix.split(',')) {
+        const QString kind = item.section('=', 0, 0);
+        const int weight = item.contains('=') ? item.section('=', 1).toInt() : 1;
+        QByteArray request;
+        if (kind == QLatin1String("tiny"))
+            request = "GET /tiny HTTP/1.1\r\nHost: localhost\r\n\r\n";
+        else if (kind == QLatin1String("static"))
+            request = "GET /static HTTP/1.1\r\nHost: localhost\r\n\r\n";
+        else if (kind == QLatin1String("post"))
+            request = "POST /upload HTTP/1.1\r\nHost: localhost\r\n"
+                "Content-Type: application/octet-stream\r\n"
+                "Content-Length: " + QByteArray::number(bodySize) + "\r\n\r\n" +
+                QByteArray(bodySize, 'x');
+        else {
+            fprintf(stderr, "Unknown request kind %s\n", qPrintable(kind));
+            return EXIT_FAILURE;
+        }
+        for (int i = 0; i < weight; ++i)
+            state.schedule << request;
+    }
+    if (state.schedule.isEmpty()) {
+        usage();
+        return EXIT_FAILURE;
+    }
+
+    // start a local server unless an address was given
+    QTemporaryFile staticFile;
+    ServerThread *server = 0;
+    if (address.isEmpty()) {
+        if (!staticFile.open()) {
+            fprintf(stderr, "Could not create static file\n");
+            return EXIT_FAILURE;
+        }
+        staticFile.write(QByteArray(staticSize, 'x'));
+        staticFile.flush();
+
+        server = new ServerThread(staticFile.fileName());
+        server->start();
+        server->ready.acquire();
+        if (!server->port) {
+            fprintf(stderr, "Could not start server\n");
+            return EXIT_FAILURE;
+        }
+        state.host = "127.0.0.1";
+        state.port = server->port;
+    } else {
+        state.host = address.section(':', 0, 0);
+        state.port = address.section(':', 1).toUShort();
+    }
+
+    // run the clients
+    QList<ClientThread*> clients;
+    for (int i = 0; i < connections; ++i)
+        clients << new ClientThread(&state);
+
+    QElapsedTimer timer;
+    timer.start();
+    foreach (ClientThread *client, clients)
+        client->start();
+    QVector<qint64> latencies;
+    foreach (ClientThread *client, clients) {
+        client->wait();
+        latencies += client->latencies;
+    }
+    const double seconds = timer.nsecsElapsed() / 1000000000.0;
+    qDeleteAll(clients);
+
+    QByteArray allocations;
+    if (server) {
+        server->quit();
+        server->wait();
+        if (QDjangoAllocCounter::isAvailable() && !latencies.isEmpty())
+            allocations = QString("  \"allocationsPerRequest\": %1,\n"
+                                  "  \"bytesPerRequest\": %2,\n").arg(
+                double(server->allocations) / latencies.size(), 0, 'f', 1).arg(
+                double(server->bytes) / latencies.size(), 0, 'f', 1).toLatin1();
+        delete server;
+    }
+
+    // report results
+    qSort(latencies);
+    const int errors = state.errors;
+    printf("{\n"
+        "  \"connections\": %i,\n"
+        "  \"pipeline\": %i,\n"
+        "  \"mix\": \"%s\",\n"
+        "  \"requests\": %i,\n"
+        "  \"errors\": %i,\n"
+        "  \"seconds\": %.3f,\n"
+        "  \"requestsPerSecond\": %.1f,\n"
+        "%s"
+        "  \"latencyMs\": {\"p50\": %.3f, \"p99\": %.3f, \"p999\": %.3f, \"max\": %.3f}\n"
+        "}\n",
+        connections, pipeline, qPrintable(mix), latencies.size(), errors, seconds,
+        latencies.size() / seconds, allocations.constData(),
+        percentile(latencies, 0.5), percentile(latencies, 0.99),
+        percentile(latencies, 0.999), percentile(latencies, 1.0));
+
+    return errors ? EXIT_FAILURE : EXIT_SUCCESS;
+}
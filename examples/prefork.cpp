@@ -0,0 +1,60 @@
+/*
+ * QDjango
+ * Copyright (C) 2010-2011 Bolloré telecom
+ * See AUTHORS file for a full list of contributors.
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <cstdlib>
+
+#include <QCoreApplication>
+
+#include "QDjangoHttpController.h"
+#include "QDjangoHttpResponse.h"
+#include "QDjangoHttpServer.h"
+#include "QDjangoHttpSupervisor.h"
+
+class HelloController : public QDjangoHttpController
+{
+public:
+    QDjangoHttpResponse* respondToRequest(const QDjangoHttpRequest &request)
+    {
+        QDjangoHttpResponse *response = new QDjangoHttpResponse;
+        response->setHeader("Content-Type", "text/plain");
+        response->setBody("hello");
+        return response;
+    }
+};
+
+int main(int argc, char* argv[])
+{
+    // fork the worker processes before any thread is started
+    QDjangoHttpSupervisor supervisor(argc > 1 ? atoi(argv[1]) : 4);
+    if (!supervisor.run())
+        return EXIT_SUCCESS;
+
+    QCoreApplication app(argc, argv);
+
+    HelloController controller;
+
+    QDjangoHttpServer server;
+    server.setController(&controller);
+    server.setWorkerCount(argc > 2 ? atoi(argv[2]) : 0);
+    if (!server.listenReusePort(QHostAddress::Any, 8092))
+        return EXIT_FAILURE;
+
+    return app.exec();
+}
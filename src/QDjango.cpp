@@ -17,27 +17,342 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <climits>
+
 #include <QCoreApplication>
 #include <QDebug>
+#include <QElapsedTimer>
 #include <QMetaProperty>
 #include <QSqlDriver>
 #include <QSqlError>
+#include <QSqlField>
 #include <QSqlQuery>
+#include <QSqlRecord>
 #include <QStringList>
 #include <QThread>
+#include <QThreadStorage>
 
 #include "QDjango.h"
+#include "QDjangoMetrics.h"
+#include "QDjangoQueryCache.h"
+#include "QDjangoQueryObserver.h"
 #include "QDjangoQuerySet_p.h"
 #include "QDjangoModel.h"
+#include "QDjangoTracer.h"
+
+/** Per-thread state used to route reads to the primary database.
+ */
+class QDjangoThreadState
+{
+public:
+    QDjangoThreadState()
+        : inTransaction(false)
+    {
+    }
+
+    QElapsedTimer lastWrite;
+    bool inTransaction;
+    QSet<QString> uncommittedTables;
+    QSet<QString> openTransactions;
+};
 
 static const char *connectionPrefix = "_qdjango_";
 
 QMap<QString, QDjangoMetaModel> globalMetaModels = QMap<QString, QDjangoMetaModel>();
 static QDjangoDatabase *globalDatabase = 0;
+static QList<QDjangoDatabase*> globalReplicas;
+static QAtomicInt globalConnectionId(0);
+static QAtomicInt globalReplicaIndex(0);
+static QDjango::ReplicaPolicy globalReplicaPolicy = QDjango::RoundRobin;
+static int globalReadYourWritesWindow = 1000;
+static QThreadStorage<QDjangoThreadState*> threadStates;
+static QMap<QString, QDjangoDatabase*> globalAliases;
+static QDjango::DatabaseRouter globalDatabaseRouter = 0;
+static QList<QDjangoDatabase*> globalShards;
+static QDjango::ShardFunction globalShardFunction = 0;
+static QList<QDjangoQueryObserver*> globalObservers;
+static QAtomicInt globalObserverCount(0);
+static QMutex globalObserversMutex;
+#ifdef QDJANGO_DEBUG_SQL
+static bool globalDebugSql = true;
+#else
+static bool globalDebugSql = false;
+#endif
+static int globalSlowQueryThreshold = -1;
+static QList<QVariantMap> globalSlowQueries;
+static QMutex globalSlowQueriesMutex;
+static const int slowQueryLogSize = 32;
+static QMap<QString, QVariantMap> globalProfiles;
+static QMutex globalProfilesMutex;
+static QMap<QString, int> globalSqliteVersions;
+static QMutex globalSqliteVersionsMutex;
+static QDjangoCounter queryCounter("qdjango_queries_total", "Number of SQL queries executed.");
+static QDjangoCounter queryErrorCounter("qdjango_query_errors_total", "Number of SQL queries which failed.");
+static QDjangoHistogram queryDuration("qdjango_query_duration_seconds", "Duration of SQL queries in seconds.");
+
+static QDjangoThreadState *threadState()
+{
+    if (!threadStates.hasLocalData())
+        threadStates.setLocalData(new QDjangoThreadState);
+    return threadStates.localData();
+}
+
+/** Removes a connection opened by QDjango for a thread.
+ *
+ * \param connectionName
+ */
+static void removeConnection(const QString &connectionName)
+{
+    if (!connectionName.startsWith(QLatin1String(connectionPrefix)))
+        return;
+    QSqlDatabase::removeDatabase(connectionName);
+    QMutexLocker versionsLocker(&globalSqliteVersionsMutex);
+    globalSqliteVersions.remove(connectionName);
+}
 
 QDjangoDatabase::QDjangoDatabase(QObject *parent)
-    : QObject(parent), connectionId(0)
+    : QObject(parent),
+    threadPool(0),
+    schemaLoaded(false),
+    activeQueries(0),
+    queryCount(0),
+    errorCount(0),
+    totalTime(0),
+    maxTime(0)
+{
+}
+
+/** Destroys the database, removing the connections it opened for other
+ *  threads.
+ */
+QDjangoDatabase::~QDjangoDatabase()
+{
+    QMutexLocker locker(&mutex);
+    QStringList connectionNames;
+    foreach (const QSqlDatabase &db, copies)
+        connectionNames << db.connectionName();
+    copies.clear();
+    foreach (const QString &connectionName, connectionNames)
+        removeConnection(connectionName);
+}
+
+QDjangoQueryEvent::QDjangoQueryEvent()
+    : thread(0),
+    duration(0),
+    rowCount(-1)
+{
+}
+
+QDjangoQueryObserver::~QDjangoQueryObserver()
+{
+}
+
+/** Returns true if the given SQL is an INSERT, UPDATE or DELETE statement.
+ */
+static bool isWriteStatement(const QString &sql)
+{
+    const QString verb = sql.trimmed().section(QLatin1Char(' '), 0, 0).toUpper();
+    return verb == QLatin1String("INSERT") ||
+           verb == QLatin1String("UPDATE") ||
+           verb == QLatin1String("DELETE");
+}
+
+/** Returns true if the plan of the given SQL can be captured, that is if
+ *  it is a SELECT, INSERT, UPDATE or DELETE statement.
+ */
+static bool isExplainable(const QString &sql)
+{
+    return sql.trimmed().section(QLatin1Char(' '), 0, 0).toUpper() == QLatin1String("SELECT") ||
+           isWriteStatement(sql);
+}
+
+/** Returns true if the current thread has a transaction open on the given
+ *  connection.
+ */
+static bool hasOpenTransaction(const QString &connectionName)
+{
+    return threadStates.hasLocalData() &&
+           threadStates.localData()->openTransactions.contains(connectionName);
+}
+
+/** Executes the prepared statement, recording it in the metrics and the
+ *  slow query log, and reporting it to the query observers, the tracer
+ *  and the debug output if enabled.
+ */
+bool QDjangoQuery::exec()
+{
+    QDjangoTraceSpan span("sql.exec", "sql");
+    if (span.isActive())
+        span.setDetail(lastQuery());
+
+    QElapsedTimer timer;
+    timer.start();
+    const bool ok = QSqlQuery::exec();
+    const qint64 duration = timer.nsecsElapsed() / 1000;
+
+    queryCounter.increment();
+    if (!ok)
+        queryErrorCounter.increment();
+    queryDuration.observe(duration / 1000000.0);
+
+    // capture the plan of slow queries, on the connection which ran them,
+    // unless a failing EXPLAIN could abort the transaction it is part of
+    const int threshold = globalSlowQueryThreshold;
+    if (ok && threshold >= 0 && duration >= qint64(threshold) * 1000) {
+        QVariantList values;
+        for (int i = 0; i < boundValues().size(); ++i)
+            values << boundValue(i);
+
+        QVariantMap entry;
+        entry.insert("sql", lastQuery());
+        entry.insert("values", values);
+        entry.insert("connectionName", m_connectionName);
+        entry.insert("duration", duration / 1000.0);
+        entry.insert("time", QDateTime::currentDateTime());
+        if (isExplainable(lastQuery()) && !hasOpenTransaction(m_connectionName))
+            entry.insert("plan", QDjango::explain(QSqlDatabase::database(m_connectionName, false), lastQuery(), values, false));
+        else
+            entry.insert("plan", QString());
+
+        QMutexLocker locker(&globalSlowQueriesMutex);
+        globalSlowQueries << entry;
+        while (globalSlowQueries.size() > slowQueryLogSize)
+            globalSlowQueries.removeFirst();
+    }
+
+    // avoid building an event when queries are not observed
+    if (!globalDebugSql && !globalObserverCount)
+        return ok;
+
+    QDjangoQueryEvent event;
+    event.duration = duration;
+    event.sql = lastQuery();
+    for (int i = 0; i < boundValues().size(); ++i)
+        event.values << boundValue(i);
+    event.connectionName = m_connectionName;
+    event.thread = QThread::currentThread();
+    // statements with a RETURNING clause are selects, but report the
+    // number of rows they modified
+    if (ok)
+        event.rowCount = (!isSelect() || isWriteStatement(event.sql)) ? numRowsAffected() : size();
+    else
+        event.error = lastError();
+
+    if (globalDebugSql) {
+        qDebug() << "SQL query" << event.sql << "took" << event.duration << "us";
+        for (int i = 0; i < event.values.size(); ++i)
+            qDebug() << "   " << i << "=" << event.values[i].toString().toAscii().data();
+        if (!ok)
+            qWarning() << "SQL error" << event.error;
+    }
+
+    if (globalObserverCount) {
+        globalObserversMutex.lock();
+        const QList<QDjangoQueryObserver*> observers = globalObservers;
+        globalObserversMutex.unlock();
+        foreach (QDjangoQueryObserver *observer, observers)
+            observer->queryExecuted(event);
+    }
+    return ok;
+}
+
+/** Returns the connection to use from the current thread.
+ *
+ *  The reference connection is used from the thread which owns this
+ *  object, other threads are given their own copy.
+ */
+QSqlDatabase QDjangoDatabase::connection()
+{
+    QThread *thread = QThread::currentThread();
+
+    // if we are in the owner thread, return reference connection
+    if (thread == this->thread())
+        return reference;
+
+    // if we have a connection for this thread, return it
+    QMutexLocker locker(&mutex);
+    if (copies.contains(thread))
+        return copies[thread];
+
+    // create a new connection for this thread
+    QObject::connect(thread, SIGNAL(finished()), this, SLOT(threadFinished()));
+    QSqlDatabase db = QSqlDatabase::cloneDatabase(reference,
+        QLatin1String(connectionPrefix) + QString::number(globalConnectionId.fetchAndAddOrdered(1)));
+    if (db.open())
+        QDjango::applyConnectionProfile(db);
+    copies.insert(thread, db);
+    return db;
+}
+
+/** Executes a query on one of this database's connections and records
+ *  its duration.
+ *
+ * \param query
+ */
+bool QDjangoDatabase::exec(QDjangoQuery &query)
 {
+    activeQueries.ref();
+    QElapsedTimer timer;
+    timer.start();
+    const bool ok = query.exec();
+    const qint64 elapsed = timer.nsecsElapsed() / 1000;
+    activeQueries.deref();
+
+    {
+        QMutexLocker locker(&mutex);
+        queryCount++;
+        if (!ok)
+            errorCount++;
+        totalTime += elapsed;
+        maxTime = qMax(maxTime, elapsed);
+    }
+    return ok;
+}
+
+/** Returns true if the database contains the given table.
+ *
+ *  The list of tables is read once and kept until invalidateSchema()
+ *  is called, so that checking many models costs a single catalog query.
+ *
+ * \param table
+ */
+bool QDjangoDatabase::hasTable(const QString &table)
+{
+    QMutexLocker locker(&mutex);
+    if (!schemaLoaded) {
+        // connection() also locks the mutex
+        locker.unlock();
+        const QStringList tables = connection().tables();
+        locker.relock();
+        schemaTables = tables.toSet();
+        schemaLoaded = true;
+    }
+    return schemaTables.contains(table);
+}
+
+/** Records the creation or removal of a table by QDjango.
+ *
+ * \param table
+ * \param exists
+ */
+void QDjangoDatabase::setTableExists(const QString &table, bool exists)
+{
+    QMutexLocker locker(&mutex);
+    if (!schemaLoaded)
+        return;
+    if (exists)
+        schemaTables.insert(table);
+    else
+        schemaTables.remove(table);
+}
+
+/** Discards the schema snapshot, it will be read again when needed.
+ */
+void QDjangoDatabase::invalidateSchema()
+{
+    QMutexLocker locker(&mutex);
+    schemaLoaded = false;
+    schemaTables.clear();
 }
 
 void QDjangoDatabase::threadFinished()
@@ -51,12 +366,19 @@ void QDjangoDatabase::threadFinished()
     disconnect(thread, SIGNAL(finished()), this, SLOT(threadFinished()));
     const QString connectionName = copies.value(thread).connectionName();
     copies.remove(thread);
-    if (connectionName.startsWith(QLatin1String(connectionPrefix)))
-        QSqlDatabase::removeDatabase(connectionName);
+    removeConnection(connectionName);
 }
 
 static void closeDatabase()
 {
+    // wait for asynchronous operations to complete
+    delete globalDatabase->threadPool;
+    qDeleteAll(globalReplicas);
+    globalReplicas.clear();
+    qDeleteAll(globalShards);
+    globalShards.clear();
+    qDeleteAll(globalAliases);
+    globalAliases.clear();
     delete globalDatabase;
 }
 
@@ -79,57 +401,736 @@ static void closeDatabase()
  *  a new connection to the database will be created. The connection will
  *  automatically be torn down once the thread finishes.
  *
- *  \sa setDatabase()
+ *  \sa setDatabase()
+ */
+QSqlDatabase QDjango::database()
+{
+    Q_ASSERT(globalDatabase != 0);
+    return globalDatabase->connection();
+}
+
+/** Sets the database used by QDjango.
+ *
+ *  You must call this method from your application's main thread.
+ *
+ *  \sa database()
+ */
+void QDjango::setDatabase(QSqlDatabase database)
+{
+    if (database.driverName() != QLatin1String("QSQLITE") &&
+        database.driverName() != QLatin1String("QSQLITE2") &&
+        database.driverName() != QLatin1String("QMYSQL") &&
+        database.driverName() != QLatin1String("QPSQL"))
+    {
+        qWarning() << "Unsupported database driver" << database.driverName();
+    }
+    if (!globalDatabase)
+    {
+        globalDatabase = new QDjangoDatabase();
+        qAddPostRoutine(closeDatabase);
+    }
+    globalDatabase->reference = database;
+    globalDatabase->invalidateSchema();
+    if (database.isOpen())
+        applyConnectionProfile(globalDatabase->reference);
+}
+
+/** Returns the database registered under the given alias.
+ *
+ *  As with database(), threads other than the application's main thread
+ *  are given their own connection. If \a alias is empty, the database set
+ *  with setDatabase() is returned.
+ *
+ * \param alias
+ *
+ *  \sa setDatabase()
+ */
+QSqlDatabase QDjango::database(const QString &alias)
+{
+    return namedDatabase(alias)->connection();
+}
+
+/** Registers a database under the given alias.
+ *
+ *  Models are assigned to an alias using the \c db_alias option in their
+ *  \c __meta__ class information or using setDatabaseRouter(), other
+ *  models use the database set with setDatabase(). Each aliased database
+ *  has its own per-thread connections and connection profile.
+ *
+ *  Registering a database under an existing alias replaces it, closing
+ *  the connections the previous database opened for other threads.
+ *
+ *  You must call this method from your application's main thread, after
+ *  calling setDatabase(), while no other thread accesses the database.
+ *
+ * \param alias
+ * \param database
+ */
+void QDjango::setDatabase(const QString &alias, QSqlDatabase database)
+{
+    Q_ASSERT(globalDatabase != 0);
+    Q_ASSERT(!alias.isEmpty());
+
+    // per-thread connections are cloned from the previous database
+    delete globalAliases.take(alias);
+    QDjangoDatabase *named = new QDjangoDatabase;
+    globalAliases.insert(alias, named);
+    named->reference = database;
+    if (database.isOpen())
+        applyConnectionProfile(named->reference);
+}
+
+/** Unregisters the database with the given alias, so that the models
+ *  assigned to it use the database set with setDatabase().
+ *
+ *  The connections the database opened for other threads are closed.
+ *  You must call this method from your application's main thread, while
+ *  no other thread accesses the database.
+ *
+ * \param alias
+ */
+void QDjango::removeDatabase(const QString &alias)
+{
+    delete globalAliases.take(alias);
+}
+
+/** Returns the aliases of the registered databases.
+ */
+QStringList QDjango::databaseAliases()
+{
+    return globalAliases.keys();
+}
+
+/** Sets the function which assigns models to database aliases.
+ *
+ *  The router is consulted when a model is registered and takes
+ *  precedence over the model's \c db_alias option, so you must set it
+ *  before calling registerModel().
+ *
+ * \param router
+ */
+void QDjango::setDatabaseRouter(DatabaseRouter router)
+{
+    globalDatabaseRouter = router;
+}
+
+/** Returns the database with the given alias, or the main database if
+ *  the alias is empty or unknown.
+ */
+QDjangoDatabase *QDjango::namedDatabase(const QString &alias)
+{
+    Q_ASSERT(globalDatabase != 0);
+    if (alias.isEmpty())
+        return globalDatabase;
+
+    QDjangoDatabase *named = globalAliases.value(alias);
+    if (!named) {
+        qWarning() << "Unknown database alias" << alias;
+        return globalDatabase;
+    }
+    return named;
+}
+
+/** Returns the tuning profile for the given database driver.
+ *
+ * \param driverName
+ *
+ *  \sa setConnectionProfile()
+ */
+QVariantMap QDjango::connectionProfile(const QString &driverName)
+{
+    QMutexLocker locker(&globalProfilesMutex);
+    return globalProfiles.value(driverName);
+}
+
+/** Sets the tuning profile for the given database driver.
+ *
+ *  The settings are applied to every connection QDjango opens with that
+ *  driver: the connection passed to setDatabase() and the per-thread
+ *  connections created by database(). Depending on the driver, each
+ *  setting is issued as:
+ *
+ *  \li QSQLITE: PRAGMA name = value, for instance journal_mode,
+ *  synchronous, cache_size, mmap_size or busy_timeout
+ *  \li QPSQL: SET name = value, for instance work_mem or statement_timeout
+ *  \li QMYSQL: SET SESSION name = value
+ *
+ *  \code
+ *  QVariantMap profile;
+ *  profile.insert("journal_mode", "WAL");
+ *  profile.insert("synchronous", "NORMAL");
+ *  profile.insert("busy_timeout", 5000);
+ *  QDjango::setConnectionProfile("QSQLITE", profile);
+ *  \endcode
+ *
+ *  If the main connection is already open, it is tuned immediately.
+ *
+ * \param driverName
+ * \param settings
+ */
+void QDjango::setConnectionProfile(const QString &driverName, const QVariantMap &settings)
+{
+    globalProfilesMutex.lock();
+    globalProfiles.insert(driverName, settings);
+    globalProfilesMutex.unlock();
+
+    if (globalDatabase &&
+        globalDatabase->reference.driverName() == driverName &&
+        globalDatabase->reference.isOpen())
+        applyConnectionProfile(globalDatabase->reference);
+}
+
+/** Returns the pool of threads used to run asynchronous database
+ *  operations such as QDjangoQuerySet::fetchAsync().
+ *
+ *  Each thread in the pool has its own database connection, as returned by
+ *  database(). Threads are kept alive so that their connections can be
+ *  reused, you can use QThreadPool::setMaxThreadCount() to limit the
+ *  number of connections.
+ *
+ *  You must call setDatabase() before calling this method.
+ */
+QThreadPool *QDjango::threadPool()
+{
+    Q_ASSERT(globalDatabase != 0);
+
+    QMutexLocker locker(&globalDatabase->mutex);
+    if (!globalDatabase->threadPool) {
+        globalDatabase->threadPool = new QThreadPool;
+        globalDatabase->threadPool->setExpiryTimeout(-1);
+    }
+    return globalDatabase->threadPool;
+}
+
+/** Adds a read replica of the database set with setDatabase().
+ *
+ *  Once replicas have been added, querysets are fetched and counted on a
+ *  replica chosen according to replicaPolicy(), while writes and
+ *  transactions use the primary database.
+ *
+ *  You must call this method from your application's main thread, before
+ *  other threads access the database.
+ *
+ * \param database
+ *
+ *  \sa setReadYourWritesWindow()
+ */
+void QDjango::addReplica(QSqlDatabase database)
+{
+    Q_ASSERT(globalDatabase != 0);
+
+    QDjangoDatabase *replica = new QDjangoDatabase;
+    replica->reference = database;
+    if (database.isOpen())
+        applyConnectionProfile(replica->reference);
+    globalReplicas << replica;
+}
+
+/** Removes all the read replicas, so that reads use the primary database.
+ *
+ *  The connections the replicas opened for other threads are closed.
+ *  You must call this method from your application's main thread, while
+ *  no other thread accesses the database.
+ */
+void QDjango::clearReplicas()
+{
+    qDeleteAll(globalReplicas);
+    globalReplicas.clear();
+}
+
+/** Returns the policy used to choose the replica which serves a read.
+ */
+QDjango::ReplicaPolicy QDjango::replicaPolicy()
+{
+    return globalReplicaPolicy;
+}
+
+/** Sets the policy used to choose the replica which serves a read.
+ *
+ *  The default policy is RoundRobin.
+ *
+ * \param policy
+ */
+void QDjango::setReplicaPolicy(ReplicaPolicy policy)
+{
+    globalReplicaPolicy = policy;
+}
+
+/** Returns the time in milliseconds during which reads from a thread go
+ *  to the primary database after that thread has written to it.
+ */
+int QDjango::readYourWritesWindow()
+{
+    return globalReadYourWritesWindow;
+}
+
+/** Sets the time in milliseconds during which reads from a thread go to
+ *  the primary database after that thread has written to it.
+ *
+ *  This allows a thread to read its own writes despite replication lag.
+ *  Every write restarts the window, as does committing a transaction
+ *  begun with transaction(); reads made while such a transaction is
+ *  open always go to the primary database. The default value is 1000,
+ *  0 disables the window.
+ *
+ * \param msecs
+ */
+void QDjango::setReadYourWritesWindow(int msecs)
+{
+    Q_ASSERT(msecs >= 0);
+    globalReadYourWritesWindow = msecs;
+}
+
+/** Returns statistics for each read replica, in the order they were added.
+ *
+ *  Each entry contains the following keys:
+ *
+ *  \li \c connectionName the name of the replica's main connection
+ *  \li \c hostName the replica's host name
+ *  \li \c activeQueries the number of queries currently running
+ *  \li \c queryCount the number of queries which were run
+ *  \li \c errorCount the number of queries which failed
+ *  \li \c averageLatency the average query duration in microseconds
+ *  \li \c maxLatency the longest query duration in microseconds
+ */
+QList<QVariantMap> QDjango::replicaStatistics()
+{
+    QList<QVariantMap> statistics;
+    foreach (QDjangoDatabase *replica, globalReplicas) {
+        QMutexLocker locker(&replica->mutex);
+        QVariantMap stats;
+        stats.insert("connectionName", replica->reference.connectionName());
+        stats.insert("hostName", replica->reference.hostName());
+        stats.insert("activeQueries", int(replica->activeQueries));
+        stats.insert("queryCount", replica->queryCount);
+        stats.insert("errorCount", replica->errorCount);
+        stats.insert("averageLatency", replica->queryCount ?
+            double(replica->totalTime) / replica->queryCount : 0.0);
+        stats.insert("maxLatency", replica->maxTime);
+        statistics << stats;
+    }
+    return statistics;
+}
+
+/** Installs an observer which is notified of every SQL statement QDjango
+ *  runs, from any thread.
+ *
+ *  The observer is not owned by QDjango, it must remain valid until it is
+ *  removed with removeQueryObserver() and no statement is running.
+ *
+ * \param observer
+ */
+void QDjango::addQueryObserver(QDjangoQueryObserver *observer)
+{
+    Q_ASSERT(observer);
+
+    QMutexLocker locker(&globalObserversMutex);
+    if (!globalObservers.contains(observer)) {
+        globalObservers << observer;
+        globalObserverCount.ref();
+    }
+}
+
+/** Removes an observer installed with addQueryObserver().
+ *
+ * \param observer
+ */
+void QDjango::removeQueryObserver(QDjangoQueryObserver *observer)
+{
+    QMutexLocker locker(&globalObserversMutex);
+    if (globalObservers.removeAll(observer))
+        globalObserverCount.deref();
+}
+
+/** Returns true if SQL statements are written to the debug output.
+ */
+bool QDjango::isDebugEnabled()
+{
+    return globalDebugSql;
+}
+
+/** Sets whether SQL statements are written to the debug output, along
+ *  with their bound values and duration. Failed statements also output
+ *  a warning.
+ *
+ *  This is disabled by default, unless QDjango was built with the
+ *  QDJANGO_DEBUG_SQL option.
+ *
+ * \param enabled
+ */
+void QDjango::setDebugEnabled(bool enabled)
+{
+    globalDebugSql = enabled;
+}
+
+/** Returns the duration in milliseconds above which the SQL statements
+ *  run by QDjango are captured, or -1 if capture is disabled.
+ *
+ *  \sa setSlowQueryThreshold()
+ */
+int QDjango::slowQueryThreshold()
+{
+    return globalSlowQueryThreshold;
+}
+
+/** Sets the duration in milliseconds above which the SQL statements run by
+ *  QDjango, including those of querysets, saves and deletes, are
+ *  captured. A value of -1, which is the default, disables capture.
+ *
+ *  For SELECT, INSERT, UPDATE and DELETE statements, the plan is obtained
+ *  by running EXPLAIN on the same connection once the statement has
+ *  completed. It is not captured for other statements, nor while a
+ *  transaction begun by QDjango is open on that connection, as a failing
+ *  EXPLAIN would abort the transaction on some databases. The last
+ *  captured queries can be retrieved with slowQueries().
+ *
+ * \param msecs
+ */
+void QDjango::setSlowQueryThreshold(int msecs)
+{
+    globalSlowQueryThreshold = msecs;
+}
+
+/** Returns the last 32 slow queries, oldest first.
+ *
+ *  Each entry holds the following keys:
+ *
+ *  \li \c sql the SQL statement
+ *  \li \c values the bound values, as a QVariantList
+ *  \li \c connectionName the name of the database connection
+ *  \li \c duration the query duration in milliseconds
+ *  \li \c time the time at which the query completed
+ *  \li \c plan the query plan, or an empty string if it was not captured
+ *
+ *  \sa setSlowQueryThreshold()
+ */
+QList<QVariantMap> QDjango::slowQueries()
+{
+    QMutexLocker locker(&globalSlowQueriesMutex);
+    return globalSlowQueries;
+}
+
+/** Discards the captured slow queries.
+ */
+void QDjango::clearSlowQueries()
+{
+    QMutexLocker locker(&globalSlowQueriesMutex);
+    globalSlowQueries.clear();
+}
+
+/** Returns the plan the database uses to run an SQL statement, or an empty
+ *  string if it could not be determined.
+ *
+ * \param db
+ * \param sql
+ * \param values the values to bind to the statement
+ * \param analyze whether to run the statement to report actual costs,
+ *  if the database supports it
+ */
+QString QDjango::explain(QSqlDatabase db, const QString &sql, const QVariantList &values, bool analyze)
+{
+    const QString driverName = db.driverName();
+    QString prefix;
+    if (driverName == QLatin1String("QSQLITE") ||
+        driverName == QLatin1String("QSQLITE2"))
+        prefix = QLatin1String("EXPLAIN QUERY PLAN ");
+    else if (driverName == QLatin1String("QPSQL") ||
+             driverName == QLatin1String("QMYSQL"))
+        prefix = QLatin1String(analyze ? "EXPLAIN ANALYZE " : "EXPLAIN ");
+    else
+        return QString();
+
+    // a plain QSqlQuery, so that explaining a slow query is not recorded
+    QSqlQuery query(db);
+    if (!query.prepare(prefix + sql))
+        return QString();
+    foreach (const QVariant &value, values)
+        query.addBindValue(value);
+    if (!query.exec())
+        return QString();
+
+    QStringList lines;
+    while (query.next()) {
+        QStringList columns;
+        for (int i = 0; i < query.record().count(); ++i)
+            columns << query.value(i).toString();
+        lines << columns.join(QLatin1String("|"));
+    }
+    return lines.join(QLatin1String("\n"));
+}
+
+/** Returns the database which should serve a read from the current thread.
+ */
+QDjangoDatabase *QDjango::readSource()
+{
+    Q_ASSERT(globalDatabase != 0);
+    const int count = globalReplicas.size();
+    if (!count)
+        return globalDatabase;
+
+    // read your own writes, including uncommitted ones
+    if (threadStates.hasLocalData()) {
+        const QDjangoThreadState *state = threadStates.localData();
+        if (state->inTransaction ||
+            (globalReadYourWritesWindow > 0 && state->lastWrite.isValid() &&
+             !state->lastWrite.hasExpired(globalReadYourWritesWindow)))
+            return globalDatabase;
+    }
+
+    // rotate the starting point so that ties are spread evenly
+    const int start = (globalReplicaIndex.fetchAndAddOrdered(1) & INT_MAX) % count;
+    if (globalReplicaPolicy == LeastLoaded) {
+        QDjangoDatabase *best = 0;
+        int bestLoad = INT_MAX;
+        for (int i = 0; i < count; ++i) {
+            QDjangoDatabase *replica = globalReplicas[(start + i) % count];
+            const int load = replica->activeQueries;
+            if (load < bestLoad) {
+                best = replica;
+                bestLoad = load;
+            }
+        }
+        return best;
+    }
+    return globalReplicas[start];
+}
+
+/** Records that the current thread has written to a table using the
+ *  given connection.
+ *
+ *  Only writes to the primary database matter, as replicas only exist
+ *  for that database and transaction() only tracks its transactions.
+ *
+ * \param table
+ * \param db
+ */
+void QDjango::writeCompleted(const QString &table, const QSqlDatabase &db)
+{
+    if (globalReplicas.isEmpty() && !threadStates.hasLocalData())
+        return;
+    if (db.connectionName() != globalDatabase->connection().connectionName())
+        return;
+
+    QDjangoThreadState *state = threadState();
+    if (state->inTransaction)
+        state->uncommittedTables.insert(table);
+    else if (!globalReplicas.isEmpty())
+        state->lastWrite.start();
+}
+
+/** Returns true if the current thread has written to any of the given
+ *  tables within a transaction which has not been committed yet.
+ *
+ * \param tables
+ */
+bool QDjango::hasUncommittedWrites(const QStringList &tables)
+{
+    if (!threadStates.hasLocalData())
+        return false;
+    const QSet<QString> &uncommitted = threadStates.localData()->uncommittedTables;
+    foreach (const QString &table, tables)
+        if (uncommitted.contains(table))
+            return true;
+    return false;
+}
+
+/** Ends the current thread's transaction, invalidating the cached query
+ *  results for the tables it wrote to.
+ */
+static void transactionFinished(QDjangoThreadState *state)
+{
+    state->inTransaction = false;
+    foreach (const QString &table, state->uncommittedTables)
+        QDjangoQueryCache::invalidate(table);
+    state->uncommittedTables.clear();
+}
+
+/** Begins a transaction on the primary database connection of the
+ *  current thread.
+ *
+ *  While the transaction is open, reads from the current thread are
+ *  routed to the primary database so that they see its uncommitted
+ *  writes. Transactions begun directly on the QSqlDatabase are not
+ *  tracked.
+ *
+ *  \sa commit(), rollback()
+ */
+bool QDjango::transaction()
+{
+    if (!beginTransaction(database()))
+        return false;
+    threadState()->inTransaction = true;
+    return true;
+}
+
+/** Commits the transaction begun with transaction().
+ *
+ *  The read-your-writes window starts once the transaction is committed,
+ *  and the cached query results for the tables it wrote to are
+ *  invalidated.
+ *
+ *  \sa setReadYourWritesWindow()
+ */
+bool QDjango::commit()
+{
+    QDjangoThreadState *state = threadState();
+    if (!endTransaction(database(), true))
+        return false;
+    if (state->inTransaction) {
+        transactionFinished(state);
+        state->lastWrite.start();
+    }
+    return true;
+}
+
+/** Rolls back the transaction begun with transaction().
+ */
+bool QDjango::rollback()
+{
+    const bool ok = endTransaction(database(), false);
+    transactionFinished(threadState());
+    return ok;
+}
+
+/** Begins a transaction on the given connection, recording it so that
+ *  slow statements run within it do not have their plan captured.
+ *
+ * \param db
+ */
+bool QDjango::beginTransaction(QSqlDatabase db)
+{
+    if (!db.transaction())
+        return false;
+    threadState()->openTransactions.insert(db.connectionName());
+    return true;
+}
+
+/** Commits or rolls back a transaction begun with beginTransaction().
+ *
+ *  A transaction whose commit fails is still open, and must be rolled
+ *  back.
+ *
+ * \param db
+ * \param commit
+ */
+bool QDjango::endTransaction(QSqlDatabase db, bool commit)
+{
+    const bool ok = commit ? db.commit() : db.rollback();
+    if (ok || !commit)
+        threadState()->openTransactions.remove(db.connectionName());
+    return ok;
+}
+
+/** Adds a shard for the models which declare a \c shard_key option.
+ *
+ *  The rows of a sharded model are spread across the shards according to
+ *  the value of their shard key: saves, deletes and querysets which
+ *  filter on a single shard key value go to one shard, other querysets
+ *  are run on all the shards in parallel and their results are merged.
+ *  Models without a shard key keep using the database set with
+ *  setDatabase().
+ *
+ *  You must call this method from your application's main thread, before
+ *  other threads access the database.
+ *
+ * \param database
+ *
+ *  \sa setShardFunction()
+ */
+void QDjango::addShard(QSqlDatabase database)
+{
+    Q_ASSERT(globalDatabase != 0);
+
+    QDjangoDatabase *shard = new QDjangoDatabase;
+    shard->reference = database;
+    if (database.isOpen())
+        applyConnectionProfile(shard->reference);
+    globalShards << shard;
+}
+
+/** Removes all the shards, so that sharded models use the database set
+ *  with setDatabase().
+ *
+ *  The connections the shards opened for other threads, including those
+ *  of QDjango::threadPool() which never finish, are closed. You must call this method from your application's main thread, while
+ *  no other thread accesses the database.
+ */
+void QDjango::clearShards()
+{
+    qDeleteAll(globalShards);
+    globalShards.clear();
+}
+
+/** Returns the number of shards.
+ */
+int QDjango::shardCount()
+{
+    return globalShards.size();
+}
+
+/** Sets the function which maps a shard key value to a shard.
+ *
+ *  The default function hashes the value's string representation. The
+ *  function must not change once rows have been stored.
+ *
+ * \param function
  */
-QSqlDatabase QDjango::database()
+void QDjango::setShardFunction(ShardFunction function)
 {
-    Q_ASSERT(globalDatabase != 0);
-    QThread *thread = QThread::currentThread();
+    globalShardFunction = function;
+}
 
-    // if we are in the main thread, return reference connection
-    if (thread == globalDatabase->thread())
-        return globalDatabase->reference;
+/** Returns the shard which stores the rows with the given shard key value.
+ */
+QDjangoDatabase *QDjango::shard(const QVariant &key)
+{
+    Q_ASSERT(!globalShards.isEmpty());
+    const int count = globalShards.size();
+    const int index = globalShardFunction ?
+        globalShardFunction(key, count) : int(qHash(key.toString()) % uint(count));
+    Q_ASSERT(index >= 0 && index < count);
+    return globalShards[index];
+}
 
-    // if we have a connection for this thread, return it
-    QMutexLocker locker(&globalDatabase->mutex);
-    if (globalDatabase->copies.contains(thread))
-        return globalDatabase->copies[thread];
+/** Returns all the shards.
+ */
+QList<QDjangoDatabase*> QDjango::shards()
+{
+    return globalShards;
+}
 
-    // create a new connection for this thread
-    QObject::connect(thread, SIGNAL(finished()), globalDatabase, SLOT(threadFinished()));
-    QSqlDatabase db = QSqlDatabase::cloneDatabase(globalDatabase->reference,
-        QLatin1String(connectionPrefix) + QString::number(globalDatabase->connectionId++));
-    db.open();
-    globalDatabase->copies.insert(thread, db);
-    return db;
+QDjangoWriteNotifier::QDjangoWriteNotifier(const QString &table)
+    : m_table(table)
+{
 }
 
-/** Sets the database used by QDjango.
- *
- *  You must call this method from your application's main thread.
+QDjangoWriteNotifier::QDjangoWriteNotifier(const QString &table, const QSqlDatabase &db)
+    : m_table(table)
+{
+    m_databases << db;
+}
+
+QDjangoWriteNotifier::~QDjangoWriteNotifier()
+{
+    QDjangoQueryCache::invalidate(m_table);
+    foreach (const QSqlDatabase &db, m_databases)
+        QDjango::writeCompleted(m_table, db);
+}
+
+/** Records that the write also touches the given connection.
  *
- *  \sa database()
+ * \param db
  */
-void QDjango::setDatabase(QSqlDatabase database)
+void QDjangoWriteNotifier::addDatabase(const QSqlDatabase &db)
 {
-    if (database.driverName() != QLatin1String("QSQLITE") &&
-        database.driverName() != QLatin1String("QSQLITE2") &&
-        database.driverName() != QLatin1String("QMYSQL") &&
-        database.driverName() != QLatin1String("QPSQL"))
-    {
-        qWarning() << "Unsupported database driver" << database.driverName();
-    }
-    if (!globalDatabase)
-    {
-        globalDatabase = new QDjangoDatabase();
-        qAddPostRoutine(closeDatabase);
-    }
-    globalDatabase->reference = database;
+    m_databases << db;
 }
 
 /** Creates the database tables for all registered models.
  *  Also checks if table with the same name as model's exist.  If it does,
  *  this function ignores this model.
+ *
+ *  \sa invalidateSchema()
  */
 bool QDjango::createTables()
 {
@@ -141,6 +1142,24 @@ bool QDjango::createTables()
     return ret;
 }
 
+/** Discards the list of existing tables QDjango keeps for each database.
+ *
+ *  QDjango reads the list of tables once per database and keeps it up to
+ *  date when it creates or drops tables. You must call this method if you
+ *  alter the schema by other means.
+ */
+void QDjango::invalidateSchema()
+{
+    if (globalDatabase)
+        globalDatabase->invalidateSchema();
+    foreach (QDjangoDatabase *database, globalAliases)
+        database->invalidateSchema();
+    foreach (QDjangoDatabase *database, globalReplicas)
+        database->invalidateSchema();
+    foreach (QDjangoDatabase *database, globalShards)
+        database->invalidateSchema();
+}
+
 /** Drops the database tables for all registered models.
  */
 bool QDjango::dropTables()
@@ -164,16 +1183,138 @@ QDjangoMetaModel QDjango::metaModel(const QString &name)
 QDjangoMetaModel QDjango::registerModel(const QObject *model)
 {
     const QString name = model->metaObject()->className();
-    if (!globalMetaModels.contains(name))
-        globalMetaModels.insert(name, QDjangoMetaModel(model));
+    if (!globalMetaModels.contains(name)) {
+        QDjangoMetaModel metaModel(model);
+        if (globalDatabaseRouter) {
+            const QString alias = globalDatabaseRouter(name);
+            if (!alias.isEmpty())
+                metaModel.m_alias = alias;
+        }
+        globalMetaModels.insert(name, metaModel);
+    }
     return globalMetaModels[name];
 }
 
+static bool isSettingName(const QString &name)
+{
+    if (name.isEmpty() || name[0].isDigit())
+        return false;
+    foreach (const QChar &c, name)
+        if (!(c.isLetterOrNumber() && c.unicode() < 128) && c != QLatin1Char('_') && c != QLatin1Char('.'))
+            return false;
+    return true;
+}
+
+/** Applies the tuning profile for the database's driver to an open
+ *  connection.
+ *
+ * \param db
+ * \return true if all the settings were applied, false otherwise
+ */
+bool QDjango::applyConnectionProfile(QSqlDatabase &db)
+{
+    const QString driverName = db.driverName();
+    const QVariantMap settings = connectionProfile(driverName);
+
+    QString statement;
+    if (driverName == QLatin1String("QSQLITE") ||
+        driverName == QLatin1String("QSQLITE2"))
+        statement = QLatin1String("PRAGMA %1 = %2");
+    else if (driverName == QLatin1String("QPSQL"))
+        statement = QLatin1String("SET %1 = %2");
+    else if (driverName == QLatin1String("QMYSQL"))
+        statement = QLatin1String("SET SESSION %1 = %2");
+    else
+        return settings.isEmpty();
+
+    bool ret = true;
+    QSqlDriver *driver = db.driver();
+    QMapIterator<QString, QVariant> i(settings);
+    while (i.hasNext()) {
+        i.next();
+
+        // setting names cannot be bound, so only accept identifiers
+        if (!isSettingName(i.key())) {
+            qWarning() << "Invalid connection setting" << i.key();
+            ret = false;
+            continue;
+        }
+
+        QSqlField field(QString(), i.value().type());
+        field.setValue(i.value());
+        QSqlQuery query(db);
+        if (!query.exec(statement.arg(i.key(), driver->formatValue(field)))) {
+            qWarning() << "Could not apply connection setting" << i.key() << query.lastError();
+            ret = false;
+        }
+    }
+    return ret;
+}
+
+/** Returns the SQLite library version of the given connection as
+ *  major * 1000 + minor, or 0 if it cannot be determined.
+ *
+ *  The version is queried once per connection.
+ */
+static int sqliteVersion(const QSqlDatabase &db)
+{
+    const QString connectionName = db.connectionName();
+    QMutexLocker locker(&globalSqliteVersionsMutex);
+    QMap<QString, int>::const_iterator it = globalSqliteVersions.constFind(connectionName);
+    if (it != globalSqliteVersions.constEnd())
+        return it.value();
+    locker.unlock();
+
+    int version = 0;
+    QSqlQuery query(db);
+    if (query.exec("SELECT sqlite_version()") && query.next()) {
+        const QStringList bits = query.value(0).toString().split(QLatin1Char('.'));
+        version = bits.value(0).toInt() * 1000 + bits.value(1).toInt();
+    }
+
+    locker.relock();
+    globalSqliteVersions.insert(connectionName, version);
+    return version;
+}
+
+/** Returns true if the database can return generated keys from an
+ *  INSERT statement using a RETURNING clause.
+ *
+ * \param db
+ */
+bool QDjango::hasInsertReturning(const QSqlDatabase &db)
+{
+    const QString driverName = db.driverName();
+    if (driverName == QLatin1String("QPSQL"))
+        return true;
+    else if (driverName == QLatin1String("QSQLITE"))
+        // RETURNING is available from SQLite 3.35 onwards
+        return sqliteVersion(db) >= 3035;
+    return false;
+}
+
+/** Returns the maximum number of values which can be bound to
+ *  a single statement.
+ *
+ * \param db
+ */
+int QDjango::maxBindValues(const QSqlDatabase &db)
+{
+    const QString driverName = db.driverName();
+    if (driverName == QLatin1String("QSQLITE") ||
+        driverName == QLatin1String("QSQLITE2"))
+        // SQLITE_MAX_VARIABLE_NUMBER defaults to 999
+        return 999;
+    else
+        // PostgreSQL and MySQL use a 16-bit parameter count
+        return 32767;
+}
+
 /** Returns the empty SQL limit clause.
  */
-QString QDjango::noLimitSql()
+QString QDjango::noLimitSql(const QSqlDatabase &db)
 {
-    const QString driverName = QDjango::database().driverName();
+    const QString driverName = db.driverName();
     if (driverName == QLatin1String("QSQLITE") ||
         driverName == QLatin1String("QSQLITE2"))
         return QLatin1String(" LIMIT -1");
@@ -192,21 +1333,86 @@ QDjangoMetaField::QDjangoMetaField()
 {
 }
 
+QDjangoMetaIndex::QDjangoMetaIndex()
+    : unique(false)
+{
+}
+
+/** Parses options of the form "keyword1=value1 .. keywordN=valueN".
+ *
+ *  Values containing spaces can be enclosed in double quotes.
+ */
 static QMap<QString, QString> parseOptions(const char *value)
 {
     QMap<QString, QString> options;
-    QStringList items = QString::fromUtf8(value).split(' ');
-    foreach (const QString &item, items) {
-        QStringList assign = item.split('=');
-        if (assign.size() == 2) {
-            options[assign[0].toLower()] = assign[1];
+    const QString str = QString::fromUtf8(value);
+    int pos = 0;
+    while (pos < str.size()) {
+        if (str[pos] == QLatin1Char(' ')) {
+            pos++;
+            continue;
+        }
+
+        // keyword
+        int end = str.indexOf(QLatin1Char(' '), pos);
+        if (end < 0)
+            end = str.size();
+        const int assign = str.indexOf(QLatin1Char('='), pos);
+        if (assign < 0 || assign > end) {
+            qWarning() << "Could not parse option" << str.mid(pos, end - pos);
+            pos = end;
+            continue;
+        }
+        const QString key = str.mid(pos, assign - pos).toLower();
+        pos = assign + 1;
+
+        // value
+        if (pos < str.size() && str[pos] == QLatin1Char('"')) {
+            end = str.indexOf(QLatin1Char('"'), pos + 1);
+            if (end < 0) {
+                qWarning() << "Unterminated quote in option" << key;
+                break;
+            }
+            options[key] = str.mid(pos + 1, end - pos - 1);
+            pos = end + 1;
         } else {
-            qWarning() << "Could not parse option" << item;
+            end = str.indexOf(QLatin1Char(' '), pos);
+            if (end < 0)
+                end = str.size();
+            options[key] = str.mid(pos, end - pos);
+            pos = end;
         }
     }
     return options;
 }
 
+/** Returns the column of a "range(column)" partitioning option, or an
+ *  empty string if the partitioning is not supported.
+ */
+static QByteArray parsePartitionKey(const QString &value, const QString &table)
+{
+    if (value.startsWith(QLatin1String("range(")) && value.endsWith(QLatin1Char(')')))
+        return value.mid(6, value.size() - 7).toLatin1();
+
+    qWarning() << "Unsupported partitioning" << value << "for" << table;
+    return QByteArray();
+}
+
+/** Parses a list of field groups of the form "a,b;c,d" into indexes.
+ */
+static QList<QDjangoMetaIndex> parseIndexes(const QString &value, bool unique)
+{
+    QList<QDjangoMetaIndex> indexes;
+    foreach (const QString &group, value.split(QLatin1Char(';'), QString::SkipEmptyParts)) {
+        QDjangoMetaIndex index;
+        foreach (const QString &name, group.split(QLatin1Char(','), QString::SkipEmptyParts))
+            index.fields << name.trimmed().toLatin1();
+        index.unique = unique;
+        indexes << index;
+    }
+    return indexes;
+}
+
 /** Constructs a new QDjangoMetaModel by inspecting the given model instance.
  *
  * \param model
@@ -228,7 +1434,44 @@ QDjangoMetaModel::QDjangoMetaModel(const QObject *model)
             option.next();
             if (option.key() == "db_table")
                 m_table = option.value();
+            else if (option.key() == "db_alias")
+                m_alias = option.value();
+            else if (option.key() == "shard_key")
+                m_shardKey = option.value().toLatin1();
+            else if (option.key() == "index_together")
+                m_indexes += parseIndexes(option.value(), false);
+            else if (option.key() == "partition_by")
+                m_partitionKey = parsePartitionKey(option.value(), m_table);
+            else if (option.key() == "partition_interval")
+                m_partitionInterval = option.value();
+            else if (option.key() == "unique_together")
+                m_indexes += parseIndexes(option.value(), true);
+        }
+    }
+
+    // parse index declarations
+    for (int i = 0; i < meta->classInfoCount(); ++i) {
+        if (qstrcmp(meta->classInfo(i).name(), "__index__"))
+            continue;
+
+        QDjangoMetaIndex index;
+        QMap<QString, QString> options = parseOptions(meta->classInfo(i).value());
+        QMapIterator<QString, QString> option(options);
+        while (option.hasNext()) {
+            option.next();
+            const QString value = option.value();
+            if (option.key() == "name")
+                index.name = value;
+            else if (option.key() == "fields")
+                index.fields = parseIndexes(value, false).value(0).fields;
+            else if (option.key() == "include")
+                index.include = parseIndexes(value, false).value(0).fields;
+            else if (option.key() == "unique")
+                index.unique = (value.toLower() == "true" || value == "1");
+            else if (option.key() == "where")
+                index.where = value;
         }
+        m_indexes << index;
     }
 
     const int count = meta->propertyCount();
@@ -318,15 +1561,80 @@ QDjangoMetaModel::QDjangoMetaModel(const QObject *model)
         m_primaryKey = field.name;
     }
 
+    // check the partitioning options
+    if (!m_partitionKey.isEmpty()) {
+        bool valid = false;
+        foreach (const QDjangoMetaField &field, m_localFields)
+            if (field.name == m_partitionKey)
+                valid = (field.type == QVariant::Date || field.type == QVariant::DateTime);
+        if (!valid) {
+            qWarning() << "Partition key" << m_partitionKey << "of" << m_table << "must be a date field";
+            m_partitionKey.clear();
+        }
+        if (m_partitionInterval != QLatin1String("day") &&
+            m_partitionInterval != QLatin1String("week") &&
+            m_partitionInterval != QLatin1String("year")) {
+            if (m_partitionInterval != QLatin1String("month"))
+                qWarning() << "Unsupported partition interval" << m_partitionInterval << "for" << m_table;
+            m_partitionInterval = QLatin1String("month");
+        }
+    }
+
+    // resolve the fields of model-level indexes to columns
+    for (int i = m_indexes.size() - 1; i >= 0; --i) {
+        QDjangoMetaIndex &index = m_indexes[i];
+        QList<QByteArray> columns;
+        foreach (const QByteArray &name, index.fields + index.include) {
+            QByteArray column = name;
+            if (name == "pk")
+                column = m_primaryKey;
+            else if (m_foreignFields.contains(name))
+                column = name + "_id";
+            foreach (const QDjangoMetaField &field, m_localFields) {
+                if (field.name == column) {
+                    columns << column;
+                    break;
+                }
+            }
+        }
+        if (index.fields.isEmpty() || columns.size() != index.fields.size() + index.include.size()) {
+            qWarning() << "Invalid index declaration for" << m_table;
+            m_indexes.removeAt(i);
+            continue;
+        }
+        index.fields = columns.mid(0, index.fields.size());
+        index.include = columns.mid(index.fields.size());
+        if (index.name.isEmpty()) {
+            QStringList bits;
+            foreach (const QByteArray &column, index.fields)
+                bits << QString::fromLatin1(column);
+            index.name = m_table + "_" + bits.join("_");
+        }
+    }
 }
 
 /** Creates the database table for this QDjangoMetaModel.
+ *
+ *  If the model is sharded, the table is created on every shard.
  */
 bool QDjangoMetaModel::createTable() const
 {
-    QSqlDatabase db = QDjango::database();
+    foreach (QDjangoDatabase *database, databases()) {
+        if (!createTable(database->connection())) {
+            // the table may have been partially created
+            database->invalidateSchema();
+            return false;
+        }
+        database->setTableExists(m_table, true);
+    }
+    return true;
+}
+
+bool QDjangoMetaModel::createTable(QSqlDatabase db) const
+{
     QSqlDriver *driver = db.driver();
     const QString driverName = db.driverName();
+    const bool partitioned = !m_partitionKey.isEmpty() && driverName == QLatin1String("QPSQL");
 
     QStringList propSql;
     const QString quotedTable = db.driver()->escapeIdentifier(m_table, QSqlDriver::TableName);
@@ -373,75 +1681,366 @@ bool QDjangoMetaModel::createTable() const
             continue;
         }
 
-        // primary key
-        if (field.primaryKey)
-            fieldSql += " PRIMARY KEY";
+        // primary key, which must include the partition key for
+        // partitioned tables
+        if (field.primaryKey && !partitioned)
+            fieldSql += " PRIMARY KEY";
+
+        // auto-increment is backend specific
+        if (field.autoIncrement) {
+            if (driverName == QLatin1String("QSQLITE") ||
+                driverName == QLatin1String("QSQLITE2"))
+                fieldSql += QLatin1String(" AUTOINCREMENT");
+            else if (driverName == QLatin1String("QMYSQL"))
+                fieldSql += QLatin1String(" AUTO_INCREMENT");
+            else if (driverName == QLatin1String("QPSQL"))
+                fieldSql = driver->escapeIdentifier(field.name, QSqlDriver::FieldName) + (partitioned ? " SERIAL" : " SERIAL PRIMARY KEY");
+        }
+
+        // foreign key
+        if (!field.foreignModel.isEmpty())
+        {
+            const QDjangoMetaModel foreignMeta = QDjango::metaModel(field.foreignModel);
+            fieldSql += QString(" REFERENCES %1 (%2)").arg(
+                driver->escapeIdentifier(foreignMeta.m_table, QSqlDriver::TableName),
+                driver->escapeIdentifier(foreignMeta.m_primaryKey, QSqlDriver::FieldName));
+        }
+        propSql << fieldSql;
+    }
+    QString partitionSql;
+    if (partitioned) {
+        const QString quotedKey = driver->escapeIdentifier(m_partitionKey, QSqlDriver::FieldName);
+        QString keySql = driver->escapeIdentifier(m_primaryKey, QSqlDriver::FieldName);
+        if (m_primaryKey != m_partitionKey)
+            keySql += ", " + quotedKey;
+        propSql << "PRIMARY KEY (" + keySql + ")";
+        partitionSql = " PARTITION BY RANGE (" + quotedKey + ")";
+    }
+
+    // create table
+    QDjangoQuery createQuery(db);
+    createQuery.prepare(QString("CREATE TABLE %1 (%2)%3").arg(
+            quotedTable,
+            propSql.join(", "),
+            partitionSql));
+    if (!createQuery.exec())
+        return false;
+
+    // create indices
+    foreach (const QDjangoMetaField &field, m_localFields)
+    {
+        // Postgres automatically creates indices on primary keys
+        if (field.primaryKey && driverName == QLatin1String("QPSQL"))
+            continue;
+
+        if (field.index)
+        {
+            const QString indexName = m_table + "_" + QString::fromLatin1(field.name);
+            QDjangoQuery indexQuery(db);
+            indexQuery.prepare(QString("CREATE %1 %2 ON %3 (%4)").arg(
+                field.primaryKey ? "UNIQUE INDEX" : "INDEX",
+                // FIXME : how should we escape an index name?
+                driver->escapeIdentifier(indexName, QSqlDriver::FieldName),
+                quotedTable,
+                driver->escapeIdentifier(field.name, QSqlDriver::FieldName)));
+            if (!indexQuery.exec())
+                return false;
+        }
+    }
+
+    // create model-level indices
+    foreach (const QDjangoMetaIndex &index, m_indexes)
+    {
+        const QString sql = indexSql(db, index);
+        if (sql.isEmpty())
+            continue;
+
+        QDjangoQuery indexQuery(db);
+        indexQuery.prepare(sql);
+        if (!indexQuery.exec())
+            return false;
+    }
+
+    // create the default partition, which holds the rows outside of the
+    // other partitions, and those for the current and next intervals
+    if (partitioned) {
+        QDjangoQuery defaultQuery(db);
+        defaultQuery.prepare(QString("CREATE TABLE %1 PARTITION OF %2 DEFAULT").arg(
+            driver->escapeIdentifier(m_table + "_default", QSqlDriver::TableName),
+            quotedTable));
+        if (!defaultQuery.exec())
+            return false;
+        return createPartitions(db, 1);
+    }
+
+    return true;
+}
+
+/** Returns true if the database supports indexes with a WHERE clause.
+ */
+static bool supportsPartialIndexes(const QSqlDatabase &db)
+{
+    const QString driverName = db.driverName();
+    if (driverName == QLatin1String("QPSQL"))
+        return true;
+    if (driverName != QLatin1String("QSQLITE"))
+        return false;
+
+    // SQLite supports partial indexes since version 3.8.0
+    return sqliteVersion(db) >= 3008;
+}
+
+/** Returns the SQL to create a model-level index, or an empty string if
+ *  the database cannot enforce it.
+ *
+ *  Covering columns use INCLUDE on PostgreSQL. Other databases get them
+ *  as trailing key columns, unless the index is unique. Partial indexes
+ *  are supported by PostgreSQL and SQLite 3.8 or later; other databases
+ *  get a full index, or none if the index is unique.
+ *
+ * \param db
+ * \param index
+ */
+QString QDjangoMetaModel::indexSql(const QSqlDatabase &db, const QDjangoMetaIndex &index) const
+{
+    QSqlDriver *driver = db.driver();
+    const QString driverName = db.driverName();
+    const bool postgres = (driverName == QLatin1String("QPSQL"));
+    const bool partial = !index.where.isEmpty() && supportsPartialIndexes(db);
+
+    if (index.unique && !index.where.isEmpty() && !partial) {
+        qWarning() << "Partial unique index" << index.name << "is not supported by" << driverName;
+        return QString();
+    }
+
+    QStringList columns;
+    foreach (const QByteArray &column, index.fields)
+        columns << driver->escapeIdentifier(column, QSqlDriver::FieldName);
+    QStringList included;
+    foreach (const QByteArray &column, index.include)
+        included << driver->escapeIdentifier(column, QSqlDriver::FieldName);
+    if (!postgres && !index.unique)
+        columns += included;
+
+    QString sql = QString("CREATE %1 %2 ON %3 (%4)").arg(
+        index.unique ? "UNIQUE INDEX" : "INDEX",
+        driver->escapeIdentifier(index.name, QSqlDriver::FieldName),
+        driver->escapeIdentifier(m_table, QSqlDriver::TableName),
+        columns.join(", "));
+    if (postgres && !included.isEmpty())
+        sql += " INCLUDE (" + included.join(", ") + ")";
+    if (partial)
+        sql += " WHERE " + index.where;
+    return sql;
+}
+
+/** Drops the database table for this QDjangoMetaModel.
+ *
+ *  If the model is sharded, the table is dropped on every shard.
+ */
+bool QDjangoMetaModel::dropTable() const
+{
+    bool ret = true;
+    foreach (QDjangoDatabase *database, databases()) {
+        if (dropTable(database->connection())) {
+            database->setTableExists(m_table, false);
+        } else {
+            database->invalidateSchema();
+            ret = false;
+        }
+    }
+    return ret;
+}
+
+bool QDjangoMetaModel::dropTable(QSqlDatabase db) const
+{
+    QDjangoWriteNotifier notifier(m_table, db);
+
+    QDjangoQuery query(db);
+    query.prepare(QString("DROP TABLE %1").arg(
+        db.driver()->escapeIdentifier(m_table, QSqlDriver::TableName)));
+    return query.exec();
+}
+
+/** Returns the start of the partition interval containing the given date.
+ */
+static QDate partitionStart(const QDate &date, const QString &interval)
+{
+    if (interval == QLatin1String("day"))
+        return date;
+    else if (interval == QLatin1String("week"))
+        return date.addDays(1 - date.dayOfWeek());
+    else if (interval == QLatin1String("year"))
+        return QDate(date.year(), 1, 1);
+    return QDate(date.year(), date.month(), 1);
+}
+
+/** Returns the start of the partition interval following the one
+ *  starting at the given date.
+ */
+static QDate partitionEnd(const QDate &start, const QString &interval)
+{
+    if (interval == QLatin1String("day"))
+        return start.addDays(1);
+    else if (interval == QLatin1String("week"))
+        return start.addDays(7);
+    else if (interval == QLatin1String("year"))
+        return start.addYears(1);
+    return start.addMonths(1);
+}
+
+/** Creates the partitions for the current interval and the given number
+ *  of following intervals, if they do not exist yet.
+ *
+ *  This is only needed for models with a \c partition_by option stored in
+ *  PostgreSQL, and should be called periodically so that rows do not
+ *  accumulate in the default partition, which holds the rows outside of
+ *  the other partitions. Rows of the default partition which belong to a
+ *  new partition are moved to it. For other models it does nothing.
+ *
+ * \param count the number of future intervals
+ */
+bool QDjangoMetaModel::createPartitions(int count) const
+{
+    bool ret = true;
+    foreach (QDjangoDatabase *database, databases())
+        if (!createPartitions(database->connection(), count))
+            ret = false;
+    return ret;
+}
 
-        // auto-increment is backend specific
-        if (field.autoIncrement) {
-            if (driverName == QLatin1String("QSQLITE") ||
-                driverName == QLatin1String("QSQLITE2"))
-                fieldSql += QLatin1String(" AUTOINCREMENT");
-            else if (driverName == QLatin1String("QMYSQL"))
-                fieldSql += QLatin1String(" AUTO_INCREMENT");
-            else if (driverName == QLatin1String("QPSQL"))
-                fieldSql = driver->escapeIdentifier(field.name, QSqlDriver::FieldName) + " SERIAL PRIMARY KEY";
+bool QDjangoMetaModel::createPartitions(QSqlDatabase db, int count) const
+{
+    if (m_partitionKey.isEmpty() || db.driverName() != QLatin1String("QPSQL"))
+        return true;
+
+    QSqlDriver *driver = db.driver();
+    const QString quotedTable = driver->escapeIdentifier(m_table, QSqlDriver::TableName);
+    const QString quotedDefault = driver->escapeIdentifier(m_table + "_default", QSqlDriver::TableName);
+    const QString quotedKey = driver->escapeIdentifier(m_partitionKey, QSqlDriver::FieldName);
+    QDate start = partitionStart(QDate::currentDate(), m_partitionInterval);
+    for (int i = 0; i <= count; ++i) {
+        const QDate end = partitionEnd(start, m_partitionInterval);
+        const QString name = m_table + "_p" + start.toString("yyyyMMdd");
+        const QString range = QString("%1 >= '%2' AND %1 < '%3'").arg(
+            quotedKey, start.toString(Qt::ISODate), end.toString(Qt::ISODate));
+        QStringList statements;
+        statements << QString("CREATE TABLE IF NOT EXISTS %1 PARTITION OF %2 FOR VALUES FROM ('%3') TO ('%4')").arg(
+            driver->escapeIdentifier(name, QSqlDriver::TableName),
+            quotedTable,
+            start.toString(Qt::ISODate),
+            end.toString(Qt::ISODate));
+
+        // a partition cannot be created while the default partition holds
+        // rows in its range, so they are moved to it
+        QDjangoQuery checkQuery(db);
+        checkQuery.prepare(QString("SELECT 1 FROM %1 WHERE %2 LIMIT 1").arg(quotedDefault, range));
+        if (!checkQuery.exec())
+            return false;
+        const bool moveRows = checkQuery.next();
+        if (moveRows) {
+            statements.prepend(QString("ALTER TABLE %1 DETACH PARTITION %2").arg(quotedTable, quotedDefault));
+            statements << QString("INSERT INTO %1 SELECT * FROM %2 WHERE %3").arg(quotedTable, quotedDefault, range);
+            statements << QString("DELETE FROM %1 WHERE %2").arg(quotedDefault, range);
+            statements << QString("ALTER TABLE %1 ATTACH PARTITION %2 DEFAULT").arg(quotedTable, quotedDefault);
         }
 
-        // foreign key
-        if (!field.foreignModel.isEmpty())
-        {
-            const QDjangoMetaModel foreignMeta = QDjango::metaModel(field.foreignModel);
-            fieldSql += QString(" REFERENCES %1 (%2)").arg(
-                driver->escapeIdentifier(foreignMeta.m_table, QSqlDriver::TableName),
-                driver->escapeIdentifier(foreignMeta.m_primaryKey, QSqlDriver::FieldName));
+        const bool transaction = moveRows && QDjango::beginTransaction(db);
+        bool ok = true;
+        foreach (const QString &sql, statements) {
+            QDjangoQuery query(db);
+            query.prepare(sql);
+            if (!query.exec()) {
+                ok = false;
+                break;
+            }
         }
-        propSql << fieldSql;
+        if (transaction) {
+            if (ok)
+                ok = QDjango::endTransaction(db, true);
+            if (!ok)
+                QDjango::endTransaction(db, false);
+        }
+        if (!ok)
+            return false;
+        start = end;
     }
+    return true;
+}
 
-    // create table
-    QDjangoQuery createQuery(db);
-    createQuery.prepare(QString("CREATE TABLE %1 (%2)").arg(
-            quotedTable,
-            propSql.join(", ")));
-    if (!createQuery.exec())
+/** Removes the rows whose partition key is before the given date.
+ *
+ *  For models with a \c partition_by option stored in PostgreSQL, the
+ *  partitions which only hold such rows are dropped, which takes the same
+ *  time however many rows they hold. Rows in the partition containing
+ *  \a before are kept. Such rows in the default partition are deleted.
+ *  Other models fall back to a DELETE statement.
+ *
+ * \param before
+ */
+bool QDjangoMetaModel::dropPartitions(const QDateTime &before) const
+{
+    if (m_partitionKey.isEmpty()) {
+        qWarning() << m_table << "has no partition key";
         return false;
-
-    // create indices
-    foreach (const QDjangoMetaField &field, m_localFields)
-    {
-        // Postgres automatically creates indices on primary keys
-        if (field.primaryKey && driverName == QLatin1String("QPSQL"))
-            continue;
-
-        if (field.index)
-        {
-            const QString indexName = m_table + "_" + QString::fromLatin1(field.name);
-            QDjangoQuery indexQuery(db);
-            indexQuery.prepare(QString("CREATE %1 %2 ON %3 (%4)").arg(
-                field.primaryKey ? "UNIQUE INDEX" : "INDEX",
-                // FIXME : how should we escape an index name?
-                driver->escapeIdentifier(indexName, QSqlDriver::FieldName),
-                quotedTable,
-                driver->escapeIdentifier(field.name, QSqlDriver::FieldName)));
-            if (!indexQuery.exec())
-                return false;
-        }
     }
 
-    return true;
+    bool ret = true;
+    foreach (QDjangoDatabase *database, databases())
+        if (!dropPartitions(database->connection(), before))
+            ret = false;
+    return ret;
 }
 
-/** Drops the database table for this QDjangoMetaModel.
- */
-bool QDjangoMetaModel::dropTable() const
+bool QDjangoMetaModel::dropPartitions(QSqlDatabase db, const QDateTime &before) const
 {
-    QSqlDatabase db = QDjango::database();
+    QDjangoWriteNotifier notifier(m_table, db);
+    QSqlDriver *driver = db.driver();
+    const bool partitioned = (db.driverName() == QLatin1String("QPSQL"));
+
+    // delete the rows which are not stored in dated partitions
+    bool dateKey = false;
+    foreach (const QDjangoMetaField &field, m_localFields)
+        if (field.name == m_partitionKey)
+            dateKey = (field.type == QVariant::Date);
+    QDjangoQuery deleteQuery(db);
+    deleteQuery.prepare(QString("DELETE FROM %1 WHERE %2 < ?").arg(
+        driver->escapeIdentifier(partitioned ? m_table + "_default" : m_table, QSqlDriver::TableName),
+        driver->escapeIdentifier(m_partitionKey, QSqlDriver::FieldName)));
+    deleteQuery.addBindValue(dateKey ? QVariant(before.date()) : QVariant(before));
+    if (!deleteQuery.exec())
+        return false;
+    if (!partitioned)
+        return true;
 
+    // list the partitions
     QDjangoQuery query(db);
-    query.prepare(QString("DROP TABLE %1").arg(
-        db.driver()->escapeIdentifier(m_table, QSqlDriver::TableName)));
-    return query.exec();
+    query.prepare("SELECT c.relname FROM pg_inherits i"
+        " JOIN pg_class c ON c.oid = i.inhrelid"
+        " JOIN pg_class p ON p.oid = i.inhparent"
+        " WHERE p.relname = ?");
+    query.addBindValue(m_table);
+    if (!query.exec())
+        return false;
+    QStringList names;
+    while (query.next())
+        names << query.value(0).toString();
+
+    // drop those which end before the given date
+    const QString prefix = m_table + "_p";
+    foreach (const QString &name, names) {
+        if (!name.startsWith(prefix))
+            continue;
+        const QDate start = QDate::fromString(name.mid(prefix.size()), "yyyyMMdd");
+        if (!start.isValid() || QDateTime(partitionEnd(start, m_partitionInterval)) > before)
+            continue;
+
+        QDjangoQuery dropQuery(db);
+        dropQuery.prepare("DROP TABLE " + driver->escapeIdentifier(name, QSqlDriver::TableName));
+        if (!dropQuery.exec())
+            return false;
+    }
+    return true;
 }
 
 /** Retrieves the QDjangoModel pointed to by the given foreign-key.
@@ -549,7 +2148,8 @@ QByteArray QDjangoMetaModel::primaryKey() const
  */
 bool QDjangoMetaModel::remove(QObject *model) const
 {
-    QSqlDatabase db = QDjango::database();
+    QSqlDatabase db = database(model->property(m_shardKey))->connection();
+    QDjangoWriteNotifier notifier(m_table, db);
 
     QDjangoQuery query(db);
     query.prepare(QString("DELETE FROM %1 WHERE %2 = ?").arg(
@@ -565,14 +2165,145 @@ bool QDjangoMetaModel::remove(QObject *model) const
  */
 bool QDjangoMetaModel::removeById(const QVariant &id) const
 {
-    QSqlDatabase db = QDjango::database();
+    // if the primary key is not the shard key, look on every shard
+    QList<QDjangoDatabase*> targets;
+    if (m_shardKey == m_primaryKey)
+        targets << database(id);
+    else
+        targets = databases();
 
-    QDjangoQuery query(db);
-    query.prepare(QString("DELETE FROM %1 WHERE %2 = ?").arg(
-                  db.driver()->escapeIdentifier(m_table, QSqlDriver::TableName),
-                  db.driver()->escapeIdentifier(m_primaryKey, QSqlDriver::FieldName)));
-    query.addBindValue(id);
-    return query.exec();
+    QDjangoWriteNotifier notifier(m_table);
+    bool ret = true;
+    foreach (QDjangoDatabase *target, targets) {
+        QSqlDatabase db = target->connection();
+        notifier.addDatabase(db);
+        QDjangoQuery query(db);
+        query.prepare(QString("DELETE FROM %1 WHERE %2 = ?").arg(
+                      db.driver()->escapeIdentifier(m_table, QSqlDriver::TableName),
+                      db.driver()->escapeIdentifier(m_primaryKey, QSqlDriver::FieldName)));
+        query.addBindValue(id);
+        if (!query.exec())
+            ret = false;
+    }
+    return ret;
+}
+
+/** Formats the given values as a PostgreSQL array literal.
+ */
+static QString postgresArray(const QVariantList &values)
+{
+    QStringList bits;
+    foreach (const QVariant &value, values) {
+        QString escaped = value.toString();
+        escaped.replace("\\", "\\\\");
+        escaped.replace("\"", "\\\"");
+        bits << "\"" + escaped + "\"";
+    }
+    return "{" + bits.join(",") + "}";
+}
+
+/** Removes the objects for the given ids from the database.
+ *
+ *  The ids are split into chunks which respect the driver's limit on
+ *  bound values, and all the chunks are deleted in a single transaction.
+ *  On PostgreSQL the ids are bound as a single array parameter.
+ *
+ *  For sharded models, a transaction is opened on every shard involved
+ *  and they are only committed once the deletes succeeded on all of them.
+ *  The commits themselves are not atomic: if committing fails on a shard,
+ *  the shards committed before it keep their deletions.
+ *
+ * \param ids
+ *
+ * \return the number of deleted rows, or -1 if deletion failed
+ */
+int QDjangoMetaModel::removeByIds(const QVariantList &ids) const
+{
+    if (ids.isEmpty())
+        return 0;
+
+    // group the ids by shard if the primary key is the shard key,
+    // otherwise look on every shard
+    QList<QDjangoDatabase*> targets;
+    QMap<QDjangoDatabase*, QVariantList> groups;
+    if (m_shardKey == m_primaryKey) {
+        foreach (const QVariant &id, ids) {
+            QDjangoDatabase *target = database(id);
+            if (!groups.contains(target))
+                targets << target;
+            groups[target] << id;
+        }
+    } else {
+        targets = databases();
+    }
+
+    QDjangoWriteNotifier notifier(m_table);
+    QList<QSqlDatabase> connections;
+    QList<bool> transactions;
+    foreach (QDjangoDatabase *target, targets) {
+        QSqlDatabase db = target->connection();
+        notifier.addDatabase(db);
+        connections << db;
+        transactions << QDjango::beginTransaction(db);
+    }
+
+    int count = 0;
+    for (int i = 0; i < targets.size(); ++i) {
+        const int removed = removeByIds(connections[i], groups.isEmpty() ? ids : groups.value(targets[i]));
+        if (removed < 0) {
+            count = -1;
+            break;
+        }
+        count += removed;
+    }
+
+    // commit only if every database succeeded
+    bool ok = (count >= 0);
+    for (int i = 0; i < connections.size(); ++i) {
+        if (!transactions[i])
+            continue;
+        if (ok)
+            ok = QDjango::endTransaction(connections[i], true);
+        if (!ok)
+            QDjango::endTransaction(connections[i], false);
+    }
+    return ok ? count : -1;
+}
+
+int QDjangoMetaModel::removeByIds(QSqlDatabase db, const QVariantList &ids) const
+{
+    QSqlDriver *driver = db.driver();
+
+    const QString quotedTable = driver->escapeIdentifier(m_table, QSqlDriver::TableName);
+    const QString quotedKey = driver->escapeIdentifier(m_primaryKey, QSqlDriver::FieldName);
+    const bool arrayParameter = (db.driverName() == QLatin1String("QPSQL"));
+    const int chunkSize = arrayParameter ? ids.size() : QDjango::maxBindValues(db);
+
+    int count = 0;
+    for (int offset = 0; offset < ids.size(); offset += chunkSize)
+    {
+        const QVariantList chunk = ids.mid(offset, chunkSize);
+
+        QDjangoQuery query(db);
+        if (arrayParameter) {
+            query.prepare(QString("DELETE FROM %1 WHERE %2 = ANY(?)").arg(
+                          quotedTable, quotedKey));
+            query.addBindValue(postgresArray(chunk));
+        } else {
+            QStringList holders;
+            for (int i = 0; i < chunk.size(); ++i)
+                holders << "?";
+            query.prepare(QString("DELETE FROM %1 WHERE %2 IN (%3)").arg(
+                          quotedTable, quotedKey, holders.join(", ")));
+            foreach (const QVariant &id, chunk)
+                query.addBindValue(id);
+        }
+
+        if (!query.exec())
+            return -1;
+        count += query.numRowsAffected();
+    }
+    return count;
 }
 
 /** Saves the given QObject to the database.
@@ -587,6 +2318,42 @@ bool QDjangoMetaModel::save(QObject *model) const
     return save(model, dummy);
 }
 
+/** Returns a copy of the local fields of the given QObject, which can be
+ *  saved from another thread with saveSnapshot().
+ *
+ * \param model
+ */
+QVariantMap QDjangoMetaModel::snapshot(const QObject *model) const
+{
+    QVariantMap values;
+    foreach (const QDjangoMetaField &field, m_localFields)
+        values.insert(QString::fromLatin1(field.name), model->property(field.name));
+    return values;
+}
+
+/** Saves a snapshot taken with snapshot() to the database.
+ *
+ * \param values
+ * \param outPk receives the primary key of the saved row
+ *
+ * \return true if saving succeeded, false otherwise
+ */
+bool QDjangoMetaModel::saveSnapshot(const QVariantMap &values, QVariant &outPk) const
+{
+    // restore the snapshot as dynamic properties
+    QObject object;
+    QMapIterator<QString, QVariant> it(values);
+    while (it.hasNext()) {
+        it.next();
+        object.setProperty(it.key().toLatin1(), it.value());
+    }
+
+    if (!save(&object))
+        return false;
+    outPk = object.property(m_primaryKey);
+    return true;
+}
+
 /** Saves the given QObject to the database.
  *
  * \param model
@@ -596,7 +2363,15 @@ bool QDjangoMetaModel::save(QObject *model) const
  */
 bool QDjangoMetaModel::save(QObject *model, QVariant &inOutPk) const
 {
-    QSqlDatabase db = QDjango::database();
+    // sharded rows can only be routed once their shard key is known
+    const QVariant shardValue = model->property(m_shardKey);
+    if (!m_shardKey.isEmpty() && QDjango::shardCount() && shardValue.isNull()) {
+        qWarning() << "Cannot save" << m_table << "without a value for its shard key" << m_shardKey;
+        return false;
+    }
+
+    QSqlDatabase db = database(shardValue)->connection();
+    QDjangoWriteNotifier notifier(m_table, db);
     QSqlDriver *driver = db.driver();
 
     QStringList fieldNames;
@@ -659,19 +2434,11 @@ bool QDjangoMetaModel::save(QObject *model, QVariant &inOutPk) const
     if (primaryKey.autoIncrement)
         fieldNames.removeAll(primaryKey.name);
 
-    // perform insert
-    QStringList fieldColumns;
-    QStringList fieldHolders;
-    foreach (const QString &name, fieldNames)
-    {
-        fieldColumns << driver->escapeIdentifier(name, QSqlDriver::FieldName);
-        fieldHolders << "?";
-    }
-
+    // perform insert, retrieving the generated key in the same round-trip
+    // if the database supports it
+    const bool returning = primaryKey.autoIncrement && QDjango::hasInsertReturning(db);
     QDjangoQuery query(db);
-    query.prepare(QString("INSERT INTO %1 (%2) VALUES(%3)").arg(
-                  quotedTable,
-                  fieldColumns.join(", "), fieldHolders.join(", ")));
+    query.prepare(insertSql(db, fieldNames, 1, returning));
     foreach (const QString &name, fieldNames)
     {
         QVariant value = model->property(name.toLatin1());
@@ -689,14 +2456,8 @@ bool QDjangoMetaModel::save(QObject *model, QVariant &inOutPk) const
     bool ret = query.exec();
     if (primaryKey.autoIncrement) {
         QVariant insertId;
-        if (db.driverName() == "QPSQL") {
-            QDjangoQuery query(db);
-            const QString seqName =
-                    driver->escapeIdentifier(m_table + "_" +
-                                             primaryKey.name + "_seq",
-                                             QSqlDriver::FieldName);
-            query.prepare("SELECT CURRVAL('" + seqName + "')");
-            if (!query.exec() || !query.next())
+        if (returning) {
+            if (!ret || !query.next())
                 return false;
             insertId = query.value(0);
         } else {
@@ -708,7 +2469,196 @@ bool QDjangoMetaModel::save(QObject *model, QVariant &inOutPk) const
     return ret;
 }
 
+/** Orders generated primary keys.
+ */
+static bool keyLessThan(const QVariant &a, const QVariant &b)
+{
+    return a.toLongLong() < b.toLongLong();
+}
+
+/** Inserts the given QObjects into the database using multi-row INSERT
+ *  statements, within a transaction.
+ *
+ *  If the primary key is auto-incremented, the generated keys are stored
+ *  in the objects using a RETURNING clause. On databases which do not
+ *  support it, such as MySQL, the objects are saved one at a time instead,
+ *  as the keys of a multi-row INSERT cannot be reliably derived from the
+ *  last insert id.
+ *
+ * \param models
+ *
+ * \return true if all the objects were inserted, false otherwise
+ */
+bool QDjangoMetaModel::bulkInsert(const QList<QObject*> &models) const
+{
+    if (models.isEmpty())
+        return true;
+
+    // group the objects by shard
+    QList<QDjangoDatabase*> targets;
+    QMap<QDjangoDatabase*, QList<QObject*> > groups;
+    foreach (QObject *model, models) {
+        const QVariant shardValue = model->property(m_shardKey);
+        if (!m_shardKey.isEmpty() && QDjango::shardCount() && shardValue.isNull()) {
+            qWarning() << "Cannot save" << m_table << "without a value for its shard key" << m_shardKey;
+            return false;
+        }
+        QDjangoDatabase *target = database(shardValue);
+        if (!groups.contains(target))
+            targets << target;
+        groups[target] << model;
+    }
+
+    foreach (QDjangoDatabase *target, targets)
+        if (!bulkInsert(target->connection(), groups.value(target)))
+            return false;
+    return true;
+}
+
+bool QDjangoMetaModel::bulkInsert(QSqlDatabase db, const QList<QObject*> &models) const
+{
+    QDjangoWriteNotifier notifier(m_table, db);
+
+    QStringList fieldNames;
+    QDjangoMetaField primaryKey;
+    foreach (const QDjangoMetaField &field, m_localFields)
+    {
+        if (field.primaryKey == true)
+            primaryKey = field;
+        fieldNames << field.name;
+    }
+
+    // generated keys can only be fed back using RETURNING
+    const bool returning = primaryKey.autoIncrement && QDjango::hasInsertReturning(db);
+    if (returning)
+        fieldNames.removeAll(primaryKey.name);
+    const int rowsPerQuery = (primaryKey.autoIncrement && !returning) ? 1 :
+        qMax(1, QDjango::maxBindValues(db) / qMax(1, fieldNames.size()));
+
+    // insert all the chunks atomically
+    const bool transaction = QDjango::beginTransaction(db);
+
+    bool ok = true;
+    QDjangoQuery query(db);
+    QString sql;
+    for (int offset = 0; ok && offset < models.size(); offset += rowsPerQuery)
+    {
+        const QList<QObject*> chunk = models.mid(offset, rowsPerQuery);
+
+        // without RETURNING, fall back to saving the objects one at a time
+        if (primaryKey.autoIncrement && !returning)
+        {
+            ok = save(chunk.first());
+            continue;
+        }
+
+        const QString chunkSql = insertSql(db, fieldNames, chunk.size(), returning);
+        if (chunkSql != sql)
+        {
+            sql = chunkSql;
+            query.prepare(sql);
+        }
+        foreach (QObject *model, chunk)
+        {
+            foreach (const QString &name, fieldNames)
+            {
+                QVariant value = model->property(name.toLatin1());
+                if (QVariant::Map == value.type())
+                {
+                    QByteArray ba;
+                    QDataStream ds(&ba, QIODevice::WriteOnly);
+                    ds << value;
+                    query.addBindValue(ba);
+                }
+                else
+                    query.addBindValue(value);
+            }
+        }
+        ok = query.exec();
+
+        // store the generated keys: the order of the returned rows is not
+        // guaranteed, but the keys increase in the order of the VALUES rows
+        if (ok && returning)
+        {
+            QList<QVariant> keys;
+            while (query.next())
+                keys << query.value(0);
+            ok = (keys.size() == chunk.size());
+            if (ok) {
+                qSort(keys.begin(), keys.end(), keyLessThan);
+                for (int i = 0; i < chunk.size(); ++i)
+                    chunk[i]->setProperty(primaryKey.name, keys[i]);
+            }
+        }
+    }
+
+    if (transaction)
+    {
+        if (ok)
+            ok = QDjango::endTransaction(db, true);
+        if (!ok)
+            QDjango::endTransaction(db, false);
+    }
+    return ok;
+}
+
+/** Returns the SQL for an INSERT statement with the given number of rows.
+ *
+ * \param db
+ * \param fieldNames
+ * \param rowCount
+ * \param returning whether the primary key should be returned
+ */
+QString QDjangoMetaModel::insertSql(const QSqlDatabase &db, const QStringList &fieldNames, int rowCount, bool returning) const
+{
+    QSqlDriver *driver = db.driver();
+
+    QStringList fieldColumns;
+    QStringList fieldHolders;
+    foreach (const QString &name, fieldNames)
+    {
+        fieldColumns << driver->escapeIdentifier(name, QSqlDriver::FieldName);
+        fieldHolders << "?";
+    }
+
+    QStringList rows;
+    const QString row = QString("(%1)").arg(fieldHolders.join(", "));
+    for (int i = 0; i < rowCount; ++i)
+        rows << row;
+
+    QString sql = QString("INSERT INTO %1 (%2) VALUES%3").arg(
+                  driver->escapeIdentifier(m_table, QSqlDriver::TableName),
+                  fieldColumns.join(", "), rows.join(", "));
+    if (returning)
+        sql += " RETURNING " + driver->escapeIdentifier(m_primaryKey, QSqlDriver::FieldName);
+    return sql;
+}
+
 bool QDjangoMetaModel::tableExists() const
 {
-    return QDjango::database().tables().contains(m_table);
+    foreach (QDjangoDatabase *database, databases())
+        if (!database->hasTable(m_table))
+            return false;
+    return true;
+}
+
+/** Returns the database which stores the rows with the given shard key
+ *  value, or the model's database if it is not sharded.
+ *
+ * \param shardValue
+ */
+QDjangoDatabase *QDjangoMetaModel::database(const QVariant &shardValue) const
+{
+    if (m_shardKey.isEmpty() || !QDjango::shardCount())
+        return QDjango::namedDatabase(m_alias);
+    return QDjango::shard(shardValue);
+}
+
+/** Returns the databases which store the rows of this model.
+ */
+QList<QDjangoDatabase*> QDjangoMetaModel::databases() const
+{
+    if (m_shardKey.isEmpty() || !QDjango::shardCount())
+        return QList<QDjangoDatabase*>() << QDjango::namedDatabase(m_alias);
+    return QDjango::shards();
 }
@@ -26,8 +26,10 @@ class QObject;
 class QSqlDatabase;
 class QSqlQuery;
 class QString;
+class QThreadPool;
 
 class QDjangoMetaModel;
+class QDjangoQueryObserver;
 
 /** \defgroup Database */
 
@@ -40,26 +42,103 @@ class QDjangoMetaModel;
 class QDjango
 {
 public:
+    /** The policy used to choose the replica which serves a read. */
+    enum ReplicaPolicy
+    {
+        /** Replicas are used in turn. */
+        RoundRobin,
+        /** The replica running the fewest queries is used. */
+        LeastLoaded
+    };
+
     static bool createTables();
     static bool dropTables();
+    static void invalidateSchema();
+
+    /** A function which returns the alias of the database storing a
+     *  model, or an empty string to use the model's own settings.
+     */
+    typedef QString (*DatabaseRouter)(const QString &modelName);
 
     static QSqlDatabase database();
     static void setDatabase(QSqlDatabase database);
 
+    static QSqlDatabase database(const QString &alias);
+    static void setDatabase(const QString &alias, QSqlDatabase database);
+    static void removeDatabase(const QString &alias);
+    static QStringList databaseAliases();
+    static void setDatabaseRouter(DatabaseRouter router);
+
+    static QVariantMap connectionProfile(const QString &driverName);
+    static void setConnectionProfile(const QString &driverName, const QVariantMap &settings);
+
+    static QThreadPool *threadPool();
+
+    static bool transaction();
+    static bool commit();
+    static bool rollback();
+
+    static void addReplica(QSqlDatabase database);
+    static void clearReplicas();
+    static ReplicaPolicy replicaPolicy();
+    static void setReplicaPolicy(ReplicaPolicy policy);
+    static int readYourWritesWindow();
+    static void setReadYourWritesWindow(int msecs);
+    static QList<QVariantMap> replicaStatistics();
+
+    static void addQueryObserver(QDjangoQueryObserver *observer);
+    static void removeQueryObserver(QDjangoQueryObserver *observer);
+    static bool isDebugEnabled();
+    static void setDebugEnabled(bool enabled);
+
+    static int slowQueryThreshold();
+    static void setSlowQueryThreshold(int msecs);
+    static QList<QVariantMap> slowQueries();
+    static void clearSlowQueries();
+
+    /** A function which maps a shard key value to a shard index, between
+     *  0 and shardCount - 1.
+     */
+    typedef int (*ShardFunction)(const QVariant &key, int shardCount);
+
+    static void addShard(QSqlDatabase database);
+    static void clearShards();
+    static int shardCount();
+    static void setShardFunction(ShardFunction function);
+
     template <class T>
     static QDjangoMetaModel registerModel();
 
 private:
     // backend specific
-    static QString noLimitSql();
+    static bool applyConnectionProfile(QSqlDatabase &db);
+    static bool beginTransaction(QSqlDatabase db);
+    static bool endTransaction(QSqlDatabase db, bool commit);
+    static QString explain(QSqlDatabase db, const QString &sql, const QVariantList &values, bool analyze);
+    static QDjangoDatabase *namedDatabase(const QString &alias);
+    static QDjangoDatabase *readSource();
+    static QDjangoDatabase *shard(const QVariant &key);
+    static QList<QDjangoDatabase*> shards();
+    static void writeCompleted(const QString &table, const QSqlDatabase &db);
+    static bool hasUncommittedWrites(const QStringList &tables);
+    static bool hasInsertReturning(const QSqlDatabase &db);
+    static int maxBindValues(const QSqlDatabase &db);
+    static QString noLimitSql(const QSqlDatabase &db);
 
     static QDjangoMetaModel registerModel(const QObject *model);
     static QDjangoMetaModel metaModel(const QString &name);
 
+    friend class QDjangoBulkLoaderPrivate;
     friend class QDjangoCompiler;
+    friend class QDjangoDatabase;
     friend class QDjangoModel;
     friend class QDjangoMetaModel;
+    friend class QDjangoQuery;
+    friend class QDjangoQueryBatch;
     friend class QDjangoQuerySetPrivate;
+    friend class QDjangoWriteNotifier;
+    friend class QDjangoWriteQueue;
+    friend class QDjangoWriteQueuePrivate;
 };
 
 /** Register a QDjangoModel class with QDjango.
@@ -0,0 +1,122 @@
+/*
+ * QDjango
+ * Copyright (C) 2010-2011 Bolloré telecom
+ * See AUTHORS file for a full list of contributors.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <cstddef>
+
+#include "QDjangoAllocCounter.h"
+
+#if defined(QDJANGO_ALLOC_ACCOUNTING) && defined(__GLIBC__)
+#define QDJANGO_ALLOC_WRAPPERS
+
+// thread-local storage which does not itself allocate
+static __thread qint64 threadAllocations = 0;
+static __thread qint64 threadBytes = 0;
+
+extern "C" {
+void *__libc_malloc(size_t size);
+void *__libc_calloc(size_t count, size_t size);
+void *__libc_realloc(void *ptr, size_t size);
+void __libc_free(void *ptr);
+
+void *malloc(size_t size)
+{
+    threadAllocations++;
+    threadBytes += size;
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t count, size_t size)
+{
+    threadAllocations++;
+    threadBytes += count * size;
+    return __libc_calloc(count, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+    if (size) {
+        threadAllocations++;
+        threadBytes += size;
+    }
+    return __libc_realloc(ptr, size);
+}
+
+void free(void *ptr)
+{
+    __libc_free(ptr);
+}
+}
+#endif
+
+/** Constructs a counter which counts the allocations made by the current
+ *  thread from now on.
+ */
+QDjangoAllocCounter::QDjangoAllocCounter()
+{
+    reset();
+}
+
+/** Returns the number of allocations made by the current thread since
+ *  the counter was constructed or reset.
+ */
+qint64 QDjangoAllocCounter::allocations() const
+{
+#ifdef QDJANGO_ALLOC_WRAPPERS
+    return threadAllocations - m_allocations;
+#else
+    return 0;
+#endif
+}
+
+/** Returns the number of bytes allocated by the current thread since
+ *  the counter was constructed or reset.
+ */
+qint64 QDjangoAllocCounter::bytes() const
+{
+#ifdef QDJANGO_ALLOC_WRAPPERS
+    return threadBytes - m_bytes;
+#else
+    return 0;
+#endif
+}
+
+/** Restarts counting from zero.
+ */
+void QDjangoAllocCounter::reset()
+{
+#ifdef QDJANGO_ALLOC_WRAPPERS
+    m_allocations = threadAllocations;
+    m_bytes = threadBytes;
+#else
+    m_allocations = 0;
+    m_bytes = 0;
+#endif
+}
+
+/** Returns true if allocations are being counted.
+ */
+bool QDjangoAllocCounter::isAvailable()
+{
+#ifdef QDJANGO_ALLOC_WRAPPERS
+    return true;
+#else
+    return false;
+#endif
+}
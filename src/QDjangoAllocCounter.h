@@ -0,0 +1,61 @@
+/*
+ * QDjango
+ * Copyright (C) 2010-2011 Bolloré telecom
+ * See AUTHORS file for a full list of contributors.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef QDJANGO_ALLOC_COUNTER_H
+#define QDJANGO_ALLOC_COUNTER_H
+
+#include <QtGlobal>
+
+/** \brief The QDjangoAllocCounter class counts the memory allocations
+ *   made by the current thread.
+ *
+ *  Counting requires QDjango to be built with the QDJANGO_ALLOC_ACCOUNTING
+ *  option on a glibc system, in which case \c malloc and related functions
+ *  are wrapped for the whole program. Otherwise isAvailable() returns
+ *  false and the counts remain zero.
+ *
+ *  It is used to measure allocations per operation and to guard against
+ *  regressions:
+ *
+ *  \code
+ *  QDjangoAllocCounter counter;
+ *  QDjangoQuerySet<User>().values();
+ *  qDebug() << counter.allocations() << "allocations," << counter.bytes() << "bytes";
+ *  \endcode
+ *
+ * \ingroup Database
+ */
+class QDjangoAllocCounter
+{
+public:
+    QDjangoAllocCounter();
+
+    qint64 allocations() const;
+    qint64 bytes() const;
+    void reset();
+
+    static bool isAvailable();
+
+private:
+    qint64 m_allocations;
+    qint64 m_bytes;
+};
+
+#endif
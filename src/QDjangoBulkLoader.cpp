@@ -0,0 +1,372 @@
+/*
+ * QDjango
+ * Copyright (C) 2010-2011 Bolloré telecom
+ * See AUTHORS file for a full list of contributors.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <QDataStream>
+#include <QDebug>
+#include <QSqlDriver>
+#include <QSqlError>
+
+#ifdef QDJANGO_WITH_LIBPQ
+#include <libpq-fe.h>
+#endif
+
+#include "QDjango.h"
+#include "QDjangoBulkLoader_p.h"
+
+/** Converts a field value to the value stored in the database.
+ */
+static QVariant databaseValue(const QVariant &value)
+{
+    if (QVariant::Map == value.type())
+    {
+        QByteArray ba;
+        QDataStream ds(&ba, QIODevice::WriteOnly);
+        ds << value;
+        return ba;
+    }
+    return value;
+}
+
+#ifdef QDJANGO_WITH_LIBPQ
+/** Returns the native PostgreSQL connection handle.
+ */
+static PGconn *postgresHandle(const QSqlDatabase &db)
+{
+    QVariant handle = db.driver()->handle();
+    if (handle.isValid() && !qstrcmp(handle.typeName(), "PGconn*"))
+        return *static_cast<PGconn**>(handle.data());
+    return 0;
+}
+
+/** Formats a value using the text format of the COPY command.
+ */
+static QByteArray copyValue(const QVariant &value)
+{
+    if (value.isNull())
+        return "\\N";
+
+    switch (value.type())
+    {
+    case QVariant::Bool:
+        return value.toBool() ? "t" : "f";
+    case QVariant::ByteArray:
+        return "\\\\x" + value.toByteArray().toHex();
+    case QVariant::Date:
+        return value.toDate().toString(Qt::ISODate).toLatin1();
+    case QVariant::DateTime:
+        return value.toDateTime().toLocalTime().toString("yyyy-MM-dd hh:mm:ss.zzz").toLatin1();
+    default:
+        break;
+    }
+
+    QByteArray escaped = value.toString().toUtf8();
+    escaped.replace("\\", "\\\\");
+    escaped.replace("\t", "\\t");
+    escaped.replace("\n", "\\n");
+    escaped.replace("\r", "\\r");
+    return escaped;
+}
+#endif
+
+QDjangoBulkLoaderPrivate::QDjangoBulkLoaderPrivate(const QString &modelName)
+    : active(false),
+    batchSize(1000),
+    rowCount(0),
+    m_method(InsertMethod),
+    m_query(0),
+    m_handle(0)
+{
+    m_metaModel = QDjango::metaModel(modelName);
+    foreach (const QDjangoMetaField &field, m_metaModel.m_localFields)
+        if (!(field.primaryKey && field.autoIncrement))
+            m_fieldNames << QString::fromLatin1(field.name);
+}
+
+QDjangoBulkLoaderPrivate::~QDjangoBulkLoaderPrivate()
+{
+    if (active)
+        finish();
+}
+
+bool QDjangoBulkLoaderPrivate::begin()
+{
+    if (active) {
+        qWarning("QDjangoBulkLoader is already loading");
+        return false;
+    }
+
+    if (!m_metaModel.m_shardKey.isEmpty() && QDjango::shardCount()) {
+        qWarning("QDjangoBulkLoader does not support sharded models");
+        return false;
+    }
+
+    m_db = m_metaModel.database(QVariant())->connection();
+    m_rows.clear();
+    rowCount = 0;
+
+    const QString driverName = m_db.driverName();
+    if (driverName == QLatin1String("QSQLITE") ||
+        driverName == QLatin1String("QSQLITE2")) {
+        m_method = SqliteMethod;
+
+        // relax durability until loading is finished, this must be done
+        // outside of a transaction
+        QSqlQuery query(m_db);
+        if (query.exec("PRAGMA synchronous") && query.next())
+            m_synchronous = query.value(0).toString();
+        query.exec("PRAGMA synchronous = OFF");
+    }
+#ifdef QDJANGO_WITH_LIBPQ
+    else if (driverName == QLatin1String("QPSQL") && postgresHandle(m_db)) {
+        m_method = CopyMethod;
+        m_handle = postgresHandle(m_db);
+    }
+#endif
+    else {
+        m_method = InsertMethod;
+    }
+
+    if (!QDjango::beginTransaction(m_db)) {
+        qWarning() << "Could not start bulk load transaction" << m_db.lastError();
+        rollback();
+        return false;
+    }
+
+    if (m_method == SqliteMethod) {
+        // a single prepared statement is reused for every row
+        m_query = new QDjangoQuery(m_db);
+        if (!m_query->prepare(m_metaModel.insertSql(m_db, m_fieldNames, 1, false))) {
+            rollback();
+            return false;
+        }
+    } else if (m_method == CopyMethod && !copyBegin()) {
+        rollback();
+        return false;
+    }
+
+    active = true;
+    m_timer.start();
+    return true;
+}
+
+bool QDjangoBulkLoaderPrivate::append(const QObject *model)
+{
+    QVariantList row;
+    foreach (const QString &name, m_fieldNames)
+        row << model->property(name.toLatin1());
+    return append(row);
+}
+
+bool QDjangoBulkLoaderPrivate::append(const QVariantList &row)
+{
+    if (!active) {
+        qWarning("QDjangoBulkLoader is not loading");
+        return false;
+    }
+    if (row.size() != m_fieldNames.size()) {
+        qWarning() << "QDjangoBulkLoader expected" << m_fieldNames.size()
+                   << "values but got" << row.size();
+        return false;
+    }
+
+    if (m_method == SqliteMethod) {
+        for (int i = 0; i < row.size(); ++i)
+            m_query->bindValue(i, databaseValue(row[i]));
+        if (!m_query->exec()) {
+            rollback();
+            return false;
+        }
+    } else {
+        m_rows << row;
+        if (m_rows.size() >= batchSize && !flush()) {
+            rollback();
+            return false;
+        }
+    }
+    rowCount++;
+    return true;
+}
+
+bool QDjangoBulkLoaderPrivate::finish()
+{
+    if (!active)
+        return false;
+
+    bool ok = flush();
+    if (ok && m_method == CopyMethod)
+        ok = copyEnd();
+    if (!ok) {
+        rollback();
+        return false;
+    }
+
+    QDjangoWriteNotifier notifier(m_metaModel.m_table, m_db);
+    if (!QDjango::endTransaction(m_db, true)) {
+        qWarning() << "Could not commit bulk load" << m_db.lastError();
+        rollback();
+        return false;
+    }
+
+    // restore durability
+    if (m_method == SqliteMethod && !m_synchronous.isEmpty()) {
+        QSqlQuery query(m_db);
+        query.exec("PRAGMA synchronous = " + QString::number(m_synchronous.toInt()));
+    }
+
+    delete m_query;
+    m_query = 0;
+    m_handle = 0;
+    active = false;
+    return true;
+}
+
+double QDjangoBulkLoaderPrivate::rowsPerSecond() const
+{
+    if (!m_timer.isValid())
+        return 0.0;
+    return rowCount * 1000.0 / qMax(qint64(1), m_timer.elapsed());
+}
+
+bool QDjangoBulkLoaderPrivate::flush()
+{
+    if (m_rows.isEmpty())
+        return true;
+
+    if (m_method == CopyMethod) {
+        if (!copyFlush())
+            return false;
+        m_rows.clear();
+        return true;
+    }
+
+    // multi-row inserts, each within the driver's limit on bound values
+    const int rowsPerQuery = qMax(1, QDjango::maxBindValues(m_db) / qMax(1, m_fieldNames.size()));
+    for (int offset = 0; offset < m_rows.size(); offset += rowsPerQuery)
+    {
+        const QList<QVariantList> chunk = m_rows.mid(offset, rowsPerQuery);
+
+        QDjangoQuery query(m_db);
+        query.prepare(m_metaModel.insertSql(m_db, m_fieldNames, chunk.size(), false));
+        foreach (const QVariantList &row, chunk)
+            foreach (const QVariant &value, row)
+                query.addBindValue(databaseValue(value));
+        if (!query.exec())
+            return false;
+    }
+    m_rows.clear();
+    return true;
+}
+
+bool QDjangoBulkLoaderPrivate::copyBegin()
+{
+#ifdef QDJANGO_WITH_LIBPQ
+    PGconn *conn = static_cast<PGconn*>(m_handle);
+    QSqlDriver *driver = m_db.driver();
+
+    QStringList columns;
+    foreach (const QString &name, m_fieldNames)
+        columns << driver->escapeIdentifier(name, QSqlDriver::FieldName);
+    const QString sql = QString("COPY %1 (%2) FROM STDIN").arg(
+        driver->escapeIdentifier(m_metaModel.m_table, QSqlDriver::TableName),
+        columns.join(", "));
+
+    PGresult *result = PQexec(conn, sql.toUtf8().constData());
+    const bool ok = (PQresultStatus(result) == PGRES_COPY_IN);
+    if (!ok)
+        qWarning() << "Could not start COPY" << PQerrorMessage(conn);
+    PQclear(result);
+    return ok;
+#else
+    return false;
+#endif
+}
+
+bool QDjangoBulkLoaderPrivate::copyFlush()
+{
+#ifdef QDJANGO_WITH_LIBPQ
+    PGconn *conn = static_cast<PGconn*>(m_handle);
+
+    QByteArray data;
+    foreach (const QVariantList &row, m_rows) {
+        for (int i = 0; i < row.size(); ++i) {
+            if (i)
+                data += '\t';
+            data += copyValue(databaseValue(row[i]));
+        }
+        data += '\n';
+    }
+
+    if (PQputCopyData(conn, data.constData(), data.size()) != 1) {
+        qWarning() << "Could not send COPY data" << PQerrorMessage(conn);
+        return false;
+    }
+    return true;
+#else
+    return false;
+#endif
+}
+
+bool QDjangoBulkLoaderPrivate::copyEnd()
+{
+#ifdef QDJANGO_WITH_LIBPQ
+    PGconn *conn = static_cast<PGconn*>(m_handle);
+    if (!conn)
+        return true;
+    m_handle = 0;
+
+    bool ok = (PQputCopyEnd(conn, 0) == 1);
+    PGresult *result;
+    while ((result = PQgetResult(conn)) != 0) {
+        if (PQresultStatus(result) != PGRES_COMMAND_OK)
+            ok = false;
+        PQclear(result);
+    }
+    if (!ok)
+        qWarning() << "Could not complete COPY" << PQerrorMessage(conn);
+    return ok;
+#else
+    return true;
+#endif
+}
+
+void QDjangoBulkLoaderPrivate::rollback()
+{
+#ifdef QDJANGO_WITH_LIBPQ
+    // abort the COPY operation if it is still in progress
+    if (m_method == CopyMethod && m_handle) {
+        PGconn *conn = static_cast<PGconn*>(m_handle);
+        PQputCopyEnd(conn, "bulk load aborted");
+        PGresult *result;
+        while ((result = PQgetResult(conn)) != 0)
+            PQclear(result);
+    }
+#endif
+    QDjango::endTransaction(m_db, false);
+
+    if (m_method == SqliteMethod && !m_synchronous.isEmpty()) {
+        QSqlQuery query(m_db);
+        query.exec("PRAGMA synchronous = " + QString::number(m_synchronous.toInt()));
+    }
+
+    delete m_query;
+    m_query = 0;
+    m_handle = 0;
+    m_rows.clear();
+    active = false;
+}
@@ -0,0 +1,176 @@
+/*
+ * QDjango
+ * Copyright (C) 2010-2011 Bolloré telecom
+ * See AUTHORS file for a full list of contributors.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef QDJANGO_BULK_LOADER_H
+#define QDJANGO_BULK_LOADER_H
+
+#include "QDjango.h"
+#include "QDjangoBulkLoader_p.h"
+
+/** \brief The QDjangoBulkLoader class is a template class for loading
+ *   large numbers of rows into a model's table.
+ *
+ *  Rows are given either as model instances or as lists of values, in the
+ *  order the model's fields are declared. If the primary key is
+ *  auto-incremented, it is omitted from the rows and generated by the
+ *  database.
+ *
+ *  The loading method depends on the database driver:
+ *
+ *  \li on PostgreSQL, rows are streamed using COPY FROM STDIN if QDjango
+ *  was built with QDJANGO_WITH_LIBPQ, otherwise multi-row INSERT
+ *  statements are used
+ *  \li on SQLite, rows are inserted using a single prepared statement
+ *  inside one transaction, with the \c synchronous pragma relaxed until
+ *  finish() is called
+ *  \li on other databases, multi-row INSERT statements are used
+ *
+ *  \code
+ *  QDjangoBulkLoader<File> loader;
+ *  loader.begin();
+ *  foreach (const QVariantList &row, rows) {
+ *      loader.append(row);
+ *      if (!(loader.rowCount() % 100000))
+ *          qDebug() << loader.rowsPerSecond() << "rows/s";
+ *  }
+ *  loader.finish();
+ *  \endcode
+ *
+ * \ingroup Database
+ */
+template <class T>
+class QDjangoBulkLoader
+{
+public:
+    QDjangoBulkLoader();
+    ~QDjangoBulkLoader();
+
+    int batchSize() const;
+    void setBatchSize(int size);
+
+    bool begin();
+    bool append(const T *model);
+    bool append(const QVariantList &row);
+    bool finish();
+
+    qint64 rowCount() const;
+    double rowsPerSecond() const;
+
+private:
+    Q_DISABLE_COPY(QDjangoBulkLoader)
+    QDjangoBulkLoaderPrivate *d;
+};
+
+/** Constructs a new bulk loader.
+ */
+template <class T>
+QDjangoBulkLoader<T>::QDjangoBulkLoader()
+{
+    d = new QDjangoBulkLoaderPrivate(T::staticMetaObject.className());
+}
+
+/** Destroys the bulk loader.
+ *
+ *  If loading is in progress, finish() is called.
+ */
+template <class T>
+QDjangoBulkLoader<T>::~QDjangoBulkLoader()
+{
+    delete d;
+}
+
+/** Returns the number of rows which are buffered before they are
+ *  sent to the database.
+ */
+template <class T>
+int QDjangoBulkLoader<T>::batchSize() const
+{
+    return d->batchSize;
+}
+
+/** Sets the number of rows which are buffered before they are
+ *  sent to the database. The default value is 1000.
+ *
+ * \param size
+ */
+template <class T>
+void QDjangoBulkLoader<T>::setBatchSize(int size)
+{
+    Q_ASSERT(size > 0);
+    d->batchSize = size;
+}
+
+/** Starts loading rows.
+ *
+ * \return true if loading could be started, false otherwise
+ */
+template <class T>
+bool QDjangoBulkLoader<T>::begin()
+{
+    return d->begin();
+}
+
+/** Appends the fields of the given model instance.
+ *
+ * \param model
+ */
+template <class T>
+bool QDjangoBulkLoader<T>::append(const T *model)
+{
+    return d->append(model);
+}
+
+/** Appends a row of values, in the order the model's fields are declared.
+ *
+ * \param row
+ */
+template <class T>
+bool QDjangoBulkLoader<T>::append(const QVariantList &row)
+{
+    return d->append(row);
+}
+
+/** Sends any buffered rows to the database and commits them.
+ *
+ * \return true if all the rows were loaded, false otherwise
+ */
+template <class T>
+bool QDjangoBulkLoader<T>::finish()
+{
+    return d->finish();
+}
+
+/** Returns the number of rows appended since begin() was called.
+ */
+template <class T>
+qint64 QDjangoBulkLoader<T>::rowCount() const
+{
+    return d->rowCount;
+}
+
+/** Returns the average number of rows appended per second since
+ *  begin() was called.
+ */
+template <class T>
+double QDjangoBulkLoader<T>::rowsPerSecond() const
+{
+    return d->rowsPerSecond();
+}
+
+#endif
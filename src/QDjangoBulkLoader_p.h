@@ -0,0 +1,80 @@
+/*
+ * QDjango
+ * Copyright (C) 2010-2011 Bolloré telecom
+ * See AUTHORS file for a full list of contributors.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef QDJANGO_BULK_LOADER_P_H
+#define QDJANGO_BULK_LOADER_P_H
+
+//
+//  W A R N I N G
+//  -------------
+//
+// This file is not part of the QDjango API.
+//
+
+#include <QElapsedTimer>
+#include <QStringList>
+
+#include "QDjango_p.h"
+
+/** \internal
+ */
+class QDjangoBulkLoaderPrivate
+{
+public:
+    enum Method
+    {
+        InsertMethod,
+        CopyMethod,
+        SqliteMethod
+    };
+
+    QDjangoBulkLoaderPrivate(const QString &modelName);
+    ~QDjangoBulkLoaderPrivate();
+
+    bool begin();
+    bool append(const QVariantList &row);
+    bool append(const QObject *model);
+    bool finish();
+    double rowsPerSecond() const;
+
+    bool active;
+    int batchSize;
+    qint64 rowCount;
+
+private:
+    Q_DISABLE_COPY(QDjangoBulkLoaderPrivate)
+
+    bool flush();
+    bool copyBegin();
+    bool copyFlush();
+    bool copyEnd();
+    void rollback();
+
+    QDjangoMetaModel m_metaModel;
+    QStringList m_fieldNames;
+    QSqlDatabase m_db;
+    Method m_method;
+    QList<QVariantList> m_rows;
+    QDjangoQuery *m_query;
+    QString m_synchronous;
+    void *m_handle;
+    QElapsedTimer m_timer;
+};
+
+#endif
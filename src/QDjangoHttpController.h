@@ -31,6 +31,9 @@ QString httpDateTime(const QDateTime &dt);
 QDateTime httpDateTime(const QString &str);
 
 /** \brief The QDjangoHttpController class is the base class for HTTP request handlers.
+ *
+ * When the server uses worker threads, respondToRequest() is called
+ * concurrently from several threads, so it must be thread-safe.
  *
  * \ingroup Http
  */
@@ -51,6 +54,8 @@ public:
     /** \brief Responds to an HTTP request.
      *
      * Reimplement this method when creating a subclass of QDjangoHttpController.
+     * It is called from the thread which handles the connection and the
+     * returned response lives in that thread.
      */
     virtual QDjangoHttpResponse *respondToRequest(const QDjangoHttpRequest &request) = 0;
 
@@ -20,7 +20,17 @@
 #include <QCoreApplication>
 #include <QDateTime>
 #include <QDebug>
+#include <QElapsedTimer>
 #include <QTcpSocket>
+#include <QThread>
+
+#ifdef Q_OS_UNIX
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <cstring>
+#endif
 
 #include "QDjangoHttpController.h"
 #include "QDjangoHttpRequest.h"
@@ -29,13 +39,48 @@
 #include "QDjangoHttpResponse_p.h"
 #include "QDjangoHttpServer.h"
 #include "QDjangoHttpServer_p.h"
+#include "QDjangoMetrics.h"
+#include "QDjangoTracer.h"
 
 //#define DEBUG_HTTP
 
 // maximum request body size is 10 MB
 #define MAX_BODY_SIZE (10 * 1024 * 1024)
 
-typedef QPair<QDjangoHttpRequest*,QDjangoHttpResponse*> QDjangoHttpJob;
+static QDjangoCounter connectionCounter("qdjango_http_connections_total", "Number of HTTP connections accepted.");
+static QDjangoGauge activeConnections("qdjango_http_connections_active", "Number of open HTTP connections.");
+static QDjangoCounter responseBytes("qdjango_http_response_bytes_total", "Number of bytes sent in HTTP responses.");
+static QDjangoHistogram requestDuration("qdjango_http_request_duration_seconds", "Time from receiving an HTTP request to sending its response, in seconds.");
+
+/** Returns the buckets for the number of requests queued on a connection.
+ */
+static QList<double> pendingJobBuckets()
+{
+    QList<double> buckets;
+    buckets << 1 << 2 << 4 << 8 << 16 << 32;
+    return buckets;
+}
+
+static QDjangoHistogram connectionPendingJobs("qdjango_http_pending_jobs", "Number of requests queued on a connection, including the one just received.", pendingJobBuckets());
+
+// responses by class of status code, from 1xx to 5xx
+static QDjangoCounter responseCounters[] = {
+    QDjangoCounter("qdjango_http_responses_total{code=\"1xx\"}", "Number of HTTP responses sent."),
+    QDjangoCounter("qdjango_http_responses_total{code=\"2xx\"}", "Number of HTTP responses sent."),
+    QDjangoCounter("qdjango_http_responses_total{code=\"3xx\"}", "Number of HTTP responses sent."),
+    QDjangoCounter("qdjango_http_responses_total{code=\"4xx\"}", "Number of HTTP responses sent."),
+    QDjangoCounter("qdjango_http_responses_total{code=\"5xx\"}", "Number of HTTP responses sent.")
+};
+
+/** \internal
+ */
+class QDjangoHttpJob
+{
+public:
+    QDjangoHttpRequest *request;
+    QDjangoHttpResponse *response;
+    QElapsedTimer timer;
+};
 
 class QDjangoHttpConnectionPrivate
 {
@@ -49,9 +94,12 @@ public:
 };
 
 /** Constructs a new HTTP connection.
+ *
+ *  The connection deletes itself when it is closed. It lives in the
+ *  thread of its parent, which is either the server or a worker.
  */
-QDjangoHttpConnection::QDjangoHttpConnection(int socketDescriptor, QDjangoHttpServer *server)
-    : QObject(server),
+QDjangoHttpConnection::QDjangoHttpConnection(int socketDescriptor, QDjangoHttpServer *server, QObject *parent)
+    : QObject(parent),
     d(new QDjangoHttpConnectionPrivate)
 {
     bool check;
@@ -63,6 +111,9 @@ QDjangoHttpConnection::QDjangoHttpConnection(int socketDescriptor, QDjangoHttpSe
     d->socket = new QTcpSocket(this);
     d->socket->setSocketDescriptor(socketDescriptor);
 
+    connectionCounter.increment();
+    activeConnections.increment();
+
     check = connect(d->socket, SIGNAL(bytesWritten(qint64)),
                     this, SLOT(bytesWritten(qint64)));
     Q_ASSERT(check);
@@ -74,6 +125,18 @@ QDjangoHttpConnection::QDjangoHttpConnection(int socketDescriptor, QDjangoHttpSe
     check = connect(d->socket, SIGNAL(readyRead()),
                     this, SLOT(handleData()));
     Q_ASSERT(check);
+
+    check = connect(this, SIGNAL(closed()),
+                    this, SLOT(deleteLater()));
+    Q_ASSERT(check);
+
+    // connections owned by a worker hand their requests over to the
+    // server's thread instead, see writeResponse()
+    if (server->thread() == thread()) {
+        check = connect(this, SIGNAL(requestFinished(QDjangoHttpRequest*,QDjangoHttpResponse*)),
+                        server, SIGNAL(requestFinished(QDjangoHttpRequest*,QDjangoHttpResponse*)));
+        Q_ASSERT(check);
+    }
 }
 
 /** Destroys the HTTP connection.
@@ -83,10 +146,12 @@ QDjangoHttpConnection::~QDjangoHttpConnection()
     if (d->pendingRequest)
         delete d->pendingRequest;
     foreach (const QDjangoHttpJob &job, d->pendingJobs) {
-        delete job.first;
-        delete job.second;
+        delete job.request;
+        delete job.response;
     }
     delete d;
+
+    activeConnections.decrement();
 }
 
 /** When bytes have been written, check whether we need to close
@@ -113,9 +178,14 @@ void QDjangoHttpConnection::bytesWritten(qint64 bytes)
  */
 void QDjangoHttpConnection::handleData()
 {
+    QDjangoTraceSpan span("http.request", "http");
+
     /* Receive request */
     QDjangoHttpRequest *request = d->pendingRequest ? d->pendingRequest : new QDjangoHttpRequest;
-    request->d->readFromSocket(d->socket);
+    {
+        QDjangoTraceSpan readSpan("http.read", "http");
+        request->d->readFromSocket(d->socket);
+    }
     if (!request->isFinished())
     {
         d->pendingRequest = request;
@@ -128,21 +198,31 @@ void QDjangoHttpConnection::handleData()
 #endif
 
     /* Process request */
+    QDjangoHttpJob job;
+    job.timer.start();
     bool keepAlive = request->d->header.majorVersion() >= 1 && request->d->header.minorVersion() >= 1;
     if (request->header("Connection").toLower() == QLatin1String("keep-alive"))
         keepAlive = true;
     else if (request->header("Connection").toLower() == QLatin1String("close"))
         keepAlive = false;
 
+    if (span.isActive())
+        span.setDetail(request->method() + QLatin1Char(' ') + request->path());
+
     QDjangoHttpController *controller = d->server->controller();
     QDjangoHttpResponse *response = 0;
     if (!request->isValid())
         response = QDjangoHttpController::serveBadRequest(*request);
     else if (!controller)
         response = QDjangoHttpController::serveNotFound(*request);
-    else
+    else {
+        QDjangoTraceSpan controllerSpan("http.controller", "http");
         response = controller->respondToRequest(*request);
-    d->pendingJobs << qMakePair(request, response);
+    }
+    job.request = request;
+    job.response = response;
+    d->pendingJobs << job;
+    connectionPendingJobs.observe(d->pendingJobs.size());
 
     /* Store keep-alive flag */
     if (!keepAlive)
@@ -150,15 +230,19 @@ void QDjangoHttpConnection::handleData()
 
     connect(response, SIGNAL(ready()), this, SLOT(writeResponse()));
     writeResponse();
+
+    /* Handle pipelined requests which were received along with this one */
+    if (!d->closeAfterResponse && d->socket->bytesAvailable())
+        QMetaObject::invokeMethod(this, "handleData", Qt::QueuedConnection);
 }
 
 void QDjangoHttpConnection::writeResponse()
 {
     while (!d->pendingJobs.isEmpty() &&
-            d->pendingJobs.first().second->isReady()) {
+            d->pendingJobs.first().response->isReady()) {
         const QDjangoHttpJob job = d->pendingJobs.takeFirst();
-        QDjangoHttpRequest *request = job.first;
-        QDjangoHttpResponse *response = job.second;
+        QDjangoHttpRequest *request = job.request;
+        QDjangoHttpResponse *response = job.response;
         if (!response->isReady())
             return;
 
@@ -168,27 +252,216 @@ void QDjangoHttpConnection::writeResponse()
         response->setHeader("Connection", d->closeAfterResponse ? "close" : "keep-alive");
 
         /* Send response */
-        d->socket->write(response->d->header.toString().toUtf8());
+        QDjangoTraceSpan writeSpan("http.write", "http");
+        const QByteArray header = response->d->header.toString().toUtf8();
+        d->socket->write(header);
         d->socket->write(response->d->body);
 
-        /* Emit signal */
+        /* Update metrics */
+        responseCounters[qBound(1, response->statusCode() / 100, 5) - 1].increment();
+        responseBytes.increment(header.size() + response->d->body.size());
+        requestDuration.observe(job.timer.nsecsElapsed() / 1000000000.0);
+
+        /* Emit signal and destroy response, in the server's thread if the
+           connection is owned by a worker */
+        if (d->server->thread() != thread()) {
+            response->moveToThread(d->server->thread());
+            QMetaObject::invokeMethod(d->server, "finishRequest", Qt::QueuedConnection,
+                Q_ARG(QDjangoHttpRequest*, request),
+                Q_ARG(QDjangoHttpResponse*, response));
+            continue;
+        }
         emit requestFinished(request, response);
-
-        /* Destroy response */
         delete request;
         response->deleteLater();
     }
 }
 
+#if defined(Q_OS_UNIX) && defined(SO_REUSEPORT)
+#define QDJANGO_HAVE_REUSEPORT
+#endif
+
+/** Opens a listening socket with SO_REUSEPORT set, so that several
+ *  sockets can accept connections on the same port.
+ *
+ *  Returns the socket descriptor, or -1 on failure.
+ */
+static int reusePortSocket(const QHostAddress &address, quint16 port)
+{
+#ifdef QDJANGO_HAVE_REUSEPORT
+    const bool ipv6 = (address.protocol() == QAbstractSocket::IPv6Protocol);
+    const int fd = ::socket(ipv6 ? AF_INET6 : AF_INET, SOCK_STREAM, 0);
+    if (fd < 0)
+        return -1;
+    ::fcntl(fd, F_SETFD, FD_CLOEXEC);
+
+    int on = 1;
+    ::setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    if (::setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) < 0) {
+        ::close(fd);
+        return -1;
+    }
+
+    int result;
+    if (ipv6) {
+        struct sockaddr_in6 addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin6_family = AF_INET6;
+        addr.sin6_port = htons(port);
+        const Q_IPV6ADDR ip = address.toIPv6Address();
+        memcpy(&addr.sin6_addr, &ip, sizeof(addr.sin6_addr));
+        result = ::bind(fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr));
+    } else {
+        struct sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(port);
+        addr.sin_addr.s_addr = htonl(address.toIPv4Address());
+        result = ::bind(fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr));
+    }
+    if (result < 0 || ::listen(fd, SOMAXCONN) < 0) {
+        ::close(fd);
+        return -1;
+    }
+    return fd;
+#else
+    Q_UNUSED(address);
+    Q_UNUSED(port);
+    return -1;
+#endif
+}
+
+/** Closes a socket descriptor which could not be used.
+ */
+static void closeSocket(int fd)
+{
+#ifdef Q_OS_UNIX
+    ::close(fd);
+#else
+    Q_UNUSED(fd);
+#endif
+}
+
+/** Constructs a listener which hands its connections to a worker.
+ */
+QDjangoHttpListener::QDjangoHttpListener(QDjangoHttpWorker *worker)
+    : QTcpServer(worker),
+    m_worker(worker)
+{
+}
+
+void QDjangoHttpListener::incomingConnection(int socketDescriptor)
+{
+    m_worker->connectionCount.ref();
+    m_worker->addConnection(socketDescriptor);
+}
+
+/** Constructs a new worker, which must then be moved to its thread.
+ */
+QDjangoHttpWorker::QDjangoHttpWorker(QDjangoHttpServer *server)
+    : connectionCount(0),
+    m_server(server)
+{
+}
+
+/** Handles a connection which was accepted by the server.
+ *
+ * \param socketDescriptor
+ */
+void QDjangoHttpWorker::addConnection(int socketDescriptor)
+{
+    QDjangoHttpConnection *connection = new QDjangoHttpConnection(socketDescriptor, m_server, this);
+    bool check = connect(connection, SIGNAL(destroyed()),
+                         this, SLOT(connectionDestroyed()));
+    Q_ASSERT(check);
+    Q_UNUSED(check);
+}
+
+/** Opens a listener of the worker's own on the given port, which must
+ *  already be open with SO_REUSEPORT.
+ *
+ * \param address
+ * \param port
+ */
+bool QDjangoHttpWorker::listen(const QString &address, int port)
+{
+    const int fd = reusePortSocket(QHostAddress(address), port);
+    if (fd < 0)
+        return false;
+
+    QDjangoHttpListener *listener = new QDjangoHttpListener(this);
+    if (!listener->setSocketDescriptor(fd)) {
+        closeSocket(fd);
+        delete listener;
+        return false;
+    }
+    return true;
+}
+
+void QDjangoHttpWorker::connectionDestroyed()
+{
+    connectionCount.deref();
+}
+
 /** \internal
  */
 class QDjangoHttpServerPrivate
 {
 public:
+    bool listenWorkers(const QHostAddress &address, quint16 port);
+    void startWorkers(QDjangoHttpServer *server, int count);
+    void stopWorkers();
+
     int connectionCount;
     QDjangoHttpController *requestHandler;
+    QList<QThread*> threads;
+    QList<QDjangoHttpWorker*> workers;
+    QDjangoHttpServer::WorkerPolicy workerPolicy;
+    int nextWorker;
+    bool reusePort;
 };
 
+bool QDjangoHttpServerPrivate::listenWorkers(const QHostAddress &address, quint16 port)
+{
+    foreach (QDjangoHttpWorker *worker, workers) {
+        bool ok = false;
+        QMetaObject::invokeMethod(worker, "listen", Qt::BlockingQueuedConnection,
+                                  Q_RETURN_ARG(bool, ok),
+                                  Q_ARG(QString, address.toString()),
+                                  Q_ARG(int, port));
+        if (!ok)
+            return false;
+    }
+    return true;
+}
+
+void QDjangoHttpServerPrivate::startWorkers(QDjangoHttpServer *server, int count)
+{
+    for (int i = 0; i < count; ++i) {
+        QThread *thread = new QThread;
+        QDjangoHttpWorker *worker = new QDjangoHttpWorker(server);
+        worker->moveToThread(thread);
+        thread->start();
+        threads << thread;
+        workers << worker;
+    }
+}
+
+void QDjangoHttpServerPrivate::stopWorkers()
+{
+    // the workers and the connections they own are deleted in their own
+    // thread when its event loop exits
+    for (int i = 0; i < threads.size(); ++i) {
+        workers[i]->deleteLater();
+        threads[i]->quit();
+        threads[i]->wait();
+        delete threads[i];
+    }
+    threads.clear();
+    workers.clear();
+    nextWorker = 0;
+}
+
 /** Constructs a new HTTP server.
  */
 QDjangoHttpServer::QDjangoHttpServer(QObject *parent)
@@ -197,35 +470,54 @@ QDjangoHttpServer::QDjangoHttpServer(QObject *parent)
 {
     d->connectionCount = 0;
     d->requestHandler = 0;
+    d->workerPolicy = RoundRobin;
+    d->nextWorker = 0;
+    d->reusePort = false;
+
+    qRegisterMetaType<QDjangoHttpRequest*>("QDjangoHttpRequest*");
+    qRegisterMetaType<QDjangoHttpResponse*>("QDjangoHttpResponse*");
 }
 
 /** Destroys the HTTP server.
  */
 QDjangoHttpServer::~QDjangoHttpServer()
 {
+    d->stopWorkers();
     delete d;
 }
 
 /** Handles the creation of a new HTTP connection.
+ *
+ *  If worker threads are enabled, the connection is handed to one of them
+ *  according to the workerPolicy().
  *
  * \param socketDescriptor
  */
 void QDjangoHttpServer::incomingConnection(int socketDescriptor)
 {
-    QDjangoHttpConnection *connection = new QDjangoHttpConnection(socketDescriptor, this);
-
 #ifdef DEBUG_HTTP
     qDebug("Handling connection %i", d->connectionCount++);
 #endif
 
-    bool check;
-    check = connect(connection, SIGNAL(closed()),
-                    connection, SLOT(deleteLater()));
-    Q_ASSERT(check);
+    if (d->workers.isEmpty()) {
+        new QDjangoHttpConnection(socketDescriptor, this, this);
+        return;
+    }
 
-    check = connect(connection, SIGNAL(requestFinished(QDjangoHttpRequest*,QDjangoHttpResponse*)),
-                    this, SIGNAL(requestFinished(QDjangoHttpRequest*,QDjangoHttpResponse*)));
-    Q_ASSERT(check);
+    QDjangoHttpWorker *worker = 0;
+    if (d->workerPolicy == LeastConnections) {
+        foreach (QDjangoHttpWorker *candidate, d->workers) {
+            if (!worker || int(candidate->connectionCount) < int(worker->connectionCount))
+                worker = candidate;
+        }
+    } else {
+        worker = d->workers.at(d->nextWorker);
+        d->nextWorker = (d->nextWorker + 1) % d->workers.size();
+    }
+
+    worker->connectionCount.ref();
+    QMetaObject::invokeMethod(worker, "addConnection", Qt::QueuedConnection,
+                              Q_ARG(int, socketDescriptor));
 }
 
 /** Returns the controller which serves requests received by the server.
@@ -243,3 +535,105 @@ void QDjangoHttpServer::setController(QDjangoHttpController *controller)
 {
     d->requestHandler = controller;
 }
+
+/** Tells the server to listen for incoming connections on the given
+ *  address and port, using sockets with the SO_REUSEPORT option.
+ *
+ *  Other sockets with the option may listen on the same port, for
+ *  instance in pre-forked processes started by a QDjangoHttpSupervisor,
+ *  and the kernel balances incoming connections between them. If worker
+ *  threads are used, each worker also opens its own listening socket and
+ *  accepts connections directly, so that there is no single accept queue.
+ *
+ *  This is only available on systems which support SO_REUSEPORT.
+ *
+ * \param address
+ * \param port If 0, a port is chosen automatically.
+ * \return true on success, false otherwise
+ */
+bool QDjangoHttpServer::listenReusePort(const QHostAddress &address, quint16 port)
+{
+    const int fd = reusePortSocket(address, port);
+    if (fd < 0) {
+        qWarning("Could not open a listening socket with SO_REUSEPORT");
+        return false;
+    }
+    if (!setSocketDescriptor(fd)) {
+        closeSocket(fd);
+        return false;
+    }
+
+    d->reusePort = true;
+    if (!d->listenWorkers(address, serverPort())) {
+        qWarning("Could not open worker listeners");
+        close();
+        d->reusePort = false;
+
+        // discard the listeners which were opened
+        const int count = d->workers.size();
+        d->stopWorkers();
+        d->startWorkers(this, count);
+        return false;
+    }
+    return true;
+}
+
+/** Returns the number of worker threads which handle connections.
+ */
+int QDjangoHttpServer::workerCount() const
+{
+    return d->workers.size();
+}
+
+/** Sets the number of worker threads which handle connections.
+ *
+ *  Each worker runs its own event loop and owns the connections it is
+ *  given, so that requests are served on several cores. With the default
+ *  value of 0, connections are handled in the server's thread.
+ *
+ *  When workers are used, the controller's respondToRequest() is called
+ *  concurrently from several threads and must be thread-safe. The
+ *  requestFinished() signal is still emitted from the server's thread.
+ *  Changing the number of workers closes the connections they own.
+ *
+ * \param count
+ */
+void QDjangoHttpServer::setWorkerCount(int count)
+{
+    Q_ASSERT(count >= 0);
+
+    d->stopWorkers();
+    d->startWorkers(this, count);
+    if (d->reusePort && isListening() && !d->listenWorkers(serverAddress(), serverPort()))
+        qWarning("Could not open worker listeners");
+}
+
+/** Emits requestFinished() for a request served by a worker, then
+ *  destroys the request and response.
+ *
+ * \param request
+ * \param response
+ */
+void QDjangoHttpServer::finishRequest(QDjangoHttpRequest *request, QDjangoHttpResponse *response)
+{
+    emit requestFinished(request, response);
+    delete request;
+    response->deleteLater();
+}
+
+/** Returns the policy used to choose the worker which handles a
+ *  connection.
+ */
+QDjangoHttpServer::WorkerPolicy QDjangoHttpServer::workerPolicy() const
+{
+    return d->workerPolicy;
+}
+
+/** Sets the policy used to choose the worker which handles a connection.
+ *
+ * \param policy
+ */
+void QDjangoHttpServer::setWorkerPolicy(WorkerPolicy policy)
+{
+    d->workerPolicy = policy;
+}
@@ -39,20 +39,45 @@ class QDjangoHttpServer : public QTcpServer
     Q_OBJECT
 
 public:
+    /** The policy used to choose the worker which handles a connection. */
+    enum WorkerPolicy
+    {
+        /** Workers are used in turn. */
+        RoundRobin,
+        /** The worker with the fewest open connections is used. */
+        LeastConnections
+    };
+
     QDjangoHttpServer(QObject *parent = 0);
     ~QDjangoHttpServer();
 
     QDjangoHttpController *controller() const;
     void setController(QDjangoHttpController *controller);
 
+    bool listenReusePort(const QHostAddress &address = QHostAddress::Any, quint16 port = 0);
+
+    int workerCount() const;
+    void setWorkerCount(int count);
+
+    WorkerPolicy workerPolicy() const;
+    void setWorkerPolicy(WorkerPolicy policy);
+
 signals:
     /** This signal is emitted when a request completes.
+     *
+     *  It is always emitted from the server's thread, including for
+     *  requests served by worker threads. The request and response are
+     *  destroyed once the signal has been delivered to the receivers in
+     *  that thread, so receivers in other threads must not keep them.
      */
     void requestFinished(QDjangoHttpRequest *request, QDjangoHttpResponse *response);
 
 protected:
     void incomingConnection(int socketDescriptor);
 
+private slots:
+    void finishRequest(QDjangoHttpRequest *request, QDjangoHttpResponse *response);
+
 private:
     Q_DISABLE_COPY(QDjangoHttpServer)
     QDjangoHttpServerPrivate* const d;
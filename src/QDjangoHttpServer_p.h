@@ -27,7 +27,9 @@
 // This file is not part of the QDjango API.
 //
 
+#include <QAtomicInt>
 #include <QObject>
+#include <QTcpServer>
 
 class QDjangoHttpConnectionPrivate;
 class QDjangoHttpRequest;
@@ -41,7 +43,7 @@ class QDjangoHttpConnection : public QObject
     Q_OBJECT
 
 public:
-    QDjangoHttpConnection(int socketDescriptor, QDjangoHttpServer *server);
+    QDjangoHttpConnection(int socketDescriptor, QDjangoHttpServer *server, QObject *parent);
     ~QDjangoHttpConnection();
 
 signals:
@@ -63,4 +65,45 @@ private:
     QDjangoHttpConnectionPrivate* const d;
 };
 
+/** \internal
+ *
+ * Owns the connections handed to a worker thread.
+ */
+class QDjangoHttpWorker : public QObject
+{
+    Q_OBJECT
+
+public:
+    QDjangoHttpWorker(QDjangoHttpServer *server);
+
+    QAtomicInt connectionCount;
+
+public slots:
+    void addConnection(int socketDescriptor);
+    bool listen(const QString &address, int port);
+
+private slots:
+    void connectionDestroyed();
+
+private:
+    QDjangoHttpServer *m_server;
+};
+
+/** \internal
+ *
+ * A listening socket owned by a worker, which accepts connections in the
+ * worker's thread.
+ */
+class QDjangoHttpListener : public QTcpServer
+{
+public:
+    QDjangoHttpListener(QDjangoHttpWorker *worker);
+
+protected:
+    void incomingConnection(int socketDescriptor);
+
+private:
+    QDjangoHttpWorker *m_worker;
+};
+
 #endif
@@ -0,0 +1,204 @@
+/*
+ * QDjango
+ * Copyright (C) 2010-2011 Bolloré telecom
+ * See AUTHORS file for a full list of contributors.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <QVector>
+
+#ifdef Q_OS_UNIX
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <ctime>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+#include "QDjangoHttpSupervisor.h"
+
+#ifdef Q_OS_UNIX
+static volatile sig_atomic_t stopRequested = 0;
+
+static void requestStop(int signal)
+{
+    Q_UNUSED(signal);
+    stopRequested = 1;
+}
+
+static void childExited(int signal)
+{
+    // only there to interrupt sigsuspend()
+    Q_UNUSED(signal);
+}
+#endif
+
+/** \internal
+ */
+class QDjangoHttpSupervisorPrivate
+{
+public:
+    int processCount;
+    int processIndex;
+};
+
+/** Constructs a supervisor for the given number of worker processes.
+ *
+ * \param processCount
+ */
+QDjangoHttpSupervisor::QDjangoHttpSupervisor(int processCount)
+    : d(new QDjangoHttpSupervisorPrivate)
+{
+    Q_ASSERT(processCount > 0);
+    d->processCount = processCount;
+    d->processIndex = -1;
+}
+
+/** Destroys the supervisor.
+ */
+QDjangoHttpSupervisor::~QDjangoHttpSupervisor()
+{
+    delete d;
+}
+
+/** Returns the number of worker processes.
+ */
+int QDjangoHttpSupervisor::processCount() const
+{
+    return d->processCount;
+}
+
+/** Returns the index of the current worker process, from 0 to
+ *  processCount() - 1, or -1 in the supervisor process.
+ */
+int QDjangoHttpSupervisor::processIndex() const
+{
+    return d->processIndex;
+}
+
+/** Forks the worker processes and supervises them.
+ *
+ *  In worker processes, this returns true at once and the caller should
+ *  start serving. In the supervisor process, workers which exit are
+ *  restarted until SIGINT or SIGTERM is received, at which point the
+ *  workers are terminated and false is returned.
+ *
+ *  On platforms without fork(), this returns true and the server runs
+ *  in the current process.
+ */
+bool QDjangoHttpSupervisor::run()
+{
+#ifdef Q_OS_UNIX
+    // the signals are only delivered while waiting in sigsuspend(), so
+    // that a stop request cannot slip in between checking stopRequested
+    // and going to sleep
+    sigset_t blocked, oldMask, waitMask;
+    sigemptyset(&blocked);
+    sigaddset(&blocked, SIGINT);
+    sigaddset(&blocked, SIGTERM);
+    sigaddset(&blocked, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &blocked, &oldMask);
+    waitMask = oldMask;
+    sigdelset(&waitMask, SIGINT);
+    sigdelset(&waitMask, SIGTERM);
+    sigdelset(&waitMask, SIGCHLD);
+
+    struct sigaction action, childAction, oldInt, oldTerm, oldChild;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = requestStop;
+    sigemptyset(&action.sa_mask);
+    memset(&childAction, 0, sizeof(childAction));
+    childAction.sa_handler = childExited;
+    sigemptyset(&childAction.sa_mask);
+    stopRequested = 0;
+    sigaction(SIGINT, &action, &oldInt);
+    sigaction(SIGTERM, &action, &oldTerm);
+    sigaction(SIGCHLD, &childAction, &oldChild);
+
+    QVector<pid_t> pids(d->processCount, 0);
+    QVector<time_t> started(d->processCount, 0);
+    while (!stopRequested) {
+        // start the missing workers
+        for (int i = 0; i < pids.size(); ++i) {
+            if (pids[i])
+                continue;
+            const pid_t pid = fork();
+            if (!pid) {
+                sigaction(SIGINT, &oldInt, 0);
+                sigaction(SIGTERM, &oldTerm, 0);
+                sigaction(SIGCHLD, &oldChild, 0);
+                sigprocmask(SIG_SETMASK, &oldMask, 0);
+                d->processIndex = i;
+                return true;
+            } else if (pid < 0) {
+                qWarning("Could not fork worker %i: %s", i, strerror(errno));
+                sleep(1);
+            } else {
+                pids[i] = pid;
+                started[i] = time(0);
+            }
+        }
+
+        // reap the workers which exited
+        bool restart = false;
+        int status;
+        pid_t pid;
+        while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+            const int index = pids.indexOf(pid);
+            if (index < 0)
+                continue;
+            pids[index] = 0;
+            restart = true;
+            qWarning("Worker %i (pid %i) exited, restarting it", index, int(pid));
+
+            // do not restart a worker which fails at once in a tight loop
+            if (time(0) - started[index] < 1)
+                sleep(1);
+        }
+        if (pid < 0 && errno != ECHILD) {
+            qWarning("Could not wait for workers: %s", strerror(errno));
+            break;
+        }
+
+        // wait for a signal
+        if (!restart && !stopRequested)
+            sigsuspend(&waitMask);
+    }
+
+    // terminate the workers
+    foreach (pid_t pid, pids) {
+        if (pid)
+            kill(pid, SIGTERM);
+    }
+    foreach (pid_t pid, pids) {
+        if (pid) {
+            while (waitpid(pid, 0, 0) < 0 && errno == EINTR)
+                ;
+        }
+    }
+
+    sigaction(SIGINT, &oldInt, 0);
+    sigaction(SIGTERM, &oldTerm, 0);
+    sigaction(SIGCHLD, &oldChild, 0);
+    sigprocmask(SIG_SETMASK, &oldMask, 0);
+    return false;
+#else
+    d->processIndex = 0;
+    return true;
+#endif
+}
@@ -0,0 +1,72 @@
+/*
+ * QDjango
+ * Copyright (C) 2010-2011 Bolloré telecom
+ * See AUTHORS file for a full list of contributors.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef QDJANGO_HTTP_SUPERVISOR_H
+#define QDJANGO_HTTP_SUPERVISOR_H
+
+#include <QtGlobal>
+
+class QDjangoHttpSupervisorPrivate;
+
+/** \brief The QDjangoHttpSupervisor class runs an HTTP server in several
+ *   pre-forked processes and restarts the ones which die.
+ *
+ *  The supervisor must be started before the QCoreApplication is created,
+ *  as forking a process which runs threads is unsafe. Each worker process
+ *  opens its own listening socket on the same port with
+ *  QDjangoHttpServer::listenReusePort(), so that the kernel balances
+ *  incoming connections between them.
+ *
+ *  \code
+ *  int main(int argc, char *argv[])
+ *  {
+ *      QDjangoHttpSupervisor supervisor(4);
+ *      if (!supervisor.run())
+ *          return 0;
+ *
+ *      QCoreApplication app(argc, argv);
+ *      QDjangoHttpServer server;
+ *      server.setController(&controller);
+ *      server.listenReusePort(QHostAddress::Any, 8080);
+ *      return app.exec();
+ *  }
+ *  \endcode
+ *
+ *  Pre-forking is only available on Unix systems.
+ *
+ * \ingroup Http
+ */
+class QDjangoHttpSupervisor
+{
+public:
+    QDjangoHttpSupervisor(int processCount);
+    ~QDjangoHttpSupervisor();
+
+    int processCount() const;
+    int processIndex() const;
+
+    bool run();
+
+private:
+    Q_DISABLE_COPY(QDjangoHttpSupervisor)
+    QDjangoHttpSupervisorPrivate* const d;
+};
+
+#endif
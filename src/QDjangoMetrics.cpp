@@ -0,0 +1,419 @@
+/*
+ * QDjango
+ * Copyright (C) 2010-2011 Bolloré telecom
+ * See AUTHORS file for a full list of contributors.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <cstring>
+
+#include <QAtomicInt>
+#include <QDebug>
+#include <QHash>
+#include <QMap>
+#include <QMutex>
+#include <QStringList>
+#include <QThreadStorage>
+
+#include "QDjangoMetrics.h"
+
+// number of values each thread can accumulate, a histogram uses one
+// value per bucket plus two
+#define QDJANGO_METRIC_SLOTS 1024
+
+/** \internal
+ */
+class QDjangoMetricEntry
+{
+public:
+    enum Type {
+        Counter,
+        Gauge,
+        Histogram
+    };
+
+    QString name;
+    QString help;
+    Type type;
+    int slot;
+    QList<double> buckets;
+    QAtomicInt gauge;
+};
+
+/** \internal
+ *
+ * Values accumulated by a thread. They are only written by the owning
+ * thread and are folded into the registry when the thread exits.
+ *
+ * Other threads read the values without synchronisation when metrics are
+ * exported. The slots are volatile so that each update is a single store,
+ * and aligned 64-bit loads and stores are assumed not to tear, which holds
+ * on common 64-bit platforms. Elsewhere an exported value may occasionally
+ * be torn, metrics being approximate by nature.
+ */
+class QDjangoMetricsThread
+{
+public:
+    QDjangoMetricsThread();
+    ~QDjangoMetricsThread();
+
+    volatile double slots[QDJANGO_METRIC_SLOTS];
+};
+
+/** \internal
+ */
+class QDjangoMetricsRegistry
+{
+public:
+    QDjangoMetricsRegistry();
+    ~QDjangoMetricsRegistry();
+
+    QDjangoMetricEntry *entry(const QString &name, const QString &help, QDjangoMetricEntry::Type type, const QList<double> &buckets = QList<double>());
+    double value(int slot) const;
+
+    QMutex mutex;
+    QList<QDjangoMetricEntry*> entries;
+    QHash<QString, QDjangoMetricEntry*> names;
+    QList<QDjangoMetricsThread*> threads;
+    double retired[QDJANGO_METRIC_SLOTS];
+    int slotCount;
+};
+
+Q_GLOBAL_STATIC(QDjangoMetricsRegistry, globalMetrics)
+static QThreadStorage<QDjangoMetricsThread*> metricsThreads;
+
+QDjangoMetricsThread::QDjangoMetricsThread()
+{
+    for (int i = 0; i < QDJANGO_METRIC_SLOTS; ++i)
+        slots[i] = 0.0;
+
+    QDjangoMetricsRegistry *registry = globalMetrics();
+    QMutexLocker locker(&registry->mutex);
+    registry->threads << this;
+}
+
+QDjangoMetricsThread::~QDjangoMetricsThread()
+{
+    // the registry may already be gone if the application is exiting
+    QDjangoMetricsRegistry *registry = globalMetrics();
+    if (!registry)
+        return;
+
+    QMutexLocker locker(&registry->mutex);
+    for (int i = 0; i < registry->slotCount; ++i)
+        registry->retired[i] += slots[i];
+    registry->threads.removeAll(this);
+}
+
+QDjangoMetricsRegistry::QDjangoMetricsRegistry()
+    : slotCount(0)
+{
+    memset(retired, 0, sizeof(retired));
+}
+
+QDjangoMetricsRegistry::~QDjangoMetricsRegistry()
+{
+    qDeleteAll(entries);
+}
+
+/** Returns the metric with the given name, registering it if needed.
+ *
+ *  Returns 0 if a metric with the same name but a different type exists,
+ *  or if there is no storage left for the metric's values.
+ */
+QDjangoMetricEntry *QDjangoMetricsRegistry::entry(const QString &name, const QString &help, QDjangoMetricEntry::Type type, const QList<double> &buckets)
+{
+    QMutexLocker locker(&mutex);
+    QDjangoMetricEntry *entry = names.value(name);
+    if (entry) {
+        if (entry->type != type) {
+            qWarning() << "Metric" << name << "is already registered with another type";
+            return 0;
+        }
+        return entry;
+    }
+
+    int size = 0;
+    if (type == QDjangoMetricEntry::Counter)
+        size = 1;
+    else if (type == QDjangoMetricEntry::Histogram)
+        size = buckets.size() + 2;
+    if (slotCount + size > QDJANGO_METRIC_SLOTS) {
+        qWarning() << "Too many metrics, could not register" << name;
+        return 0;
+    }
+
+    entry = new QDjangoMetricEntry;
+    entry->name = name;
+    entry->help = help;
+    entry->type = type;
+    entry->slot = size ? slotCount : -1;
+    entry->buckets = buckets;
+    slotCount += size;
+    entries << entry;
+    names.insert(name, entry);
+    return entry;
+}
+
+/** Returns the total of a value over all threads.
+ *
+ *  The registry's mutex must be held. Values which are being recorded by
+ *  running threads may not be included yet, see QDjangoMetricsThread for
+ *  the assumptions made when reading them.
+ */
+double QDjangoMetricsRegistry::value(int slot) const
+{
+    double total = retired[slot];
+    foreach (const QDjangoMetricsThread *thread, threads)
+        total += thread->slots[slot];
+    return total;
+}
+
+/** Returns the values accumulated by the current thread.
+ */
+static inline volatile double *threadSlots()
+{
+    QDjangoMetricsThread *thread = metricsThreads.localData();
+    if (!thread) {
+        thread = new QDjangoMetricsThread;
+        metricsThreads.setLocalData(thread);
+    }
+    return thread->slots;
+}
+
+/** Formats a sample line, merging the labels of the metric's name with
+ *  an extra label.
+ */
+static QString sampleLine(const QString &name, const QString &suffix, const QString &extra, double value)
+{
+    const int pos = name.indexOf(QLatin1Char('{'));
+    const QString base = pos < 0 ? name : name.left(pos);
+    QStringList labels;
+    if (pos >= 0)
+        labels << name.mid(pos + 1, name.size() - pos - 2);
+    if (!extra.isEmpty())
+        labels << extra;
+
+    QString line = base + suffix;
+    if (!labels.isEmpty())
+        line += QLatin1Char('{') + labels.join(QLatin1String(",")) + QLatin1Char('}');
+    return line + QLatin1Char(' ') + QString::number(value, 'g', 15) + QLatin1Char('\n');
+}
+
+/** Constructs a handle to the counter with the given name.
+ *
+ * \param name
+ * \param help A description of the counter.
+ */
+QDjangoCounter::QDjangoCounter(const QString &name, const QString &help)
+    : m_slot(-1)
+{
+    QDjangoMetricEntry *entry = globalMetrics()->entry(name, help, QDjangoMetricEntry::Counter);
+    if (entry)
+        m_slot = entry->slot;
+}
+
+/** Increments the counter.
+ *
+ * \param value
+ */
+void QDjangoCounter::increment(double value)
+{
+    if (m_slot >= 0)
+        threadSlots()[m_slot] += value;
+}
+
+/** Returns the value of the counter, summed over all threads.
+ */
+double QDjangoCounter::value() const
+{
+    if (m_slot < 0)
+        return 0.0;
+
+    QDjangoMetricsRegistry *registry = globalMetrics();
+    QMutexLocker locker(&registry->mutex);
+    return registry->value(m_slot);
+}
+
+/** Constructs a handle to the gauge with the given name.
+ *
+ * \param name
+ * \param help A description of the gauge.
+ */
+QDjangoGauge::QDjangoGauge(const QString &name, const QString &help)
+{
+    m_entry = globalMetrics()->entry(name, help, QDjangoMetricEntry::Gauge);
+}
+
+/** Increments the gauge.
+ *
+ * \param value
+ */
+void QDjangoGauge::increment(int value)
+{
+    if (m_entry)
+        m_entry->gauge.fetchAndAddRelaxed(value);
+}
+
+/** Decrements the gauge.
+ *
+ * \param value
+ */
+void QDjangoGauge::decrement(int value)
+{
+    if (m_entry)
+        m_entry->gauge.fetchAndAddRelaxed(-value);
+}
+
+/** Sets the value of the gauge.
+ *
+ * \param value
+ */
+void QDjangoGauge::setValue(int value)
+{
+    if (m_entry)
+        m_entry->gauge.fetchAndStoreRelaxed(value);
+}
+
+/** Returns the value of the gauge.
+ */
+int QDjangoGauge::value() const
+{
+    return m_entry ? int(m_entry->gauge) : 0;
+}
+
+/** Constructs a handle to the histogram with the given name.
+ *
+ *  If the histogram is already registered, the buckets it was registered
+ *  with are used.
+ *
+ * \param name
+ * \param help A description of the histogram.
+ * \param buckets The upper bounds of the buckets, in increasing order.
+ */
+QDjangoHistogram::QDjangoHistogram(const QString &name, const QString &help, const QList<double> &buckets)
+    : m_slot(-1)
+{
+    QDjangoMetricEntry *entry = globalMetrics()->entry(name, help, QDjangoMetricEntry::Histogram, buckets);
+    if (entry) {
+        m_slot = entry->slot;
+        m_buckets = entry->buckets;
+    }
+}
+
+/** Records an observed value.
+ *
+ * \param value
+ */
+void QDjangoHistogram::observe(double value)
+{
+    if (m_slot < 0)
+        return;
+
+    const int size = m_buckets.size();
+    int bucket = 0;
+    while (bucket < size && value > m_buckets.at(bucket))
+        bucket++;
+
+    volatile double *slots = threadSlots() + m_slot;
+    slots[bucket] += 1.0;
+    slots[size + 1] += value;
+}
+
+/** Returns the number of observed values, over all threads.
+ */
+qint64 QDjangoHistogram::count() const
+{
+    if (m_slot < 0)
+        return 0;
+
+    QDjangoMetricsRegistry *registry = globalMetrics();
+    QMutexLocker locker(&registry->mutex);
+    double total = 0.0;
+    for (int i = 0; i <= m_buckets.size(); ++i)
+        total += registry->value(m_slot + i);
+    return qint64(total);
+}
+
+/** Returns the sum of the observed values, over all threads.
+ */
+double QDjangoHistogram::sum() const
+{
+    if (m_slot < 0)
+        return 0.0;
+
+    QDjangoMetricsRegistry *registry = globalMetrics();
+    QMutexLocker locker(&registry->mutex);
+    return registry->value(m_slot + m_buckets.size() + 1);
+}
+
+/** Returns buckets suitable for durations in seconds, from 1 ms to 10 s.
+ */
+QList<double> QDjangoHistogram::defaultBuckets()
+{
+    QList<double> buckets;
+    buckets << 0.001 << 0.0025 << 0.005 << 0.01 << 0.025 << 0.05
+            << 0.1 << 0.25 << 0.5 << 1.0 << 2.5 << 5.0 << 10.0;
+    return buckets;
+}
+
+/** Returns the value of all the registered metrics, in the Prometheus
+ *  text exposition format.
+ */
+QString QDjangoMetrics::toPrometheus()
+{
+    QDjangoMetricsRegistry *registry = globalMetrics();
+    QMutexLocker locker(&registry->mutex);
+
+    // sort metrics so that the samples of a metric family are adjacent
+    QMap<QString, QDjangoMetricEntry*> sorted;
+    foreach (QDjangoMetricEntry *entry, registry->entries)
+        sorted.insert(entry->name.section(QLatin1Char('{'), 0, 0) + QLatin1Char(' ') + entry->name, entry);
+
+    QString output;
+    QString family;
+    foreach (QDjangoMetricEntry *entry, sorted) {
+        const QString base = entry->name.section(QLatin1Char('{'), 0, 0);
+        if (base != family) {
+            family = base;
+            const char *type = "counter";
+            if (entry->type == QDjangoMetricEntry::Gauge)
+                type = "gauge";
+            else if (entry->type == QDjangoMetricEntry::Histogram)
+                type = "histogram";
+            output += QString::fromLatin1("# HELP %1 %2\n").arg(base, entry->help);
+            output += QString::fromLatin1("# TYPE %1 %2\n").arg(base, QLatin1String(type));
+        }
+
+        if (entry->type == QDjangoMetricEntry::Counter) {
+            output += sampleLine(entry->name, QString(), QString(), registry->value(entry->slot));
+        } else if (entry->type == QDjangoMetricEntry::Gauge) {
+            output += sampleLine(entry->name, QString(), QString(), int(entry->gauge));
+        } else {
+            // buckets are cumulative
+            double count = 0.0;
+            for (int i = 0; i <= entry->buckets.size(); ++i) {
+                count += registry->value(entry->slot + i);
+                const QString bound = i < entry->buckets.size() ?
+                    QString::number(entry->buckets.at(i), 'g', 15) : QString::fromLatin1("+Inf");
+                output += sampleLine(entry->name, QLatin1String("_bucket"), QString::fromLatin1("le=\"%1\"").arg(bound), count);
+            }
+            output += sampleLine(entry->name, QLatin1String("_sum"), QString(), registry->value(entry->slot + entry->buckets.size() + 1));
+            output += sampleLine(entry->name, QLatin1String("_count"), QString(), count);
+        }
+    }
+    return output;
+}
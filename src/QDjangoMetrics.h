@@ -0,0 +1,117 @@
+/*
+ * QDjango
+ * Copyright (C) 2010-2011 Bolloré telecom
+ * See AUTHORS file for a full list of contributors.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef QDJANGO_METRICS_H
+#define QDJANGO_METRICS_H
+
+#include <QList>
+#include <QString>
+
+class QDjangoMetricEntry;
+
+/** \brief The QDjangoCounter class represents a metric whose value only
+ *   increases, such as a number of requests.
+ *
+ *  Counters are identified by their name, which may carry Prometheus
+ *  labels, for instance \c requests_total{code="2xx"}. Constructing
+ *  several counters with the same name gives handles to the same metric.
+ *
+ *  Increments are accumulated in storage which belongs to the calling
+ *  thread, so recording a value takes no lock.
+ *
+ * \ingroup Database
+ */
+class QDjangoCounter
+{
+public:
+    QDjangoCounter(const QString &name, const QString &help);
+
+    void increment(double value = 1.0);
+    double value() const;
+
+private:
+    int m_slot;
+};
+
+/** \brief The QDjangoGauge class represents a metric whose value can go
+ *   up and down, such as a number of open connections.
+ *
+ * \ingroup Database
+ */
+class QDjangoGauge
+{
+public:
+    QDjangoGauge(const QString &name, const QString &help);
+
+    void increment(int value = 1);
+    void decrement(int value = 1);
+    void setValue(int value);
+    int value() const;
+
+private:
+    QDjangoMetricEntry *m_entry;
+};
+
+/** \brief The QDjangoHistogram class represents a metric which counts
+ *   observed values, such as durations, in configurable buckets.
+ *
+ *  Like counters, observations are accumulated per thread without taking
+ *  a lock.
+ *
+ * \ingroup Database
+ */
+class QDjangoHistogram
+{
+public:
+    QDjangoHistogram(const QString &name, const QString &help, const QList<double> &buckets = defaultBuckets());
+
+    void observe(double value);
+    qint64 count() const;
+    double sum() const;
+
+    static QList<double> defaultBuckets();
+
+private:
+    int m_slot;
+    QList<double> m_buckets;
+};
+
+/** \brief The QDjangoMetrics class gives access to the registered metrics.
+ *
+ *  QDjango registers the following metrics:
+ *
+ *  \li \c qdjango_queries_total, \c qdjango_query_errors_total and
+ *  \c qdjango_query_duration_seconds for the queries issued by
+ *  QDjangoQuerySet and models
+ *  \li \c qdjango_http_connections_total, \c qdjango_http_connections_active,
+ *  \c qdjango_http_responses_total, \c qdjango_http_response_bytes_total and
+ *  \c qdjango_http_request_duration_seconds for QDjangoHttpServer
+ *
+ *  They can be served to a Prometheus server by a QDjangoMetricsController.
+ *
+ * \ingroup Database
+ */
+class QDjangoMetrics
+{
+public:
+    static QString toPrometheus();
+};
+
+#endif
@@ -0,0 +1,63 @@
+/*
+ * QDjango
+ * Copyright (C) 2010-2011 Bolloré telecom
+ * See AUTHORS file for a full list of contributors.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "QDjangoHttpRequest.h"
+#include "QDjangoHttpResponse.h"
+#include "QDjangoMetrics.h"
+#include "QDjangoMetricsController.h"
+
+/** Constructs a new metrics controller.
+ *
+ * \param next The controller which serves the other requests.
+ * \param path The path at which metrics are served.
+ */
+QDjangoMetricsController::QDjangoMetricsController(QDjangoHttpController *next, const QString &path)
+    : m_next(next),
+    m_path(path)
+{
+}
+
+/** Returns the path at which metrics are served.
+ */
+QString QDjangoMetricsController::path() const
+{
+    return m_path;
+}
+
+/** Responds to an HTTP request.
+ *
+ * \param request
+ */
+QDjangoHttpResponse *QDjangoMetricsController::respondToRequest(const QDjangoHttpRequest &request)
+{
+    if (request.path() != m_path) {
+        if (m_next)
+            return m_next->respondToRequest(request);
+        return serveNotFound(request);
+    }
+
+    QDjangoHttpResponse *response = new QDjangoHttpResponse;
+    response->setStatusCode(QDjangoHttpResponse::OK);
+    response->setHeader("Content-Type", "text/plain; version=0.0.4; charset=utf-8");
+    response->setHeader("Cache-Control", "no-cache");
+    if (request.method() != QLatin1String("HEAD"))
+        response->setBody(QDjangoMetrics::toPrometheus().toUtf8());
+    return response;
+}
@@ -0,0 +1,55 @@
+/*
+ * QDjango
+ * Copyright (C) 2010-2011 Bolloré telecom
+ * See AUTHORS file for a full list of contributors.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef QDJANGO_METRICS_CONTROLLER_H
+#define QDJANGO_METRICS_CONTROLLER_H
+
+#include <QString>
+
+#include "QDjangoHttpController.h"
+
+/** \brief The QDjangoMetricsController class serves the registered
+ *   metrics in the Prometheus text format.
+ *
+ *  Requests for the metrics path are answered with the output of
+ *  QDjangoMetrics::toPrometheus(), other requests are passed on to the
+ *  next controller if there is one.
+ *
+ *  \code
+ *  QDjangoMetricsController metrics(&appController);
+ *  server.setController(&metrics);
+ *  \endcode
+ *
+ * \ingroup Http
+ */
+class QDjangoMetricsController : public QDjangoHttpController
+{
+public:
+    QDjangoMetricsController(QDjangoHttpController *next = 0, const QString &path = QString("/metrics"));
+
+    QString path() const;
+    QDjangoHttpResponse *respondToRequest(const QDjangoHttpRequest &request);
+
+private:
+    QDjangoHttpController *m_next;
+    QString m_path;
+};
+
+#endif
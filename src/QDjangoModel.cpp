@@ -24,6 +24,30 @@
 #include "QDjangoModel.h"
 #include "QDjangoQuerySet.h"
 
+/** \internal
+ */
+class QDjangoModelSaveTask : public QDjangoFutureTask<QVariant>
+{
+public:
+    QDjangoModelSaveTask(const QDjangoMetaModel &metaModel, const QVariantMap &values)
+        : m_metaModel(metaModel), m_values(values)
+    {
+    }
+
+protected:
+    QVariant compute()
+    {
+        QVariant pk;
+        if (!m_metaModel.saveSnapshot(m_values, pk))
+            return QVariant();
+        return pk;
+    }
+
+private:
+    QDjangoMetaModel m_metaModel;
+    QVariantMap m_values;
+};
+
 /** Construct a new QDjangoModel.
  *
  * \param parent
@@ -94,6 +118,25 @@ bool QDjangoModel::save()
     return metaModel.save(this);
 }
 
+/** Saves a snapshot of the QDjangoModel to the database on
+ *  QDjango::threadPool().
+ *
+ *  The fields are copied when this method is called, so the model can be
+ *  modified or destroyed while the save is in progress. The result is the
+ *  primary key of the saved row, or an invalid QVariant if saving failed.
+ *
+ *  As the model may be destroyed or used by its own thread by then, its
+ *  primary key is never updated, even if it was generated by the
+ *  database. Call setPk() with the result from the model's thread, for
+ *  instance when a QFutureWatcher reports that the save finished.
+ */
+QFuture<QVariant> QDjangoModel::saveAsync() const
+{
+    const QDjangoMetaModel metaModel = QDjango::metaModel(metaObject()->className());
+    QDjangoModelSaveTask *task = new QDjangoModelSaveTask(metaModel, metaModel.snapshot(this));
+    return task->start(QDjango::threadPool());
+}
+
 /** Returns a string representation of the model instance.
  */
 QString QDjangoModel::toString() const
@@ -20,6 +20,7 @@
 #ifndef QDJANGO_MODEL_H
 #define QDJANGO_MODEL_H
 
+#include <QFuture>
 #include <QObject>
 #include <QVariant>
 
@@ -39,8 +40,44 @@
  *
  *  The following keywords are recognised for model options:
  *
+ *  \li \c db_alias if provided, this is the alias of the database storing
+ *  the model, see QDjango::setDatabase()
  *  \li \c db_table if provided, this is the name of the database table for
  *  the model, otherwise the lowercased class name will be used
+ *  \li \c index_together if provided, a list of fields which are indexed
+ *  together, for instance "user,date". Several indexes can be separated by
+ *  semicolons.
+ *  \li \c partition_by if provided, in the form "range(field)", the table
+ *  is partitioned by ranges of the given date field on PostgreSQL, see
+ *  QDjangoMetaModel::createPartitions() and
+ *  QDjangoMetaModel::dropPartitions(). The primary key then includes the
+ *  partition key, so other models cannot declare a foreign key to this
+ *  model. Rows outside of the created partitions go to a default
+ *  partition. Other databases use a regular table.
+ *  \li \c partition_interval the range covered by each partition, one of
+ *  'day', 'week', 'month' or 'year'. The default is 'month'.
+ *  \li \c shard_key if provided, this is the name of the field whose value
+ *  determines which shard stores a row, see QDjango::addShard()
+ *  \li \c unique_together if provided, a list of fields whose combined
+ *  values must be unique, in the same format as \c index_together
+ *
+ *  Indexes with more options can be declared using one or more
+ *  Q_CLASSINFO("__index__", ...) entries, with the following keywords:
+ *
+ *  \li \c fields the comma-separated list of indexed fields
+ *  \li \c include a comma-separated list of covering fields, which are
+ *  stored in the index but not used as keys. On databases other than
+ *  PostgreSQL, they are appended to the keys of non-unique indexes.
+ *  \li \c name the name of the index, by default the table name followed
+ *  by the indexed columns
+ *  \li \c unique if set to 'true', the index enforces unique values
+ *  \li \c where an SQL predicate restricting the index to some rows,
+ *  written in double quotes. Partial indexes require PostgreSQL or SQLite
+ *  3.8 or later, other databases index all the rows.
+ *
+ *  \code
+ *  Q_CLASSINFO("__index__", "fields=user,date include=amount where=\"deleted = 0\"")
+ *  \endcode
  *
  *  You can also provide additional information about a field using the
  *  Q_CLASSINFO macro, in the form:
@@ -75,6 +112,8 @@ public:
     QVariant pk() const;
     void setPk(const QVariant &pk);
 
+    QFuture<QVariant> saveAsync() const;
+
 public slots:
     bool remove();
     bool save();
@@ -0,0 +1,125 @@
+/*
+ * QDjango
+ * Copyright (C) 2010-2011 Bolloré telecom
+ * See AUTHORS file for a full list of contributors.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "QDjango.h"
+#include "QDjangoQueryBatch.h"
+#include "QDjangoQueryCache.h"
+
+class QDjangoQueryBatchPrivate
+{
+public:
+    QList<QDjangoQuerySetPrivate*> counts;
+    QList<QDjangoQuerySetPrivate*> fetches;
+};
+
+/** Constructs a new query batch.
+ */
+QDjangoQueryBatch::QDjangoQueryBatch()
+    : d(new QDjangoQueryBatchPrivate)
+{
+}
+
+/** Destroys the query batch.
+ */
+QDjangoQueryBatch::~QDjangoQueryBatch()
+{
+    clear();
+    delete d;
+}
+
+void QDjangoQueryBatch::addQuery(QDjangoQuerySetPrivate *querySet, bool fetch)
+{
+    querySet->counter.ref();
+    if (fetch)
+        d->fetches << querySet;
+    else
+        d->counts << querySet;
+}
+
+/** Removes all the querysets from the batch.
+ */
+void QDjangoQueryBatch::clear()
+{
+    foreach (QDjangoQuerySetPrivate *querySet, d->counts + d->fetches) {
+        if (!querySet->counter.deref())
+            delete querySet;
+    }
+    d->counts.clear();
+    d->fetches.clear();
+}
+
+/** Evaluates all the querysets in the batch.
+ *
+ * \return true if all the queries succeeded, false otherwise
+ */
+bool QDjangoQueryBatch::exec()
+{
+    QDjangoDatabase *source = QDjango::readSource();
+    QSqlDatabase db = source->connection();
+    bool ret = true;
+
+    // counts are kept until one of the tables they read is written to
+    foreach (QDjangoQuerySetPrivate *querySet, d->counts)
+        querySet->cachedCount = -1;
+
+    // combine the counts into a single statement, except for those which
+    // are run on other databases
+    QList<QDjangoQuerySetPrivate*> combined;
+    foreach (QDjangoQuerySetPrivate *querySet, d->counts)
+        if (!querySet->isRouted())
+            combined << querySet;
+    if (combined.size() > 1) {
+        QStringList subqueries;
+        QList<QDjangoWhere> wheres;
+        foreach (QDjangoQuerySetPrivate *querySet, combined) {
+            QDjangoWhere resolvedWhere;
+            QStringList tables;
+            subqueries << "(" + querySet->countSql(db, resolvedWhere, querySet->lowMark, querySet->highMark, &tables) + ")";
+            wheres << resolvedWhere;
+            querySet->cachedCountGenerations = QDjangoQueryCache::generations(tables);
+        }
+
+        QDjangoQuery query(db);
+        query.prepare("SELECT " + subqueries.join(", "));
+        foreach (const QDjangoWhere &where, wheres)
+            where.bindValues(query);
+        if (source->exec(query) && query.next()) {
+            for (int i = 0; i < combined.size(); ++i)
+                combined[i]->cachedCount = query.value(i).toInt();
+        }
+    }
+
+    // run any remaining counts and the fetches
+    foreach (QDjangoQuerySetPrivate *querySet, d->counts) {
+        if (querySet->cachedCount < 0 && !querySet->hasResults) {
+            QDjangoWhere resolvedWhere;
+            QStringList tables;
+            querySet->countSql(db, resolvedWhere, querySet->lowMark, querySet->highMark, &tables);
+            querySet->cachedCountGenerations = QDjangoQueryCache::generations(tables);
+            querySet->cachedCount = querySet->sqlCount();
+            if (querySet->cachedCount < 0)
+                ret = false;
+        }
+    }
+    foreach (QDjangoQuerySetPrivate *querySet, d->fetches) {
+        if (!querySet->sqlFetch())
+            ret = false;
+    }
+    return ret;
+}
@@ -0,0 +1,97 @@
+/*
+ * QDjango
+ * Copyright (C) 2010-2011 Bolloré telecom
+ * See AUTHORS file for a full list of contributors.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef QDJANGO_QUERY_BATCH_H
+#define QDJANGO_QUERY_BATCH_H
+
+#include "QDjangoQuerySet.h"
+
+class QDjangoQueryBatchPrivate;
+
+/** \brief The QDjangoQueryBatch class evaluates several querysets
+ *   together to reduce the number of round-trips to the database.
+ *
+ *  Querysets are added to the batch using addCount() and addFetch(), then
+ *  evaluated by calling exec(). The results are stored in each queryset,
+ *  so that subsequent calls to QDjangoQuerySet::count(),
+ *  QDjangoQuerySet::size() or QDjangoQuerySet::at() do not access the
+ *  database.
+ *
+ *  All the counts are combined into a single SELECT statement made of
+ *  scalar subqueries. Fetches return different columns, which the Qt SQL
+ *  drivers cannot receive from one statement, so they are run one after
+ *  the other on the same connection. If the combined statement fails, the
+ *  counts are also run one after the other.
+ *
+ *  \code
+ *  QDjangoQuerySet<User> active = users.filter(QDjangoWhere("is_active", QDjangoWhere::Equals, true));
+ *  QDjangoQuerySet<User> staff = users.filter(QDjangoWhere("is_staff", QDjangoWhere::Equals, true));
+ *  QDjangoQuerySet<Message> latest = messages.orderBy(QStringList("-id")).limit(0, 10);
+ *
+ *  QDjangoQueryBatch batch;
+ *  batch.addCount(active);
+ *  batch.addCount(staff);
+ *  batch.addFetch(latest);
+ *  batch.exec();
+ *  \endcode
+ *
+ * \ingroup Database
+ */
+class QDjangoQueryBatch
+{
+public:
+    QDjangoQueryBatch();
+    ~QDjangoQueryBatch();
+
+    template <class T>
+    void addCount(const QDjangoQuerySet<T> &querySet);
+    template <class T>
+    void addFetch(const QDjangoQuerySet<T> &querySet);
+
+    void clear();
+    bool exec();
+
+private:
+    Q_DISABLE_COPY(QDjangoQueryBatch)
+    void addQuery(QDjangoQuerySetPrivate *querySet, bool fetch);
+
+    QDjangoQueryBatchPrivate *d;
+};
+
+/** Adds a count of the given queryset to the batch.
+ *
+ * \param querySet
+ */
+template <class T>
+void QDjangoQueryBatch::addCount(const QDjangoQuerySet<T> &querySet)
+{
+    addQuery(querySet.d, false);
+}
+
+/** Adds a fetch of the given queryset to the batch.
+ *
+ * \param querySet
+ */
+template <class T>
+void QDjangoQueryBatch::addFetch(const QDjangoQuerySet<T> &querySet)
+{
+    addQuery(querySet.d, true);
+}
+
+#endif
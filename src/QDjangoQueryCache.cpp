@@ -0,0 +1,204 @@
+/*
+ * QDjango
+ * Copyright (C) 2010-2011 Bolloré telecom
+ * See AUTHORS file for a full list of contributors.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <QCache>
+#include <QElapsedTimer>
+#include <QHash>
+#include <QMutex>
+
+#include "QDjangoQueryCache.h"
+
+class QDjangoQueryCacheEntry
+{
+public:
+    QList<QVariantList> properties;
+    QMap<QString, qint64> generations;
+    QElapsedTimer timer;
+    int ttl;
+};
+
+class QDjangoQueryCachePrivate
+{
+public:
+    QDjangoQueryCachePrivate()
+        : entries(16 * 1024 * 1024), hitCount(0), missCount(0)
+    {
+    }
+
+    QMutex mutex;
+    QCache<QString, QDjangoQueryCacheEntry> entries;
+    QHash<QString, qint64> generations;
+    qint64 hitCount;
+    qint64 missCount;
+};
+
+Q_GLOBAL_STATIC(QDjangoQueryCachePrivate, globalQueryCache)
+
+/** Returns the approximate number of bytes used to store a result set.
+ */
+static int resultCost(const QString &key, const QList<QVariantList> &properties)
+{
+    int cost = sizeof(QDjangoQueryCacheEntry) + key.size() * sizeof(QChar);
+    foreach (const QVariantList &row, properties) {
+        cost += sizeof(QVariantList) + row.size() * sizeof(QVariant);
+        foreach (const QVariant &value, row) {
+            if (value.type() == QVariant::String)
+                cost += value.toString().size() * sizeof(QChar);
+            else if (value.type() == QVariant::ByteArray)
+                cost += value.toByteArray().size();
+        }
+    }
+    return cost;
+}
+
+/** Returns the maximum number of bytes used by cached results.
+ */
+int QDjangoQueryCache::maxCost()
+{
+    QDjangoQueryCachePrivate *d = globalQueryCache();
+    QMutexLocker locker(&d->mutex);
+    return d->entries.maxCost();
+}
+
+/** Sets the maximum number of bytes used by cached results.
+ *
+ *  The default value is 16MB.
+ *
+ * \param bytes
+ */
+void QDjangoQueryCache::setMaxCost(int bytes)
+{
+    QDjangoQueryCachePrivate *d = globalQueryCache();
+    QMutexLocker locker(&d->mutex);
+    d->entries.setMaxCost(bytes);
+}
+
+/** Returns the approximate number of bytes used by cached results.
+ */
+int QDjangoQueryCache::totalCost()
+{
+    QDjangoQueryCachePrivate *d = globalQueryCache();
+    QMutexLocker locker(&d->mutex);
+    return d->entries.totalCost();
+}
+
+/** Returns the number of cached queries which were answered from the cache.
+ */
+qint64 QDjangoQueryCache::hitCount()
+{
+    QDjangoQueryCachePrivate *d = globalQueryCache();
+    QMutexLocker locker(&d->mutex);
+    return d->hitCount;
+}
+
+/** Returns the number of cached queries which had to be run against the
+ *  database.
+ */
+qint64 QDjangoQueryCache::missCount()
+{
+    QDjangoQueryCachePrivate *d = globalQueryCache();
+    QMutexLocker locker(&d->mutex);
+    return d->missCount;
+}
+
+/** Returns the proportion of cached queries which were answered from the
+ *  cache, between 0 and 1.
+ */
+double QDjangoQueryCache::hitRatio()
+{
+    QDjangoQueryCachePrivate *d = globalQueryCache();
+    QMutexLocker locker(&d->mutex);
+    const qint64 total = d->hitCount + d->missCount;
+    return total ? double(d->hitCount) / total : 0.0;
+}
+
+/** Removes all the cached results and resets the counters.
+ */
+void QDjangoQueryCache::clear()
+{
+    QDjangoQueryCachePrivate *d = globalQueryCache();
+    QMutexLocker locker(&d->mutex);
+    d->entries.clear();
+    d->hitCount = 0;
+    d->missCount = 0;
+}
+
+/** Invalidates the cached results which read from the given table.
+ *
+ *  Entries are not removed immediately, they are discarded the next time
+ *  they are looked up.
+ *
+ * \param table
+ */
+void QDjangoQueryCache::invalidate(const QString &table)
+{
+    QDjangoQueryCachePrivate *d = globalQueryCache();
+    QMutexLocker locker(&d->mutex);
+    d->generations[table]++;
+}
+
+bool QDjangoQueryCache::find(const QString &key, QList<QVariantList> &properties)
+{
+    QDjangoQueryCachePrivate *d = globalQueryCache();
+    QMutexLocker locker(&d->mutex);
+
+    QDjangoQueryCacheEntry *entry = d->entries.object(key);
+    if (entry) {
+        bool valid = !entry->timer.hasExpired(entry->ttl);
+        QMapIterator<QString, qint64> i(entry->generations);
+        while (valid && i.hasNext()) {
+            i.next();
+            if (d->generations.value(i.key()) != i.value())
+                valid = false;
+        }
+
+        if (valid) {
+            properties = entry->properties;
+            d->hitCount++;
+            return true;
+        }
+        d->entries.remove(key);
+    }
+    d->missCount++;
+    return false;
+}
+
+QMap<QString, qint64> QDjangoQueryCache::generations(const QStringList &tables)
+{
+    QDjangoQueryCachePrivate *d = globalQueryCache();
+    QMutexLocker locker(&d->mutex);
+
+    QMap<QString, qint64> generations;
+    foreach (const QString &table, tables)
+        generations.insert(table, d->generations.value(table));
+    return generations;
+}
+
+void QDjangoQueryCache::insert(const QString &key, const QMap<QString, qint64> &generations, const QList<QVariantList> &properties, int ttl)
+{
+    QDjangoQueryCachePrivate *d = globalQueryCache();
+    QMutexLocker locker(&d->mutex);
+
+    QDjangoQueryCacheEntry *entry = new QDjangoQueryCacheEntry;
+    entry->properties = properties;
+    entry->generations = generations;
+    entry->ttl = ttl;
+    entry->timer.start();
+    d->entries.insert(key, entry, resultCost(key, properties));
+}
@@ -0,0 +1,67 @@
+/*
+ * QDjango
+ * Copyright (C) 2010-2011 Bolloré telecom
+ * See AUTHORS file for a full list of contributors.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef QDJANGO_QUERY_CACHE_H
+#define QDJANGO_QUERY_CACHE_H
+
+#include <QList>
+#include <QMap>
+#include <QStringList>
+#include <QVariant>
+
+/** \brief The QDjangoQueryCache class holds the results of cached
+ *   querysets.
+ *
+ *  Querysets are cached by calling QDjangoQuerySet::cached(). Entries are
+ *  keyed by the compiled SQL and the bound values, and they are dropped:
+ *
+ *  \li when their time to live has expired
+ *  \li when QDjango writes to any of the tables the query reads from
+ *  \li when the total cost of the cache exceeds maxCost(), starting with
+ *  the least recently used entries
+ *
+ *  If you modify tables without going through QDjango, you should call
+ *  invalidate() yourself.
+ *
+ * \ingroup Database
+ */
+class QDjangoQueryCache
+{
+public:
+    static int maxCost();
+    static void setMaxCost(int bytes);
+    static int totalCost();
+
+    static qint64 hitCount();
+    static qint64 missCount();
+    static double hitRatio();
+
+    static void clear();
+    static void invalidate(const QString &table);
+
+private:
+    static bool find(const QString &key, QList<QVariantList> &properties);
+    static QMap<QString, qint64> generations(const QStringList &tables);
+    static void insert(const QString &key, const QMap<QString, qint64> &generations, const QList<QVariantList> &properties, int ttl);
+
+    friend class QDjangoQueryBatch;
+    friend class QDjangoQuerySetPrivate;
+};
+
+#endif
@@ -0,0 +1,245 @@
+/*
+ * QDjango
+ * Copyright (C) 2010-2011 Bolloré telecom
+ * See AUTHORS file for a full list of contributors.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <QDebug>
+#include <QHash>
+#include <QThreadStorage>
+
+#if defined(__GLIBC__)
+#include <cstdlib>
+#include <execinfo.h>
+#endif
+
+#include "QDjango.h"
+#include "QDjangoQueryDetector.h"
+
+class QDjangoQueryUnit
+{
+public:
+    QString name;
+    QHash<QString, int> counts;
+    QStringList reports;
+};
+
+class QDjangoQueryDetectorPrivate
+{
+public:
+    int threshold;
+    bool fatal;
+    QThreadStorage<QDjangoQueryUnit*> units;
+};
+
+/** Returns a description of the code which ran the current statement.
+ */
+static QString callSite()
+{
+#if defined(__GLIBC__)
+    void *frames[32];
+    const int count = backtrace(frames, 32);
+    char **symbols = backtrace_symbols(frames, count);
+    if (!symbols)
+        return QString();
+
+    // skip QDjango's own frames
+    QStringList lines;
+    for (int i = 0; i < count && lines.size() < 3; ++i) {
+        const QString symbol = QString::fromLocal8Bit(symbols[i]);
+        if (!symbol.contains(QLatin1String("QDjango")))
+            lines << symbol;
+    }
+    std::free(symbols);
+    return lines.join(QLatin1String("\n    "));
+#else
+    return QString();
+#endif
+}
+
+/** Constructs a new detector which reports statements running more than
+ *  \a threshold times within a unit of work, and installs it as a query
+ *  observer.
+ *
+ * \param threshold
+ */
+QDjangoQueryDetector::QDjangoQueryDetector(int threshold)
+    : d(new QDjangoQueryDetectorPrivate)
+{
+    Q_ASSERT(threshold > 0);
+    d->threshold = threshold;
+    d->fatal = false;
+    QDjango::addQueryObserver(this);
+}
+
+/** Removes the detector from the query observers and destroys it.
+ */
+QDjangoQueryDetector::~QDjangoQueryDetector()
+{
+    QDjango::removeQueryObserver(this);
+    delete d;
+}
+
+/** Returns the number of times a statement may run within a unit of work
+ *  before it is reported.
+ */
+int QDjangoQueryDetector::threshold() const
+{
+    return d->threshold;
+}
+
+/** Sets the number of times a statement may run within a unit of work
+ *  before it is reported.
+ *
+ * \param threshold
+ */
+void QDjangoQueryDetector::setThreshold(int threshold)
+{
+    Q_ASSERT(threshold > 0);
+    d->threshold = threshold;
+}
+
+/** Returns true if repeated statements abort the program.
+ */
+bool QDjangoQueryDetector::isFatal() const
+{
+    return d->fatal;
+}
+
+/** Sets whether repeated statements abort the program using qFatal()
+ *  instead of outputting a warning, for instance in test suites.
+ *
+ * \param fatal
+ */
+void QDjangoQueryDetector::setFatal(bool fatal)
+{
+    d->fatal = fatal;
+}
+
+/** Starts a unit of work in the current thread.
+ *
+ * \param name a name for the unit of work, used in the reports
+ */
+void QDjangoQueryDetector::begin(const QString &name)
+{
+    QDjangoQueryUnit *unit = new QDjangoQueryUnit;
+    unit->name = name;
+    d->units.setLocalData(unit);
+}
+
+/** Ends the unit of work in the current thread.
+ *
+ * \return the reports for the statements which were repeated
+ */
+QStringList QDjangoQueryDetector::end()
+{
+    if (!d->units.hasLocalData() || !d->units.localData())
+        return QStringList();
+
+    const QStringList reports = d->units.localData()->reports;
+    d->units.setLocalData(0);
+    return reports;
+}
+
+/** Counts a statement against the current thread's unit of work.
+ *
+ * \param event
+ */
+void QDjangoQueryDetector::queryExecuted(const QDjangoQueryEvent &event)
+{
+    if (!d->units.hasLocalData() || !d->units.localData())
+        return;
+
+    QDjangoQueryUnit *unit = d->units.localData();
+    const QString key = fingerprint(event.sql);
+    const int count = ++unit->counts[key];
+    if (count != d->threshold + 1)
+        return;
+
+    QString report = QString("Statement repeated more than %1 times").arg(d->threshold);
+    if (!unit->name.isEmpty())
+        report += " in " + unit->name;
+    report += ": " + key;
+    if (key.startsWith(QLatin1String("SELECT ")))
+        report += "\n  Consider QDjangoQuerySet::selectRelated() or fetching the objects with a single pk__in filter";
+    const QString site = callSite();
+    if (!site.isEmpty())
+        report += "\n  Called from:\n    " + site;
+    unit->reports << report;
+
+    if (d->fatal)
+        qFatal("%s", qPrintable(report));
+    else
+        qWarning("%s", qPrintable(report));
+}
+
+/** Returns the fingerprint of an SQL statement, in which string and
+ *  numeric literals are replaced with placeholders, lists of placeholders
+ *  are collapsed and whitespace is normalised.
+ *
+ * \param sql
+ */
+QString QDjangoQueryDetector::fingerprint(const QString &sql)
+{
+    QString result;
+    result.reserve(sql.size());
+    bool space = false;
+    for (int i = 0; i < sql.size(); ++i) {
+        const QChar c = sql[i];
+        if (c.isSpace()) {
+            space = !result.isEmpty();
+            continue;
+        }
+        if (space) {
+            result += QLatin1Char(' ');
+            space = false;
+        }
+
+        if (c == QLatin1Char('\'')) {
+            // string literal, with doubled quotes as escapes
+            int j = i + 1;
+            while (j < sql.size()) {
+                if (sql[j] == QLatin1Char('\'')) {
+                    if (j + 1 < sql.size() && sql[j + 1] == QLatin1Char('\''))
+                        j++;
+                    else
+                        break;
+                }
+                j++;
+            }
+            result += QLatin1Char('?');
+            i = j;
+        } else if (c.isDigit() && (result.isEmpty() || !(result.at(result.size() - 1).isLetterOrNumber() || result.at(result.size() - 1) == QLatin1Char('_')))) {
+            // numeric literal, but not part of an identifier
+            int j = i;
+            while (j + 1 < sql.size() && (sql[j + 1].isDigit() || sql[j + 1] == QLatin1Char('.')))
+                j++;
+            result += QLatin1Char('?');
+            i = j;
+        } else {
+            result += c;
+        }
+    }
+
+    // collapse lists of placeholders
+    QString previous;
+    while (previous != result) {
+        previous = result;
+        result.replace(QLatin1String("?, ?"), QLatin1String("?"));
+        result.replace(QLatin1String("?,?"), QLatin1String("?"));
+    }
+    return result;
+}
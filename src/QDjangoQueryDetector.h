@@ -0,0 +1,78 @@
+/*
+ * QDjango
+ * Copyright (C) 2010-2011 Bolloré telecom
+ * See AUTHORS file for a full list of contributors.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef QDJANGO_QUERY_DETECTOR_H
+#define QDJANGO_QUERY_DETECTOR_H
+
+#include <QStringList>
+
+#include "QDjangoQueryObserver.h"
+
+class QDjangoQueryDetectorPrivate;
+
+/** \brief The QDjangoQueryDetector class detects statements which are
+ *   repeated within a unit of work, such as the N+1 queries caused by
+ *   loading related objects in a loop.
+ *
+ *  A unit of work is delimited by calling begin() and end() from the same
+ *  thread, for instance around the handling of an HTTP request or around
+ *  a test. Statements are fingerprinted by replacing their literals and
+ *  bound values with placeholders. When a fingerprint runs more than
+ *  threshold() times within a unit of work, a warning is output with the
+ *  repeated SQL, the call site if it can be determined, and a suggestion
+ *  to use QDjangoQuerySet::selectRelated() or to fetch the objects with a
+ *  single filter.
+ *
+ *  \code
+ *  QDjangoQueryDetector detector;
+ *  detector.begin(request.path());
+ *  QDjangoHttpResponse *response = handleRequest(request);
+ *  detector.end();
+ *  \endcode
+ *
+ *  The detector observes queries from the moment it is constructed, and
+ *  is intended for development and canary builds.
+ *
+ * \ingroup Database
+ */
+class QDjangoQueryDetector : public QDjangoQueryObserver
+{
+public:
+    QDjangoQueryDetector(int threshold = 5);
+    ~QDjangoQueryDetector();
+
+    int threshold() const;
+    void setThreshold(int threshold);
+
+    bool isFatal() const;
+    void setFatal(bool fatal);
+
+    void begin(const QString &name = QString());
+    QStringList end();
+
+    void queryExecuted(const QDjangoQueryEvent &event);
+
+    static QString fingerprint(const QString &sql);
+
+private:
+    Q_DISABLE_COPY(QDjangoQueryDetector)
+    QDjangoQueryDetectorPrivate *d;
+};
+
+#endif
@@ -0,0 +1,89 @@
+/*
+ * QDjango
+ * Copyright (C) 2010-2011 Bolloré telecom
+ * See AUTHORS file for a full list of contributors.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef QDJANGO_QUERY_OBSERVER_H
+#define QDJANGO_QUERY_OBSERVER_H
+
+#include <QSqlError>
+#include <QVariant>
+
+class QThread;
+
+/** \brief The QDjangoQueryEvent class describes an SQL statement which
+ *   was run by QDjango.
+ *
+ * \ingroup Database
+ */
+class QDjangoQueryEvent
+{
+public:
+    QDjangoQueryEvent();
+
+    /** The SQL statement. */
+    QString sql;
+    /** The values bound to the statement, in order. */
+    QVariantList values;
+    /** The name of the database connection. */
+    QString connectionName;
+    /** The thread which ran the statement. */
+    QThread *thread;
+    /** The duration of the statement in microseconds. */
+    qint64 duration;
+    /** The number of rows returned by a SELECT, or affected by other
+     *  statements, or -1 if it is not known. */
+    int rowCount;
+    /** The error reported by the database, if the statement failed. */
+    QSqlError error;
+};
+
+/** \brief The QDjangoQueryObserver class is the interface for receiving
+ *   notifications of every SQL statement QDjango runs.
+ *
+ *  Observers are installed with QDjango::addQueryObserver(). They are
+ *  called from the thread which ran the statement, once it has completed,
+ *  so they must be thread-safe and return quickly. When no observer is
+ *  installed, statements are run without any instrumentation.
+ *
+ *  \code
+ *  class QueryLogger : public QDjangoQueryObserver
+ *  {
+ *  public:
+ *      void queryExecuted(const QDjangoQueryEvent &event)
+ *      {
+ *          if (event.duration > 100000)
+ *              qWarning() << "Slow query" << event.sql;
+ *      }
+ *  };
+ *  \endcode
+ *
+ * \ingroup Database
+ */
+class QDjangoQueryObserver
+{
+public:
+    virtual ~QDjangoQueryObserver();
+
+    /** Called when an SQL statement has been run.
+     *
+     * \param event
+     */
+    virtual void queryExecuted(const QDjangoQueryEvent &event) = 0;
+};
+
+#endif
@@ -17,13 +17,17 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <QRunnable>
+#include <QSemaphore>
 #include <QSqlDriver>
 
 #include "QDjango.h"
+#include "QDjangoQueryCache.h"
 #include "QDjangoQuerySet.h"
 
 QDjangoCompiler::QDjangoCompiler(const QString &modelName, const QSqlDatabase &db)
 {
+    database = db;
     driver = db.driver();
     baseModel = QDjango::metaModel(modelName);
 }
@@ -108,6 +112,25 @@ QString QDjangoCompiler::fromSql()
     return from;
 }
 
+bool QDjangoCompiler::hasJoins() const
+{
+    return !modelRefs.isEmpty();
+}
+
+QStringList QDjangoCompiler::tables() const
+{
+    QStringList tables;
+    tables << baseModel.m_table;
+    foreach (const QString &name, modelRefs.keys())
+        tables << modelRefs[name].second.m_table;
+    return tables;
+}
+
+QString QDjangoCompiler::primaryKeyColumn()
+{
+    return databaseColumn("pk");
+}
+
 QString QDjangoCompiler::orderLimitSql(const QStringList orderBy, int lowMark, int highMark)
 {
     QString limit;
@@ -135,7 +158,7 @@ QString QDjangoCompiler::orderLimitSql(const QStringList orderBy, int lowMark, i
     {
         // no-limit is backend specific
         if (highMark <= 0)
-            limit += QDjango::noLimitSql();
+            limit += QDjango::noLimitSql(database);
         limit += QString(" OFFSET %1").arg(lowMark);
     }
     return limit;
@@ -155,6 +178,8 @@ void QDjangoCompiler::resolve(QDjangoWhere &where)
 QDjangoQuerySetPrivate::QDjangoQuerySetPrivate(const QString &modelName)
     : counter(1),
     hasResults(false),
+    cachedCount(-1),
+    cacheTtl(0),
     lowMark(0),
     highMark(0),
     selectRelated(false),
@@ -178,98 +203,68 @@ QDjangoWhere QDjangoQuerySetPrivate::resolvedWhere(const QSqlDatabase &db) const
     return resolvedWhere;
 }
 
-int QDjangoQuerySetPrivate::sqlCount() const
+QString QDjangoQuerySetPrivate::countSql(const QSqlDatabase &db, QDjangoWhere &resolvedWhere, int low, int high, QStringList *tables) const
 {
-    QSqlDatabase db = QDjango::database();
-
-    // build query
     QDjangoCompiler compiler(m_modelName, db);
-    QDjangoWhere resolvedWhere(whereClause);
+    resolvedWhere = whereClause;
     compiler.resolve(resolvedWhere);
 
     const QString where = resolvedWhere.sql();
-    const QString limit = compiler.orderLimitSql(orderBy, lowMark, highMark);
+    const QString limit = compiler.orderLimitSql(orderBy, low, high);
     QString sql = "SELECT COUNT(*) FROM " + compiler.fromSql();
     if (!where.isEmpty())
         sql += " WHERE " + where;
     sql += limit;
-    QDjangoQuery query(db);
-    query.prepare(sql);
-    resolvedWhere.bindValues(query);
-
-    // execute query
-    if (!query.exec() || !query.next())
-        return -1;
-    return query.value(0).toInt();
+    if (tables)
+        *tables = compiler.tables();
+    return sql;
 }
 
-bool QDjangoQuerySetPrivate::sqlDelete()
+QString QDjangoQuerySetPrivate::fetchSql(QDjangoCompiler &compiler, QDjangoWhere &resolvedWhere, QStringList &fields, int low, int high) const
 {
-    // DELETE on an empty queryset doesn't need a query
-    if (whereClause.isNone())
-        return true;
-
-    // FIXME : it is not possible to remove entries once a limit has been set
-    // because SQLite does not support limits on DELETE unless compiled with the
-    // SQLITE_ENABLE_UPDATE_DELETE_LIMIT option
-    if (lowMark || highMark)
-        return false;
-
-    QSqlDatabase db = QDjango::database();
-
-    // build query
-    QDjangoCompiler compiler(m_modelName, db);
-    QDjangoWhere resolvedWhere(whereClause);
+    resolvedWhere = whereClause;
     compiler.resolve(resolvedWhere);
 
+    fields = compiler.fieldNames(selectRelated);
     const QString where = resolvedWhere.sql();
-    const QString limit = compiler.orderLimitSql(orderBy, lowMark, highMark);
-    QString sql = "DELETE FROM " + compiler.fromSql();
+    const QString limit = compiler.orderLimitSql(orderBy, low, high);
+    QString sql = "SELECT " + fields.join(", ") + " FROM " + compiler.fromSql();
     if (!where.isEmpty())
         sql += " WHERE " + where;
     sql += limit;
+    return sql;
+}
+
+int QDjangoQuerySetPrivate::countRows(QDjangoDatabase *source, int low, int high) const
+{
+    QSqlDatabase db = source->connection();
+
+    // build query
+    QDjangoWhere resolvedWhere;
     QDjangoQuery query(db);
-    query.prepare(sql);
+    query.prepare(countSql(db, resolvedWhere, low, high));
     resolvedWhere.bindValues(query);
 
     // execute query
-    if (!query.exec())
-        return false;
-
-    // invalidate cache
-    if (hasResults)
-    {
-        properties.clear();
-        hasResults = false;
-    }
-    return true;
+    if (!source->exec(query) || !query.next())
+        return -1;
+    return query.value(0).toInt();
 }
 
-bool QDjangoQuerySetPrivate::sqlFetch()
+bool QDjangoQuerySetPrivate::fetchRows(QDjangoDatabase *source, int low, int high, QList<QVariantList> &rows) const
 {
-    if (hasResults || whereClause.isNone())
-        return true;
-
-    QSqlDatabase db = QDjango::database();
+    QSqlDatabase db = source->connection();
 
     // build query
     QDjangoCompiler compiler(m_modelName, db);
-    QDjangoWhere resolvedWhere(whereClause);
-    compiler.resolve(resolvedWhere);
-
-    const QStringList fields = compiler.fieldNames(selectRelated);
-    const QString where = resolvedWhere.sql();
-    const QString limit = compiler.orderLimitSql(orderBy, lowMark, highMark);
-    QString sql = "SELECT " + fields.join(", ") + " FROM " + compiler.fromSql();
-    if (!where.isEmpty())
-        sql += " WHERE " + where;
-    sql += limit;
+    QDjangoWhere resolvedWhere;
+    QStringList fields;
     QDjangoQuery query(db);
-    query.prepare(sql);
+    query.prepare(fetchSql(compiler, resolvedWhere, fields, low, high));
     resolvedWhere.bindValues(query);
 
     // execute query
-    if (!query.exec())
+    if (!source->exec(query))
         return false;
 
     // store results
@@ -292,9 +287,422 @@ bool QDjangoQuerySetPrivate::sqlFetch()
 
             props << value;
         }
-        properties.append(props);
+        rows.append(props);
+    }
+    return true;
+}
+
+/** Collects the shard key values a WHERE clause is restricted to.
+ *
+ * \return true if the clause only matches rows with the collected values
+ */
+bool QDjangoQuerySetPrivate::shardValues(const QDjangoWhere &where, const QString &shardKey, bool primaryKey, QVariantList &values)
+{
+    if (where.m_negate)
+        return false;
+
+    // a conjunction is restricted if any of its members is
+    if (where.m_combine == QDjangoWhere::AndCombine) {
+        foreach (const QDjangoWhere &child, where.m_children)
+            if (shardValues(child, shardKey, primaryKey, values))
+                return true;
+        return false;
+    } else if (where.m_combine != QDjangoWhere::NoCombine) {
+        return false;
+    }
+
+    if (where.m_key != shardKey && !(primaryKey && where.m_key == QLatin1String("pk")))
+        return false;
+    if (where.m_operation == QDjangoWhere::Equals) {
+        values << where.m_data;
+        return true;
+    } else if (where.m_operation == QDjangoWhere::IsIn) {
+        values = where.m_data.toList();
+        return !values.isEmpty();
+    }
+    return false;
+}
+
+/** Returns the databases this queryset needs to be run on.
+ *
+ *  For a sharded model, these are the shards holding the shard key values
+ *  the queryset is restricted to, or all the shards.
+ *
+ * \param write
+ */
+QList<QDjangoDatabase*> QDjangoQuerySetPrivate::databases(bool write) const
+{
+    if (!databaseAlias.isEmpty())
+        return QList<QDjangoDatabase*>() << QDjango::namedDatabase(databaseAlias);
+
+    // only the main database has replicas
+    const QDjangoMetaModel metaModel = QDjango::metaModel(m_modelName);
+    if (!isSharded())
+        return (write || !metaModel.m_alias.isEmpty()) ? metaModel.databases() : (QList<QDjangoDatabase*>() << QDjango::readSource());
+
+    QVariantList values;
+    if (!shardValues(whereClause, QString::fromLatin1(metaModel.m_shardKey), metaModel.m_shardKey == metaModel.m_primaryKey, values))
+        return metaModel.databases();
+
+    QList<QDjangoDatabase*> shards;
+    foreach (const QVariant &value, values) {
+        QDjangoDatabase *shard = metaModel.database(value);
+        if (!shards.contains(shard))
+            shards << shard;
+    }
+    return shards;
+}
+
+/** Returns true if the count stored by a QDjangoQueryBatch is still
+ *  valid, that is none of the tables it read has been written to since.
+ */
+bool QDjangoQuerySetPrivate::hasCachedCount() const
+{
+    return cachedCount >= 0 &&
+        QDjangoQueryCache::generations(cachedCountGenerations.keys()) == cachedCountGenerations;
+}
+
+/** Returns true if the queryset is not run on the main database or its
+ *  replicas.
+ */
+bool QDjangoQuerySetPrivate::isRouted() const
+{
+    return !databaseAlias.isEmpty() || !QDjango::metaModel(m_modelName).m_alias.isEmpty() || isSharded();
+}
+
+bool QDjangoQuerySetPrivate::isSharded() const
+{
+    return QDjango::shardCount() > 0 && !QDjango::metaModel(m_modelName).m_shardKey.isEmpty();
+}
+
+/** \internal
+ *
+ *  Runs a queryset's fetch or count on one shard.
+ */
+class QDjangoShardJob : public QRunnable
+{
+public:
+    QDjangoShardJob(const QDjangoQuerySetPrivate *querySet, QDjangoDatabase *shard, bool count)
+        : done(0), ok(false), rowCount(0),
+        m_count(count), m_querySet(querySet), m_shard(shard)
+    {
+        setAutoDelete(false);
+    }
+
+    void run()
+    {
+        if (m_count) {
+            rowCount = m_querySet->countRows(m_shard, 0, 0);
+            ok = (rowCount >= 0);
+        } else {
+            // the offset can only be applied once the results are merged
+            ok = m_querySet->fetchRows(m_shard, 0, m_querySet->highMark, rows);
+        }
+        if (done)
+            done->release();
+    }
+
+    static bool runAll(const QList<QDjangoShardJob*> &jobs);
+
+    QSemaphore *done;
+    bool ok;
+    int rowCount;
+    QList<QVariantList> rows;
+
+private:
+    bool m_count;
+    const QDjangoQuerySetPrivate *m_querySet;
+    QDjangoDatabase *m_shard;
+};
+
+/** Runs the given jobs in parallel and waits for them to finish.
+ *
+ *  Jobs for which no thread is available are run in the calling thread.
+ */
+bool QDjangoShardJob::runAll(const QList<QDjangoShardJob*> &jobs)
+{
+    QSemaphore semaphore;
+    QList<QDjangoShardJob*> remaining;
+    int started = 0;
+    for (int i = 1; i < jobs.size(); ++i) {
+        jobs[i]->done = &semaphore;
+        if (QDjango::threadPool()->tryStart(jobs[i])) {
+            started++;
+        } else {
+            jobs[i]->done = 0;
+            remaining << jobs[i];
+        }
+    }
+    if (!jobs.isEmpty())
+        jobs.first()->run();
+    foreach (QDjangoShardJob *job, remaining)
+        job->run();
+    semaphore.acquire(started);
+
+    foreach (QDjangoShardJob *job, jobs)
+        if (!job->ok)
+            return false;
+    return true;
+}
+
+/** Compares two values from different shards, null values first.
+ */
+static int compareValues(const QVariant &a, const QVariant &b)
+{
+    if (a.isNull() || b.isNull())
+        return (a.isNull() ? 0 : 1) - (b.isNull() ? 0 : 1);
+
+    switch (a.type())
+    {
+    case QVariant::Bool:
+    case QVariant::Int:
+    case QVariant::UInt:
+    case QVariant::LongLong:
+    case QVariant::ULongLong:
+    case QVariant::Double:
+        return a.toDouble() < b.toDouble() ? -1 : (a.toDouble() > b.toDouble() ? 1 : 0);
+    case QVariant::Date:
+    case QVariant::DateTime:
+        return a.toDateTime() < b.toDateTime() ? -1 : (a.toDateTime() > b.toDateTime() ? 1 : 0);
+    case QVariant::Time:
+        return a.toTime() < b.toTime() ? -1 : (a.toTime() > b.toTime() ? 1 : 0);
+    default:
+        return QString::compare(a.toString(), b.toString());
+    }
+}
+
+/** \internal
+ *
+ *  Orders rows by a list of (column index, descending) pairs.
+ */
+class QDjangoRowLessThan
+{
+public:
+    QDjangoRowLessThan(const QList<QPair<int, bool> > &keys)
+        : m_keys(keys)
+    {
+    }
+
+    bool operator()(const QVariantList &a, const QVariantList &b) const
+    {
+        for (int i = 0; i < m_keys.size(); ++i) {
+            const int result = compareValues(a.at(m_keys[i].first), b.at(m_keys[i].first));
+            if (result)
+                return m_keys[i].second ? (result > 0) : (result < 0);
+        }
+        return false;
+    }
+
+private:
+    QList<QPair<int, bool> > m_keys;
+};
+
+/** Fetches rows from several shards in parallel and merges them, taking
+ *  the queryset's ordering and limits into account.
+ */
+bool QDjangoQuerySetPrivate::fetchShards(const QList<QDjangoDatabase*> &shards, QList<QVariantList> &rows) const
+{
+    QList<QDjangoShardJob*> jobs;
+    foreach (QDjangoDatabase *shard, shards)
+        jobs << new QDjangoShardJob(this, shard, false);
+    const bool ok = QDjangoShardJob::runAll(jobs);
+    if (ok) {
+        foreach (QDjangoShardJob *job, jobs)
+            rows += job->rows;
+    }
+    qDeleteAll(jobs);
+    if (!ok)
+        return false;
+
+    // merge the results
+    if (!orderBy.isEmpty()) {
+        QSqlDatabase db = shards.first()->connection();
+        QDjangoCompiler compiler(m_modelName, db);
+        QDjangoWhere resolvedWhere;
+        QStringList fields;
+        fetchSql(compiler, resolvedWhere, fields, 0, 0);
+
+        QList<QPair<int, bool> > keys;
+        foreach (QString key, orderBy) {
+            const bool descending = key.startsWith(QLatin1Char('-'));
+            if (descending || key.startsWith(QLatin1Char('+')))
+                key = key.mid(1);
+            const int index = fields.indexOf(compiler.databaseColumn(key));
+            if (index < 0) {
+                qWarning("Cannot merge shard results ordered by %s", qPrintable(key));
+                continue;
+            }
+            keys << qMakePair(index, descending);
+        }
+        qStableSort(rows.begin(), rows.end(), QDjangoRowLessThan(keys));
+    }
+    if (lowMark || highMark)
+        rows = rows.mid(lowMark, highMark ? highMark - lowMark : -1);
+    return true;
+}
+
+int QDjangoQuerySetPrivate::sqlCount() const
+{
+    const QList<QDjangoDatabase*> sources = databases(false);
+    if (sources.size() == 1)
+        return countRows(sources.first(), lowMark, highMark);
+
+    // add up the counts of all the shards, then apply the limits
+    QList<QDjangoShardJob*> jobs;
+    foreach (QDjangoDatabase *shard, sources)
+        jobs << new QDjangoShardJob(this, shard, true);
+    int total = -1;
+    if (QDjangoShardJob::runAll(jobs)) {
+        total = 0;
+        foreach (QDjangoShardJob *job, jobs)
+            total += job->rowCount;
+        total = qMax(0, total - lowMark);
+        if (highMark)
+            total = qMin(total, highMark - lowMark);
+    }
+    qDeleteAll(jobs);
+    return total;
+}
+
+bool QDjangoQuerySetPrivate::sqlDelete()
+{
+    // DELETE on an empty queryset doesn't need a query
+    if (whereClause.isNone())
+        return true;
+
+    // FIXME : it is not possible to remove entries once a limit has been set
+    // because SQLite does not support limits on DELETE unless compiled with the
+    // SQLITE_ENABLE_UPDATE_DELETE_LIMIT option
+    if (lowMark || highMark)
+        return false;
+
+    const QDjangoMetaModel metaModel = QDjango::metaModel(m_modelName);
+    QDjangoWriteNotifier notifier(metaModel.m_table);
+
+    // rows are deleted from one shard after the other
+    foreach (QDjangoDatabase *target, databases(true)) {
+        QSqlDatabase db = target->connection();
+        notifier.addDatabase(db);
+
+        // build query
+        QDjangoCompiler compiler(m_modelName, db);
+        QDjangoWhere resolvedWhere(whereClause);
+        compiler.resolve(resolvedWhere);
+
+        const QString where = resolvedWhere.sql();
+        const QString limit = compiler.orderLimitSql(orderBy, lowMark, highMark);
+        const QString quotedTable = db.driver()->escapeIdentifier(metaModel.m_table, QSqlDriver::TableName);
+        QString sql;
+        if (!compiler.hasJoins()) {
+            sql = "DELETE FROM " + compiler.fromSql();
+            if (!where.isEmpty())
+                sql += " WHERE " + where;
+            sql += limit;
+        } else if (db.driverName() == QLatin1String("QMYSQL")) {
+            // MySQL supports joins using the multiple-table syntax
+            sql = "DELETE " + quotedTable + " FROM " + compiler.fromSql();
+            if (!where.isEmpty())
+                sql += " WHERE " + where;
+        } else {
+            // other databases reject joins in a DELETE statement, so select
+            // the primary keys of the rows to delete in a subquery
+            const QString pk = compiler.primaryKeyColumn();
+            QString subSql = "SELECT " + pk + " FROM " + compiler.fromSql();
+            if (!where.isEmpty())
+                subSql += " WHERE " + where;
+            sql = "DELETE FROM " + quotedTable + " WHERE " + pk + " IN (" + subSql + ")";
+        }
+        QDjangoQuery query(db);
+        query.prepare(sql);
+        resolvedWhere.bindValues(query);
+
+        // execute query
+        if (!query.exec())
+            return false;
+    }
+
+    // invalidate cache
+    if (hasResults)
+    {
+        properties.clear();
+        hasResults = false;
+    }
+    cachedCount = -1;
+    return true;
+}
+
+QString QDjangoQuerySetPrivate::sqlExplain(bool analyze) const
+{
+    if (whereClause.isNone())
+        return QString();
+
+    // use the database which fetched the objects, otherwise the primary
+    // database so that no replica is picked, or if it has since been
+    // removed; for sharded models, the plan of the first shard is returned
+    QDjangoDatabase *source = fetchSource ? fetchSource.data() : databases(true).first();
+    QSqlDatabase db = source->connection();
+
+    QDjangoCompiler compiler(m_modelName, db);
+    QDjangoWhere resolvedWhere;
+    QStringList fields;
+    const QString sql = fetchSql(compiler, resolvedWhere, fields, lowMark, highMark);
+
+    QDjangoQuery query(db);
+    resolvedWhere.bindValues(query);
+    QVariantList values;
+    for (int i = 0; i < query.boundValues().size(); ++i)
+        values << query.boundValue(i);
+    return QDjango::explain(db, sql, values, analyze);
+}
+
+bool QDjangoQuerySetPrivate::sqlFetch()
+{
+    if (hasResults || whereClause.isNone())
+        return true;
+
+    const QList<QDjangoDatabase*> sources = databases(false);
+
+    // look for cached results
+    QString cacheKey;
+    QMap<QString, qint64> generations;
+    if (cacheTtl > 0) {
+        QSqlDatabase db = sources.first()->connection();
+        QDjangoCompiler compiler(m_modelName, db);
+        QDjangoWhere resolvedWhere;
+        QStringList fields;
+        cacheKey = db.databaseName() + QLatin1Char('\n') + fetchSql(compiler, resolvedWhere, fields, lowMark, highMark);
+
+        QDjangoQuery query(db);
+        resolvedWhere.bindValues(query);
+        foreach (const QVariant &value, query.boundValues())
+            cacheKey += QLatin1Char('\n') + QLatin1String(value.typeName()) + QLatin1Char(':') + value.toString();
+
+        // results which see this thread's uncommitted writes are not shared
+        if (QDjango::hasUncommittedWrites(compiler.tables())) {
+            cacheKey.clear();
+        } else {
+            if (QDjangoQueryCache::find(cacheKey, properties)) {
+                hasResults = true;
+                return true;
+            }
+            generations = QDjangoQueryCache::generations(compiler.tables());
+        }
+    }
+
+    // execute query
+    QList<QVariantList> rows;
+    if (sources.size() == 1) {
+        fetchSource = sources.first();
+        if (!fetchRows(sources.first(), lowMark, highMark, rows))
+            return false;
+    } else if (!fetchShards(sources, rows)) {
+        return false;
     }
+    properties = rows;
     hasResults = true;
+
+    if (!cacheKey.isEmpty())
+        QDjangoQueryCache::insert(cacheKey, generations, properties, cacheTtl);
     return true;
 }
 
@@ -282,16 +282,22 @@ public:
     ~QDjangoQuerySet();
 
     QDjangoQuerySet all() const;
+    QDjangoQuerySet cached(int msecs) const;
     QDjangoQuerySet exclude(const QDjangoWhere &where) const;
     QDjangoQuerySet filter(const QDjangoWhere &where) const;
     QDjangoQuerySet limit(int pos, int length = -1) const;
     QDjangoQuerySet none() const;
     QDjangoQuerySet orderBy(const QStringList &keys) const;
     QDjangoQuerySet selectRelated() const;
+    QDjangoQuerySet usingDatabase(const QString &alias) const;
 
     int count() const;
+    QString explain(bool analyze = false) const;
     QDjangoWhere where() const;
 
+    QFuture<QDjangoQuerySet<T> > fetchAsync() const;
+    QFuture<int> countAsync() const;
+
     bool remove();
     int size();
     QList<QVariantMap> values(const QStringList &fields = QStringList());
@@ -310,8 +316,50 @@ public:
 
 private:
     QDjangoQuerySetPrivate *d;
+    friend class QDjangoQueryBatch;
 };
 
+/** \cond */
+template <class T>
+class QDjangoQuerySetFetchTask : public QDjangoFutureTask<QDjangoQuerySet<T> >
+{
+public:
+    QDjangoQuerySetFetchTask(const QDjangoQuerySet<T> &querySet)
+        : m_querySet(querySet)
+    {
+    }
+
+protected:
+    QDjangoQuerySet<T> compute()
+    {
+        m_querySet.size();
+        return m_querySet;
+    }
+
+private:
+    QDjangoQuerySet<T> m_querySet;
+};
+
+template <class T>
+class QDjangoQuerySetCountTask : public QDjangoFutureTask<int>
+{
+public:
+    QDjangoQuerySetCountTask(const QDjangoQuerySet<T> &querySet)
+        : m_querySet(querySet)
+    {
+    }
+
+protected:
+    int compute()
+    {
+        return m_querySet.count();
+    }
+
+private:
+    QDjangoQuerySet<T> m_querySet;
+};
+/** \endcond */
+
 /** Constructs a new queryset.
  */
 template <class T>
@@ -416,6 +464,27 @@ QDjangoQuerySet<T> QDjangoQuerySet<T>::all() const
     other.d->orderBy = d->orderBy;
     other.d->selectRelated = d->selectRelated;
     other.d->whereClause = d->whereClause;
+    other.d->cacheTtl = d->cacheTtl;
+    other.d->databaseAlias = d->databaseAlias;
+    return other;
+}
+
+/** Returns a copy of the current QDjangoQuerySet whose results are stored
+ *  in the QDjangoQueryCache for up to the given number of milliseconds.
+ *
+ *  When an identical query is fetched again, the results are taken from
+ *  the cache instead of the database, unless one of the tables it reads
+ *  from was written to by QDjango in the meantime.
+ *
+ * \param msecs the maximum age of the cached results, 0 disables caching
+ */
+template <class T>
+QDjangoQuerySet<T> QDjangoQuerySet<T>::cached(int msecs) const
+{
+    Q_ASSERT(msecs >= 0);
+
+    QDjangoQuerySet<T> other = all();
+    other.d->cacheTtl = msecs;
     return other;
 }
 
@@ -425,17 +494,81 @@ QDjangoQuerySet<T> QDjangoQuerySet<T>::all() const
  *  If you intend to iterate over the results, you should consider using
  *  size() instead.
  *
- * \note If the QDjangoQuerySet is already fully fetched, this simply returns
- *  the number of objects.
+ * \note If the QDjangoQuerySet is already fully fetched, or if it was
+ *  counted by a QDjangoQueryBatch and the tables it reads have not been
+ *  written to since, this simply returns the number of objects.
  */
 template <class T>
 int QDjangoQuerySet<T>::count() const
 {
     if (d->hasResults)
         return d->properties.size();
+    if (d->hasCachedCount())
+        return d->cachedCount;
     return d->sqlCount();
 }
 
+/** Counts the number of objects in the queryset using an SQL COUNT query
+ *  which runs on QDjango::threadPool().
+ *
+ *  The result is -1 if the query failed.
+ *
+ *  \sa count()
+ */
+template <class T>
+QFuture<int> QDjangoQuerySet<T>::countAsync() const
+{
+    QDjangoQuerySetCountTask<T> *task = new QDjangoQuerySetCountTask<T>(all());
+    return task->start(QDjango::threadPool());
+}
+
+/** Fetches the objects in the queryset on QDjango::threadPool().
+ *
+ *  The result is a fully fetched copy of the queryset, so that calling
+ *  size(), at() or iterating over it does not access the database. This
+ *  queryset is left untouched.
+ *
+ *  This allows a QDjangoHttpController to respond without blocking the
+ *  server's event loop, by returning a QDjangoHttpResponse subclass whose
+ *  isReady() method returns false until the data has arrived:
+ *
+ *  \code
+ *  class UserListResponse : public QDjangoHttpResponse
+ *  {
+ *      Q_OBJECT
+ *
+ *  public:
+ *      UserListResponse()
+ *      {
+ *          connect(&m_watcher, SIGNAL(finished()), this, SLOT(fetched()));
+ *          m_watcher.setFuture(QDjangoQuerySet<User>().fetchAsync());
+ *      }
+ *
+ *      bool isReady() const
+ *      {
+ *          return m_watcher.isFinished();
+ *      }
+ *
+ *  private slots:
+ *      void fetched()
+ *      {
+ *          QDjangoQuerySet<User> users = m_watcher.result();
+ *          // .. build the body from the users
+ *          emit ready();
+ *      }
+ *
+ *  private:
+ *      QFutureWatcher<QDjangoQuerySet<User> > m_watcher;
+ *  };
+ *  \endcode
+ */
+template <class T>
+QFuture<QDjangoQuerySet<T> > QDjangoQuerySet<T>::fetchAsync() const
+{
+    QDjangoQuerySetFetchTask<T> *task = new QDjangoQuerySetFetchTask<T>(all());
+    return task->start(QDjango::threadPool());
+}
+
 /** Returns a new QDjangoQuerySet containing objects for which the given key
  *  where condition is false.
  *
@@ -571,6 +704,25 @@ QDjangoQuerySet<T> QDjangoQuerySet<T>::selectRelated() const
     return other;
 }
 
+/** Returns a copy of the current QDjangoQuerySet which is run on the
+ *  database registered under the given alias, instead of the model's
+ *  database. This is the equivalent of django's \c using().
+ *
+ *  This only affects the queryset's own queries: saving an object
+ *  returned by the queryset still uses the model's database.
+ *
+ * \param alias
+ *
+ *  \sa QDjango::setDatabase()
+ */
+template <class T>
+QDjangoQuerySet<T> QDjangoQuerySet<T>::usingDatabase(const QString &alias) const
+{
+    QDjangoQuerySet<T> other = all();
+    other.d->databaseAlias = alias;
+    return other;
+}
+
 /** Returns the number of objects in the QDjangoQuerySet, or -1
  *  if the query failed.
  *
@@ -608,6 +760,25 @@ QList<QVariantList> QDjangoQuerySet<T>::valuesList(const QStringList &fields)
     return d->sqlValuesList(fields);
 }
 
+/** Returns the plan the database uses to fetch the objects in the
+ *  QDjangoQuerySet, or an empty string if it could not be determined.
+ *
+ *  The plan is obtained by running EXPLAIN QUERY PLAN on SQLite and
+ *  EXPLAIN on PostgreSQL and MySQL, with the exact statement and bound
+ *  values used to fetch the objects. Each row of the plan is returned
+ *  on its own line, with its columns separated by '|'.
+ *
+ * \param analyze if true, the query is run to report its actual costs,
+ *  using EXPLAIN ANALYZE on PostgreSQL and MySQL
+ *
+ *  \sa QDjango::setSlowQueryThreshold()
+ */
+template <class T>
+QString QDjangoQuerySet<T>::explain(bool analyze) const
+{
+    return d->sqlExplain(analyze);
+}
+
 /** Returns the QDjangoWhere expressing the WHERE clause of the
  * QDjangoQuerySet.
  */
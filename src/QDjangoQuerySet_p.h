@@ -27,10 +27,12 @@
 // This file is not part of the QDjango API.
 //
 
+#include <QPointer>
 #include <QStringList>
 
 #include "QDjangoWhere.h"
 
+class QDjangoDatabase;
 class QDjangoMetaModel;
 
 /** \internal
@@ -39,15 +41,19 @@ class QDjangoCompiler
 {
 public:
     QDjangoCompiler(const QString &modelName, const QSqlDatabase &db);
+    QString databaseColumn(const QString &name);
     QString fromSql();
+    bool hasJoins() const;
+    QString primaryKeyColumn();
+    QStringList tables() const;
     QStringList fieldNames(bool recurse, QDjangoMetaModel *metaModel = 0, const QString &modelPath = QString());
     QString orderLimitSql(const QStringList orderBy, int lowMark, int highMark);
     void resolve(QDjangoWhere &where);
 
 private:
-    QString databaseColumn(const QString &name);
     QString referenceModel(const QString &modelPath, QDjangoMetaModel *metaModel);
 
+    QSqlDatabase database;
     QSqlDriver *driver;
     QDjangoMetaModel baseModel;
     QMap<QString, QPair<QString, QDjangoMetaModel> > modelRefs;
@@ -62,8 +68,17 @@ public:
 
     void addFilter(const QDjangoWhere &where);
     QDjangoWhere resolvedWhere(const QSqlDatabase &db) const;
+    QString countSql(const QSqlDatabase &db, QDjangoWhere &resolvedWhere, int low, int high, QStringList *tables = 0) const;
+    QString fetchSql(QDjangoCompiler &compiler, QDjangoWhere &resolvedWhere, QStringList &fields, int low, int high) const;
+    int countRows(QDjangoDatabase *source, int low, int high) const;
+    bool fetchRows(QDjangoDatabase *source, int low, int high, QList<QVariantList> &rows) const;
+    QList<QDjangoDatabase*> databases(bool write) const;
+    bool hasCachedCount() const;
+    bool isRouted() const;
+    bool isSharded() const;
     int sqlCount() const;
     bool sqlDelete();
+    QString sqlExplain(bool analyze) const;
     bool sqlFetch();
     bool sqlLoad(QObject *model, int index);
     QList<QVariantMap> sqlValues(const QStringList &fields);
@@ -73,6 +88,11 @@ public:
     QAtomicInt counter;
 
     bool hasResults;
+    int cachedCount;
+    QMap<QString, qint64> cachedCountGenerations;
+    QPointer<QDjangoDatabase> fetchSource;
+    int cacheTtl;
+    QString databaseAlias;
     int lowMark;
     int highMark;
     QDjangoWhere whereClause;
@@ -83,8 +103,12 @@ public:
 private:
     Q_DISABLE_COPY(QDjangoQuerySetPrivate)
 
+    bool fetchShards(const QList<QDjangoDatabase*> &shards, QList<QVariantList> &rows) const;
+    static bool shardValues(const QDjangoWhere &where, const QString &shardKey, bool primaryKey, QVariantList &values);
+
     QString m_modelName;
 
+    friend class QDjangoDatabase;
     friend class QDjangoMetaModel;
 };
 
@@ -0,0 +1,365 @@
+/*
+ * QDjango
+ * Copyright (C) 2010-2011 Bolloré telecom
+ * See AUTHORS file for a full list of contributors.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <QAtomicInt>
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QMutex>
+#include <QThreadStorage>
+#include <QVector>
+
+#include "QDjangoTracer.h"
+
+/** \internal
+ */
+class QDjangoTraceEvent
+{
+public:
+    const char *name;
+    const char *category;
+    qint64 start;
+    qint64 duration;
+    int thread;
+    QString detail;
+};
+
+/** \internal
+ *
+ * The span stack and ring buffer of a thread.
+ */
+class QDjangoTraceThread
+{
+public:
+    QDjangoTraceThread();
+    ~QDjangoTraceThread();
+
+    void record(const QDjangoTraceEvent &event);
+    void reset(int size);
+    QList<QDjangoTraceEvent> events() const;
+
+    int id;
+    int depth;
+    bool sampled;
+
+private:
+    mutable QMutex m_mutex;
+    QVector<QDjangoTraceEvent> m_ring;
+    int m_next;
+    bool m_wrapped;
+};
+
+/** \internal
+ */
+class QDjangoTracerPrivate
+{
+public:
+    QDjangoTracerPrivate();
+
+    QMutex mutex;
+    QList<QDjangoTraceThread*> threads;
+    QList<QDjangoTraceEvent> retired;
+    QElapsedTimer clock;
+    QAtomicInt sampleCounter;
+    int bufferSize;
+    int threadCount;
+};
+
+Q_GLOBAL_STATIC(QDjangoTracerPrivate, globalTracer)
+static QThreadStorage<QDjangoTraceThread*> traceThreads;
+static QAtomicInt globalTracing(0);
+static QAtomicInt globalSampleInterval(1);
+
+QDjangoTracerPrivate::QDjangoTracerPrivate()
+    : sampleCounter(0),
+    bufferSize(4096),
+    threadCount(0)
+{
+    clock.start();
+}
+
+QDjangoTraceThread::QDjangoTraceThread()
+    : depth(0),
+    sampled(false),
+    m_next(0),
+    m_wrapped(false)
+{
+    QDjangoTracerPrivate *tracer = globalTracer();
+    QMutexLocker locker(&tracer->mutex);
+    id = ++tracer->threadCount;
+    m_ring.resize(tracer->bufferSize);
+    tracer->threads << this;
+}
+
+QDjangoTraceThread::~QDjangoTraceThread()
+{
+    // the tracer may already be gone if the application is exiting
+    QDjangoTracerPrivate *tracer = globalTracer();
+    if (!tracer)
+        return;
+
+    // keep the spans of finished threads, within the buffer size
+    QMutexLocker locker(&tracer->mutex);
+    tracer->retired += events();
+    while (tracer->retired.size() > tracer->bufferSize)
+        tracer->retired.removeFirst();
+    tracer->threads.removeAll(this);
+}
+
+void QDjangoTraceThread::record(const QDjangoTraceEvent &event)
+{
+    QMutexLocker locker(&m_mutex);
+    if (m_ring.isEmpty())
+        return;
+    m_ring[m_next] = event;
+    if (++m_next == m_ring.size()) {
+        m_next = 0;
+        m_wrapped = true;
+    }
+}
+
+void QDjangoTraceThread::reset(int size)
+{
+    QMutexLocker locker(&m_mutex);
+    m_ring = QVector<QDjangoTraceEvent>(size);
+    m_next = 0;
+    m_wrapped = false;
+}
+
+/** Returns the recorded spans, oldest first.
+ */
+QList<QDjangoTraceEvent> QDjangoTraceThread::events() const
+{
+    QMutexLocker locker(&m_mutex);
+    QList<QDjangoTraceEvent> events;
+    if (m_wrapped)
+        for (int i = m_next; i < m_ring.size(); ++i)
+            events << m_ring.at(i);
+    for (int i = 0; i < m_next; ++i)
+        events << m_ring.at(i);
+    return events;
+}
+
+/** Escapes a string for use in JSON.
+ */
+static QByteArray jsonString(const QByteArray &value)
+{
+    QByteArray escaped = "\"";
+    for (int i = 0; i < value.size(); ++i) {
+        const char c = value.at(i);
+        if (c == '"' || c == '\\') {
+            escaped += '\\';
+            escaped += c;
+        } else if (c == '\n') {
+            escaped += "\\n";
+        } else if (uchar(c) < 0x20) {
+            escaped += "\\u00" + QByteArray::number(uchar(c), 16).rightJustified(2, '0');
+        } else {
+            escaped += c;
+        }
+    }
+    return escaped + '"';
+}
+
+/** Starts a span with the given name.
+ *
+ * \param name The name of the span, which must remain valid.
+ * \param category The category of the span, which must remain valid.
+ */
+QDjangoTraceSpan::QDjangoTraceSpan(const char *name, const char *category)
+    : m_thread(0),
+    m_name(name),
+    m_category(category),
+    m_start(0)
+{
+    if (!globalTracing)
+        return;
+
+    m_thread = traceThreads.localData();
+    if (!m_thread) {
+        m_thread = new QDjangoTraceThread;
+        traceThreads.setLocalData(m_thread);
+    }
+
+    // nested spans follow the sampling decision of the top-level span
+    if (!m_thread->depth) {
+        const int interval = globalSampleInterval;
+        m_thread->sampled = interval <= 1 ||
+            !(globalTracer()->sampleCounter.fetchAndAddRelaxed(1) % interval);
+    }
+    m_thread->depth++;
+    if (m_thread->sampled)
+        m_start = globalTracer()->clock.nsecsElapsed();
+}
+
+/** Ends the span, recording it if it is sampled.
+ */
+QDjangoTraceSpan::~QDjangoTraceSpan()
+{
+    if (!m_thread)
+        return;
+
+    m_thread->depth--;
+    if (m_thread->sampled) {
+        QDjangoTraceEvent event;
+        event.name = m_name;
+        event.category = m_category;
+        event.start = m_start;
+        event.duration = globalTracer()->clock.nsecsElapsed() - m_start;
+        event.thread = m_thread->id;
+        event.detail = m_detail;
+        m_thread->record(event);
+    }
+}
+
+/** Returns true if the span is being recorded.
+ *
+ *  Use this to avoid building details for spans which are not recorded.
+ */
+bool QDjangoTraceSpan::isActive() const
+{
+    return m_thread && m_thread->sampled;
+}
+
+/** Sets a detail which is exported along with the span, such as the SQL
+ *  of a query.
+ *
+ * \param detail
+ */
+void QDjangoTraceSpan::setDetail(const QString &detail)
+{
+    m_detail = detail;
+}
+
+/** Returns true if spans are being recorded.
+ */
+bool QDjangoTracer::isEnabled()
+{
+    return globalTracing;
+}
+
+/** Enables or disables the recording of spans.
+ *
+ * \param enabled
+ */
+void QDjangoTracer::setEnabled(bool enabled)
+{
+    globalTracing.fetchAndStoreRelaxed(enabled ? 1 : 0);
+}
+
+/** Returns the number of spans which each thread keeps.
+ */
+int QDjangoTracer::bufferSize()
+{
+    QDjangoTracerPrivate *tracer = globalTracer();
+    QMutexLocker locker(&tracer->mutex);
+    return tracer->bufferSize;
+}
+
+/** Sets the number of spans which each thread keeps, discarding the
+ *  spans recorded so far. The default value is 4096.
+ *
+ * \param size
+ */
+void QDjangoTracer::setBufferSize(int size)
+{
+    Q_ASSERT(size >= 0);
+
+    QDjangoTracerPrivate *tracer = globalTracer();
+    QMutexLocker locker(&tracer->mutex);
+    tracer->bufferSize = size;
+    tracer->retired.clear();
+    foreach (QDjangoTraceThread *thread, tracer->threads)
+        thread->reset(size);
+}
+
+/** Returns the interval at which top-level spans are sampled.
+ */
+int QDjangoTracer::sampleInterval()
+{
+    return globalSampleInterval;
+}
+
+/** Sets the interval at which top-level spans are sampled, so that one
+ *  in \a interval is recorded. The default value of 1 records every span.
+ *
+ * \param interval
+ */
+void QDjangoTracer::setSampleInterval(int interval)
+{
+    Q_ASSERT(interval > 0);
+    globalSampleInterval.fetchAndStoreRelaxed(interval);
+}
+
+/** Discards the spans recorded so far.
+ */
+void QDjangoTracer::clear()
+{
+    QDjangoTracerPrivate *tracer = globalTracer();
+    QMutexLocker locker(&tracer->mutex);
+    tracer->retired.clear();
+    foreach (QDjangoTraceThread *thread, tracer->threads)
+        thread->reset(tracer->bufferSize);
+}
+
+/** Returns the recorded spans in the Chrome trace event format.
+ */
+QByteArray QDjangoTracer::toChromeTrace()
+{
+    QDjangoTracerPrivate *tracer = globalTracer();
+    QMutexLocker locker(&tracer->mutex);
+
+    QList<QDjangoTraceEvent> events = tracer->retired;
+    foreach (QDjangoTraceThread *thread, tracer->threads)
+        events += thread->events();
+
+    const QByteArray pid = QByteArray::number(QCoreApplication::applicationPid());
+    QByteArray output = "{\"traceEvents\":[";
+    for (int i = 0; i < events.size(); ++i) {
+        const QDjangoTraceEvent &event = events.at(i);
+        if (i)
+            output += ',';
+        output += "\n{\"name\":" + jsonString(event.name);
+        output += ",\"cat\":" + jsonString(event.category);
+        output += ",\"ph\":\"X\",\"ts\":" + QByteArray::number(event.start / 1000.0, 'f', 3);
+        output += ",\"dur\":" + QByteArray::number(event.duration / 1000.0, 'f', 3);
+        output += ",\"pid\":" + pid;
+        output += ",\"tid\":" + QByteArray::number(event.thread);
+        if (!event.detail.isEmpty())
+            output += ",\"args\":{\"detail\":" + jsonString(event.detail.toUtf8()) + "}";
+        output += '}';
+    }
+    output += "\n],\"displayTimeUnit\":\"ms\"}\n";
+    return output;
+}
+
+/** Writes the recorded spans to a file in the Chrome trace event format.
+ *
+ * \param fileName
+ * \return true if the file was written, false otherwise
+ */
+bool QDjangoTracer::save(const QString &fileName)
+{
+    QFile file(fileName);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate))
+        return false;
+    const QByteArray data = toChromeTrace();
+    return file.write(data) == data.size();
+}
@@ -0,0 +1,98 @@
+/*
+ * QDjango
+ * Copyright (C) 2010-2011 Bolloré telecom
+ * See AUTHORS file for a full list of contributors.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef QDJANGO_TRACER_H
+#define QDJANGO_TRACER_H
+
+#include <QString>
+
+class QDjangoTraceThread;
+
+/** \brief The QDjangoTraceSpan class measures the duration of a scope
+ *   for QDjangoTracer.
+ *
+ *  A span starts when it is constructed and ends when it is destroyed.
+ *  Spans which are constructed while another span is alive in the same
+ *  thread are nested inside it.
+ *
+ *  \code
+ *  {
+ *      QDjangoTraceSpan span("report.generate");
+ *      generateReport();
+ *  }
+ *  \endcode
+ *
+ *  When tracing is disabled, constructing a span only costs a test.
+ *
+ * \ingroup Database
+ */
+class QDjangoTraceSpan
+{
+public:
+    QDjangoTraceSpan(const char *name, const char *category = "qdjango");
+    ~QDjangoTraceSpan();
+
+    bool isActive() const;
+    void setDetail(const QString &detail);
+
+private:
+    Q_DISABLE_COPY(QDjangoTraceSpan)
+    QDjangoTraceThread *m_thread;
+    const char *m_name;
+    const char *m_category;
+    qint64 m_start;
+    QString m_detail;
+};
+
+/** \brief The QDjangoTracer class records spans and exports them in the
+ *   Chrome trace event format.
+ *
+ *  QDjango records spans for the queries it executes (\c sql.exec) and
+ *  for the stages of QDjangoHttpServer connections: \c http.request,
+ *  \c http.read, \c http.controller and \c http.write.
+ *
+ *  Each thread keeps its spans in a ring buffer, so only the most recent
+ *  ones are kept. A sample interval can be set so that only one in N
+ *  top-level spans, for instance one in N HTTP requests, is recorded
+ *  along with the spans nested inside it.
+ *
+ *  The output of toChromeTrace() can be loaded in \c chrome://tracing
+ *  or any viewer which understands the format.
+ *
+ * \ingroup Database
+ */
+class QDjangoTracer
+{
+public:
+    static bool isEnabled();
+    static void setEnabled(bool enabled);
+
+    static int bufferSize();
+    static void setBufferSize(int size);
+
+    static int sampleInterval();
+    static void setSampleInterval(int interval);
+
+    static void clear();
+    static QByteArray toChromeTrace();
+    static bool save(const QString &fileName);
+};
+
+#endif
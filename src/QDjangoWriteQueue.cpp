@@ -0,0 +1,314 @@
+/*
+ * QDjango
+ * Copyright (C) 2010-2011 Bolloré telecom
+ * See AUTHORS file for a full list of contributors.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <climits>
+
+#include "QDjango.h"
+#include "QDjangoQueryCache.h"
+#include "QDjangoWriteQueue.h"
+#include "QDjangoWriteQueue_p.h"
+
+QDjangoWriteQueuePrivate::QDjangoWriteQueuePrivate()
+    : batchSize(100),
+    flushInterval(1000),
+    flushRequested(false),
+    stopping(false),
+    queuedSerial(0),
+    writtenSerial(0),
+    peakPendingCount(0),
+    writtenCount(0),
+    failedCount(0)
+{
+}
+
+void QDjangoWriteQueuePrivate::run()
+{
+    QMutexLocker locker(&mutex);
+    forever {
+        // wait for a full batch, a flush request or for the oldest
+        // snapshot to reach the flush interval
+        if (!stopping && !flushRequested && !order.isEmpty() && order.size() < batchSize) {
+            const qint64 remaining = flushInterval - oldestTimer.elapsed();
+            if (remaining > 0) {
+                pendingCondition.wait(&mutex, remaining);
+                continue;
+            }
+        }
+
+        if (order.isEmpty()) {
+            // everything which was queued has been written
+            flushRequested = false;
+            writtenSerial = queuedSerial;
+            writtenCondition.wakeAll();
+            if (stopping)
+                break;
+            pendingCondition.wait(&mutex);
+            continue;
+        }
+
+        // take a batch of snapshots
+        QList<QDjangoWriteEntry> batch;
+        while (!order.isEmpty() && batch.size() < batchSize)
+            batch << pending.take(order.takeFirst());
+        const qint64 batchSerial = order.isEmpty() ? queuedSerial : -1;
+
+        // write the batch without holding the lock
+        locker.unlock();
+        const int failed = writeBatch(batch);
+        locker.relock();
+
+        writtenCount += batch.size() - failed;
+        failedCount += failed;
+        if (batchSerial >= 0)
+            writtenSerial = batchSerial;
+        writtenCondition.wakeAll();
+    }
+}
+
+int QDjangoWriteQueuePrivate::writeBatch(const QList<QDjangoWriteEntry> &batch)
+{
+    // group the snapshots by the database they are written to
+    QList<QDjangoDatabase*> targets;
+    QMap<QDjangoDatabase*, QList<QDjangoWriteEntry> > groups;
+    QSet<QString> tables;
+    foreach (const QDjangoWriteEntry &entry, batch) {
+        const QDjangoMetaModel metaModel = QDjango::metaModel(entry.modelName);
+        QDjangoDatabase *target = metaModel.database(entry.values.value(QString::fromLatin1(metaModel.m_shardKey)));
+        if (!groups.contains(target))
+            targets << target;
+        groups[target] << entry;
+        tables << metaModel.m_table;
+    }
+
+    int failed = 0;
+    foreach (QDjangoDatabase *target, targets)
+        failed += writeEntries(target, groups.value(target));
+
+    // other threads may have cached results read before the commit
+    foreach (const QString &table, tables)
+        QDjangoQueryCache::invalidate(table);
+    return failed;
+}
+
+/** Writes snapshots to a database in a single transaction, returning the
+ *  number of snapshots which could not be written.
+ *
+ *  On failure the transaction is rolled back, as some databases abort it
+ *  at the first error, and the other snapshots are written again without
+ *  the failing one.
+ */
+int QDjangoWriteQueuePrivate::writeEntries(QDjangoDatabase *target, QList<QDjangoWriteEntry> entries)
+{
+    QSqlDatabase db = target->connection();
+    int failed = 0;
+    while (!entries.isEmpty()) {
+        const bool transaction = QDjango::beginTransaction(db);
+
+        int failedIndex = -1;
+        for (int i = 0; i < entries.size() && failedIndex < 0; ++i) {
+            const QDjangoWriteEntry &entry = entries.at(i);
+            QVariant pk;
+            if (!QDjango::metaModel(entry.modelName).saveSnapshot(entry.values, pk))
+                failedIndex = i;
+        }
+
+        if (failedIndex < 0) {
+            if (transaction && !QDjango::endTransaction(db, true)) {
+                qWarning() << "Could not commit queued writes" << db.lastError();
+                QDjango::endTransaction(db, false);
+                failed += entries.size();
+            }
+            break;
+        }
+
+        failed++;
+        if (transaction) {
+            QDjango::endTransaction(db, false);
+            entries.removeAt(failedIndex);
+        } else {
+            // the snapshots before the failing one were written
+            entries = entries.mid(failedIndex + 1);
+        }
+    }
+    return failed;
+}
+
+/** Constructs a new write queue.
+ */
+QDjangoWriteQueue::QDjangoWriteQueue()
+    : d(new QDjangoWriteQueuePrivate)
+{
+}
+
+/** Destroys the write queue.
+ *
+ *  Any pending snapshots are written before the queue is destroyed.
+ */
+QDjangoWriteQueue::~QDjangoWriteQueue()
+{
+    d->mutex.lock();
+    d->stopping = true;
+    d->pendingCondition.wakeAll();
+    d->mutex.unlock();
+
+    d->wait();
+    delete d;
+}
+
+/** Returns the number of snapshots which triggers a write.
+ */
+int QDjangoWriteQueue::batchSize() const
+{
+    QMutexLocker locker(&d->mutex);
+    return d->batchSize;
+}
+
+/** Sets the number of snapshots which triggers a write.
+ *
+ *  This is also the maximum number of snapshots written in a single
+ *  transaction. The default value is 100.
+ *
+ * \param size
+ */
+void QDjangoWriteQueue::setBatchSize(int size)
+{
+    Q_ASSERT(size > 0);
+
+    QMutexLocker locker(&d->mutex);
+    d->batchSize = size;
+    d->pendingCondition.wakeAll();
+}
+
+/** Returns the maximum time in milliseconds a snapshot waits before
+ *  it is written.
+ */
+int QDjangoWriteQueue::flushInterval() const
+{
+    QMutexLocker locker(&d->mutex);
+    return d->flushInterval;
+}
+
+/** Sets the maximum time in milliseconds a snapshot waits before
+ *  it is written. The default value is 1000.
+ *
+ * \param msecs
+ */
+void QDjangoWriteQueue::setFlushInterval(int msecs)
+{
+    Q_ASSERT(msecs >= 0);
+
+    QMutexLocker locker(&d->mutex);
+    d->flushInterval = msecs;
+    d->pendingCondition.wakeAll();
+}
+
+/** Queues a snapshot of the given model for saving.
+ *
+ *  If a snapshot of an object with the same primary key is already
+ *  pending, it is replaced by the new snapshot. The model's primary key
+ *  is not updated, so keys generated by the database are not reported.
+ *
+ * \param model
+ */
+void QDjangoWriteQueue::save(const QObject *model)
+{
+    const QString modelName = QString::fromLatin1(model->metaObject()->className());
+    const QDjangoMetaModel metaModel = QDjango::metaModel(modelName);
+    Q_ASSERT_X(metaModel.isValid(), "QDjangoWriteQueue::save", "model is not registered");
+
+    // take a snapshot of the local fields
+    QDjangoWriteEntry entry;
+    entry.modelName = modelName;
+    entry.values = metaModel.snapshot(model);
+    QVariant pk;
+    foreach (const QDjangoMetaField &field, metaModel.m_localFields) {
+        const QVariant value = entry.values.value(QString::fromLatin1(field.name));
+        if (field.primaryKey && !value.isNull() && !(field.type == QVariant::Int && !value.toInt()))
+            pk = value;
+    }
+
+    QMutexLocker locker(&d->mutex);
+    d->queuedSerial++;
+
+    // the flush interval starts with the oldest pending snapshot
+    const bool wasEmpty = d->order.isEmpty();
+    if (wasEmpty)
+        d->oldestTimer.start();
+
+    // coalesce snapshots which share a primary key
+    const QString key = pk.isValid() ?
+        (modelName + QLatin1Char(':') + pk.toString()) :
+        (QLatin1Char('#') + QString::number(d->queuedSerial));
+    if (!d->pending.contains(key))
+        d->order << key;
+    d->pending.insert(key, entry);
+    d->peakPendingCount = qMax(d->peakPendingCount, d->order.size());
+
+    if (!d->isRunning())
+        d->start();
+    if (wasEmpty || d->order.size() >= d->batchSize)
+        d->pendingCondition.wakeAll();
+}
+
+/** Blocks until all the snapshots queued before this call have been
+ *  written to the database.
+ */
+void QDjangoWriteQueue::flush()
+{
+    QMutexLocker locker(&d->mutex);
+    const qint64 target = d->queuedSerial;
+    while (d->writtenSerial < target) {
+        d->flushRequested = true;
+        d->pendingCondition.wakeAll();
+        d->writtenCondition.wait(&d->mutex);
+    }
+}
+
+/** Returns the number of snapshots waiting to be written.
+ */
+int QDjangoWriteQueue::pendingCount() const
+{
+    QMutexLocker locker(&d->mutex);
+    return d->order.size();
+}
+
+/** Returns the highest number of snapshots which were waiting to be
+ *  written at any one time.
+ */
+int QDjangoWriteQueue::peakPendingCount() const
+{
+    QMutexLocker locker(&d->mutex);
+    return d->peakPendingCount;
+}
+
+/** Returns the number of snapshots which were successfully written.
+ */
+qint64 QDjangoWriteQueue::writtenCount() const
+{
+    QMutexLocker locker(&d->mutex);
+    return d->writtenCount;
+}
+
+/** Returns the number of snapshots which could not be written.
+ */
+qint64 QDjangoWriteQueue::failedCount() const
+{
+    QMutexLocker locker(&d->mutex);
+    return d->failedCount;
+}
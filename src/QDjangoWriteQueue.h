@@ -0,0 +1,74 @@
+/*
+ * QDjango
+ * Copyright (C) 2010-2011 Bolloré telecom
+ * See AUTHORS file for a full list of contributors.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef QDJANGO_WRITE_QUEUE_H
+#define QDJANGO_WRITE_QUEUE_H
+
+#include <QtGlobal>
+
+class QObject;
+class QDjangoWriteQueuePrivate;
+
+/** \brief The QDjangoWriteQueue class saves models in the background.
+ *
+ *  Instead of performing a database round-trip in the calling thread,
+ *  save() takes a snapshot of the model's fields and returns immediately.
+ *  The snapshots are written from a dedicated thread, in batched
+ *  transactions, once batchSize() snapshots are pending or flushInterval()
+ *  milliseconds have elapsed. Each database a batch writes to, such as a
+ *  database alias or a shard, gets its own transaction. A snapshot which
+ *  cannot be written is counted in failedCount() without preventing the
+ *  other snapshots of its batch from being written.
+ *
+ *  Successive saves of objects with the same primary key are coalesced,
+ *  so that only the most recent snapshot is written.
+ *
+ * \note Generated primary keys are not written back to the models, so
+ *  a new object with an auto-increment key is inserted again each time
+ *  it is passed to save().
+ *
+ * \ingroup Database
+ */
+class QDjangoWriteQueue
+{
+public:
+    QDjangoWriteQueue();
+    ~QDjangoWriteQueue();
+
+    int batchSize() const;
+    void setBatchSize(int size);
+
+    int flushInterval() const;
+    void setFlushInterval(int msecs);
+
+    void save(const QObject *model);
+    void flush();
+
+    // metrics
+    int pendingCount() const;
+    int peakPendingCount() const;
+    qint64 writtenCount() const;
+    qint64 failedCount() const;
+
+private:
+    Q_DISABLE_COPY(QDjangoWriteQueue)
+    QDjangoWriteQueuePrivate* const d;
+};
+
+#endif
@@ -0,0 +1,83 @@
+/*
+ * QDjango
+ * Copyright (C) 2010-2011 Bolloré telecom
+ * See AUTHORS file for a full list of contributors.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef QDJANGO_WRITE_QUEUE_P_H
+#define QDJANGO_WRITE_QUEUE_P_H
+
+//
+//  W A R N I N G
+//  -------------
+//
+// This file is not part of the QDjango API.
+//
+
+#include <QElapsedTimer>
+#include <QHash>
+#include <QMutex>
+#include <QStringList>
+#include <QThread>
+#include <QVariant>
+#include <QWaitCondition>
+
+class QDjangoDatabase;
+
+/** \internal
+ */
+class QDjangoWriteEntry
+{
+public:
+    QString modelName;
+    QVariantMap values;
+};
+
+/** \internal
+ */
+class QDjangoWriteQueuePrivate : public QThread
+{
+public:
+    QDjangoWriteQueuePrivate();
+
+    void run();
+    int writeBatch(const QList<QDjangoWriteEntry> &batch);
+    int writeEntries(QDjangoDatabase *target, QList<QDjangoWriteEntry> entries);
+
+    int batchSize;
+    int flushInterval;
+
+    QMutex mutex;
+    QWaitCondition pendingCondition;
+    QWaitCondition writtenCondition;
+
+    // pending snapshots, in the order they were queued
+    QStringList order;
+    QHash<QString, QDjangoWriteEntry> pending;
+    QElapsedTimer oldestTimer;
+
+    bool flushRequested;
+    bool stopping;
+    qint64 queuedSerial;
+    qint64 writtenSerial;
+
+    // metrics
+    int peakPendingCount;
+    qint64 writtenCount;
+    qint64 failedCount;
+};
+
+#endif
@@ -22,14 +22,22 @@
 
 #include <QDebug>
 #include <QDateTime>
+#include <QFuture>
+#include <QFutureInterface>
 #include <QMap>
 #include <QMutex>
 #include <QObject>
+#include <QRunnable>
+#include <QSet>
 #include <QSqlDatabase>
 #include <QSqlError>
 #include <QSqlQuery>
+#include <QStringList>
+#include <QThreadPool>
 #include <QVariant>
 
+class QDjangoDatabase;
+
 /** \brief The QDjangoMetaField class holds the database schema for a field.
  *
  * \internal
@@ -48,6 +56,23 @@ public:
     QString foreignModel;
 };
 
+/** \brief The QDjangoMetaIndex class holds the database schema for an
+ *  index declared at the model level.
+ *
+ * \internal
+ */
+class QDjangoMetaIndex
+{
+public:
+    QDjangoMetaIndex();
+
+    QString name;
+    QList<QByteArray> fields;
+    QList<QByteArray> include;
+    QString where;
+    bool unique;
+};
+
 /** \brief The QDjangoMetaModel class holds the database schema for a model.
  *
  *  It manages table creation and deletion operations as well as row
@@ -65,11 +90,18 @@ public:
     bool dropTable() const;
     bool tableExists() const;
 
+    bool createPartitions(int count) const;
+    bool dropPartitions(const QDateTime &before) const;
+
     void load(QObject *model, const QVariantList &props, int &pos) const;
     bool remove(QObject *model) const;
     bool removeById(const QVariant &id) const;
+    int removeByIds(const QVariantList &ids) const;
     bool save(QObject *model, QVariant &outPk) const;
     bool save(QObject *model) const;
+    QVariantMap snapshot(const QObject *model) const;
+    bool saveSnapshot(const QVariantMap &values, QVariant &outPk) const;
+    bool bulkInsert(const QList<QObject*> &models) const;
 
     QObject *foreignKey(const QObject *model, const char *name) const;
     void setForeignKey(QObject *model, const char *name, QObject *value) const;
@@ -77,16 +109,41 @@ public:
     QByteArray primaryKey() const;
 
 private:
+    bool createTable(QSqlDatabase db) const;
+    bool dropTable(QSqlDatabase db) const;
+    bool createPartitions(QSqlDatabase db, int count) const;
+    bool dropPartitions(QSqlDatabase db, const QDateTime &before) const;
+    int removeByIds(QSqlDatabase db, const QVariantList &ids) const;
+    bool bulkInsert(QSqlDatabase db, const QList<QObject*> &models) const;
+    QString insertSql(const QSqlDatabase &db, const QStringList &fieldNames, int rowCount, bool returning) const;
+    QString indexSql(const QSqlDatabase &db, const QDjangoMetaIndex &index) const;
+
+    // sharding
+    QDjangoDatabase *database(const QVariant &shardValue) const;
+    QList<QDjangoDatabase*> databases() const;
+
     QList<QDjangoMetaField> m_localFields;
+    QList<QDjangoMetaIndex> m_indexes;
     QMap<QByteArray, QString> m_foreignFields;
     QByteArray m_primaryKey;
+    QByteArray m_shardKey;
+    QByteArray m_partitionKey;
+    QString m_partitionInterval;
+    QString m_alias;
     QString m_table;
 
     friend class tst_QDjangoMetaModel;
+    friend class QDjango;
+    friend class QDjangoBulkLoaderPrivate;
     friend class QDjangoCompiler;
+    friend class QDjangoModel;
     friend class QDjangoQuerySetPrivate;
+    friend class QDjangoWriteQueue;
+    friend class QDjangoWriteQueuePrivate;
 };
 
+class QDjangoQuery;
+
 /** \brief The QDjangoDatabase class represents a set of connections to a
  *  database.
  *
@@ -98,20 +155,92 @@ class QDjangoDatabase : public QObject
 
 public:
     QDjangoDatabase(QObject *parent = 0);
+    ~QDjangoDatabase();
+
+    QSqlDatabase connection();
+    bool exec(QDjangoQuery &query);
+
+    // schema snapshot
+    bool hasTable(const QString &table);
+    void setTableExists(const QString &table, bool exists);
+    void invalidateSchema();
 
     QSqlDatabase reference;
     QMutex mutex;
     QMap<QThread*, QSqlDatabase> copies;
-    qint64 connectionId;
+    QThreadPool *threadPool;
+
+    // schema snapshot, protected by the mutex
+    bool schemaLoaded;
+    QSet<QString> schemaTables;
+
+    // statistics, protected by the mutex
+    QAtomicInt activeQueries;
+    qint64 queryCount;
+    qint64 errorCount;
+    qint64 totalTime;
+    qint64 maxTime;
 
 private slots:
     void threadFinished();
 };
 
+/** \brief The QDjangoWriteNotifier class signals that a write to a table
+ *  has completed when it goes out of scope.
+ *
+ *  The cached query results for the table are invalidated and, if the
+ *  primary database was written to, reads from the current thread are
+ *  routed to it for a while.
+ *
+ * \internal
+ */
+class QDjangoWriteNotifier
+{
+public:
+    QDjangoWriteNotifier(const QString &table);
+    QDjangoWriteNotifier(const QString &table, const QSqlDatabase &db);
+    ~QDjangoWriteNotifier();
+
+    void addDatabase(const QSqlDatabase &db);
+
+private:
+    QString m_table;
+    QList<QSqlDatabase> m_databases;
+};
+
+/** \brief The QDjangoFutureTask class is the base class for database
+ *  operations which run on a thread pool and report their result through
+ *  a QFuture.
+ *
+ * \internal
+ */
+template <class R>
+class QDjangoFutureTask : public QFutureInterface<R>, public QRunnable
+{
+public:
+    QFuture<R> start(QThreadPool *pool)
+    {
+        this->reportStarted();
+        QFuture<R> future = this->future();
+        pool->start(this);
+        return future;
+    }
+
+    void run()
+    {
+        if (!this->isCanceled())
+            this->reportResult(compute());
+        this->reportFinished();
+    }
+
+protected:
+    virtual R compute() = 0;
+};
+
 class QDjangoQuery : public QSqlQuery
 {
 public:
-    QDjangoQuery(QSqlDatabase db) : QSqlQuery(db)
+    QDjangoQuery(QSqlDatabase db) : QSqlQuery(db), m_connectionName(db.connectionName())
     {
     }
 
@@ -125,24 +254,19 @@ public:
             QSqlQuery::addBindValue(val, paramType);
     }
 
-#ifdef QDJANGO_DEBUG_SQL
-    bool exec()
+    void bindValue(int pos, const QVariant &val, QSql::ParamType paramType = QSql::In)
     {
-        qDebug() << "SQL query" << lastQuery();
-        QMapIterator<QString, QVariant> i(boundValues());
-        while (i.hasNext()) {
-            i.next();
-            qDebug() << "   " << i.key().toAscii().data() << "="
-                     << i.value().toString().toAscii().data();
-        }
-        if (!QSqlQuery::exec())
-        {
-            qWarning() << "SQL error" << lastError();
-            return false;
-        }
-        return true;
+        if (val.type() == QVariant::DateTime)
+            QSqlQuery::bindValue(pos, val.toDateTime().toLocalTime(), paramType);
+        else
+            QSqlQuery::bindValue(pos, val, paramType);
     }
-#endif
+
+    using QSqlQuery::exec;
+    bool exec();
+
+private:
+    QString m_connectionName;
 };
 
 #endif
@@ -25,13 +25,32 @@ DEFINES += QT_STATICPLUGIN
 HEADERS += \
     QDjango.h \
     QDjango_p.h \
+    QDjangoAllocCounter.h \
+    QDjangoBulkLoader.h \
+    QDjangoBulkLoader_p.h \
+    QDjangoMetrics.h \
     QDjangoModel.h \
+    QDjangoQueryBatch.h \
+    QDjangoQueryCache.h \
+    QDjangoQueryDetector.h \
+    QDjangoQueryObserver.h \
     QDjangoQuerySet.h \
     QDjangoQuerySet_p.h \
-    QDjangoWhere.h
+    QDjangoTracer.h \
+    QDjangoWhere.h \
+    QDjangoWriteQueue.h \
+    QDjangoWriteQueue_p.h
 SOURCES += \
     QDjango.cpp \
+    QDjangoAllocCounter.cpp \
+    QDjangoBulkLoader.cpp \
+    QDjangoMetrics.cpp \
     QDjangoModel.cpp \
+    QDjangoQueryBatch.cpp \
+    QDjangoQueryCache.cpp \
+    QDjangoQueryDetector.cpp \
     QDjangoQuerySet.cpp \
-    QDjangoWhere.cpp
+    QDjangoTracer.cpp \
+    QDjangoWhere.cpp \
+    QDjangoWriteQueue.cpp
 
@@ -19,8 +19,13 @@
 
 #include <QtTest/QtTest>
 
+#include "QDjangoBulkLoader.h"
+#include "QDjangoQueryBatch.h"
+#include "QDjangoQueryCache.h"
+#include "QDjangoQueryDetector.h"
 #include "QDjangoQuerySet.h"
 #include "QDjangoWhere.h"
+#include "QDjangoWriteQueue.h"
 
 #include "main.h"
 #include "models.h"
@@ -174,6 +179,69 @@ void TestUser::removeLimit()
     QCOMPARE(users.all().size(), 3);
 }
 
+/** Test removing multiple users by primary key.
+ */
+void TestUser::removeByIds()
+{
+    loadFixtures();
+
+    const QDjangoQuerySet<User> users;
+    const QDjangoMetaModel metaModel = QDjango::registerModel<User>();
+    QCOMPARE(metaModel.removeByIds(QVariantList()), 0);
+
+    // build a list of ids which spans several chunks
+    QVariantList ids;
+    foreach (const QVariantList &row, users.filter(QDjangoWhere("username", QDjangoWhere::IsIn, QStringList() << "foouser" << "baruser")).valuesList(QStringList("id")))
+        ids << row[0];
+    for (int i = 0; i < 2500; ++i)
+        ids << 1000 + i;
+    QCOMPARE(metaModel.removeByIds(ids), 2);
+
+    // check remaining user
+    QDjangoQuerySet<User> qs = users.all();
+    QCOMPARE(qs.size(), 1);
+    User *other = qs.at(0);
+    QVERIFY(other != 0);
+    QCOMPARE(other->username(), QLatin1String("wizuser"));
+    delete other;
+}
+
+/** Test loading users in bulk.
+ */
+void TestUser::bulkLoader()
+{
+    QDjangoBulkLoader<User> loader;
+    QCOMPARE(loader.batchSize(), 1000);
+    loader.setBatchSize(7);
+
+    QCOMPARE(loader.begin(), true);
+    for (int i = 0; i < 50; ++i) {
+        User user;
+        user.setUsername(QString("bulkuser%1").arg(i));
+        user.setPassword("bulkpass");
+        QCOMPARE(loader.append(&user), true);
+    }
+
+    // rows given as values, in field order
+    const QDateTime now = QDateTime::currentDateTime();
+    QCOMPARE(loader.append(QVariantList() << "rawuser" << "Raw" << "User"
+        << "raw@example.com" << "rawpass" << true << false << false << now << now), true);
+
+    // rows with the wrong number of values are rejected
+    QCOMPARE(loader.append(QVariantList() << "baduser"), false);
+    QCOMPARE(loader.rowCount(), qint64(51));
+    QCOMPARE(loader.finish(), true);
+    QVERIFY(loader.rowsPerSecond() > 0);
+
+    const QDjangoQuerySet<User> users;
+    QCOMPARE(users.count(), 51);
+    User *raw = users.get(QDjangoWhere("username", QDjangoWhere::Equals, "rawuser"));
+    QVERIFY(raw != 0);
+    QCOMPARE(raw->email(), QLatin1String("raw@example.com"));
+    QCOMPARE(raw->isActive(), true);
+    delete raw;
+}
+
 /** Test retrieving a single user.
  */
 void TestUser::get()
@@ -538,6 +606,314 @@ void TestUser::constIterator()
     QCOMPARE(int(last - it), 3);
 }
 
+/** Test evaluating several querysets in one batch.
+ */
+void TestUser::queryBatch()
+{
+    loadFixtures();
+
+    const QDjangoQuerySet<User> users;
+    QDjangoQuerySet<User> foo = users.filter(QDjangoWhere("username", QDjangoWhere::Equals, "foouser"));
+    QDjangoQuerySet<User> notFoo = users.exclude(QDjangoWhere("username", QDjangoWhere::Equals, "foouser"));
+    QDjangoQuerySet<User> none = users.none();
+    QDjangoQuerySet<User> ordered = users.orderBy(QStringList("username"));
+
+    QDjangoQueryBatch batch;
+    batch.addCount(foo);
+    batch.addCount(notFoo);
+    batch.addFetch(ordered);
+    QCOMPARE(batch.exec(), true);
+
+    // a single count is run on its own
+    QDjangoQueryBatch single;
+    single.addCount(none);
+    QCOMPARE(single.exec(), true);
+
+    QCOMPARE(foo.count(), 1);
+    QCOMPARE(notFoo.count(), 2);
+    QCOMPARE(none.count(), 0);
+    QCOMPARE(ordered.size(), 3);
+    User *other = ordered.at(0);
+    QVERIFY(other != 0);
+    QCOMPARE(other->username(), QLatin1String("baruser"));
+    delete other;
+
+    // saving objects invalidates the counts
+    User wiz2;
+    wiz2.setUsername("wizuser2");
+    wiz2.setPassword("wizpass2");
+    QCOMPARE(wiz2.save(), true);
+    QCOMPARE(notFoo.count(), 3);
+    QCOMPARE(wiz2.remove(), true);
+
+    // removing objects invalidates the counts
+    QCOMPARE(foo.remove(), true);
+    QCOMPARE(foo.count(), 0);
+}
+
+/** Test caching query results.
+ */
+void TestUser::queryCache()
+{
+    loadFixtures();
+    QDjangoQueryCache::clear();
+
+    const QDjangoQuerySet<User> users;
+    QCOMPARE(users.cached(60000).size(), 3);
+    QCOMPARE(QDjangoQueryCache::missCount(), qint64(1));
+    QVERIFY(QDjangoQueryCache::totalCost() > 0);
+
+    // identical queries are answered from the cache
+    QDjangoQuerySet<User> cached = users.cached(60000);
+    QCOMPARE(cached.size(), 3);
+    QCOMPARE(QDjangoQueryCache::hitCount(), qint64(1));
+    QCOMPARE(QDjangoQueryCache::hitRatio(), 0.5);
+
+    // bound values are part of the key
+    QCOMPARE(users.cached(60000).filter(QDjangoWhere("username", QDjangoWhere::Equals, "foouser")).size(), 1);
+    QCOMPARE(users.cached(60000).filter(QDjangoWhere("username", QDjangoWhere::Equals, "baruser")).size(), 1);
+    QCOMPARE(QDjangoQueryCache::missCount(), qint64(3));
+
+    // saving invalidates the cached results
+    User user;
+    user.setUsername("cacheuser");
+    user.setPassword("cachepass");
+    QCOMPARE(user.save(), true);
+    QCOMPARE(users.cached(60000).size(), 4);
+    QCOMPARE(QDjangoQueryCache::missCount(), qint64(4));
+
+    // so does removing
+    QCOMPARE(user.remove(), true);
+    QCOMPARE(users.cached(60000).size(), 3);
+    QCOMPARE(QDjangoQueryCache::missCount(), qint64(5));
+
+    // results which see uncommitted writes bypass the cache
+    QVERIFY(QDjango::transaction());
+    User uncommitted;
+    uncommitted.setUsername("uncommitteduser");
+    uncommitted.setPassword("uncommittedpass");
+    QCOMPARE(uncommitted.save(), true);
+    QCOMPARE(users.cached(60000).size(), 4);
+    QCOMPARE(QDjangoQueryCache::missCount(), qint64(5));
+    QVERIFY(QDjango::rollback());
+    QCOMPARE(users.cached(60000).size(), 3);
+    QCOMPARE(QDjangoQueryCache::missCount(), qint64(6));
+
+    // entries which do not fit are not stored
+    QDjangoQueryCache::clear();
+    const int maxCost = QDjangoQueryCache::maxCost();
+    QDjangoQueryCache::setMaxCost(1);
+    QCOMPARE(users.cached(60000).size(), 3);
+    QCOMPARE(users.cached(60000).size(), 3);
+    QCOMPARE(QDjangoQueryCache::hitCount(), qint64(0));
+    QCOMPARE(QDjangoQueryCache::totalCost(), 0);
+    QDjangoQueryCache::setMaxCost(maxCost);
+}
+
+/** Test explaining querysets and capturing slow queries.
+ */
+void TestUser::explain()
+{
+    loadFixtures();
+
+    const QDjangoQuerySet<User> users;
+    QDjangoQuerySet<User> filtered = users.filter(QDjangoWhere("username", QDjangoWhere::Equals, "foouser"));
+    QVERIFY(!filtered.explain().isEmpty());
+
+    // slow queries have their plan captured
+    QDjango::clearSlowQueries();
+    QDjango::setSlowQueryThreshold(0);
+    QCOMPARE(filtered.size(), 1);
+    QDjango::setSlowQueryThreshold(-1);
+
+    const QList<QVariantMap> slowQueries = QDjango::slowQueries();
+    QCOMPARE(slowQueries.size(), 1);
+    QVERIFY(slowQueries[0].value("sql").toString().startsWith("SELECT "));
+    QCOMPARE(slowQueries[0].value("values").toList(), QVariantList() << QString("foouser"));
+    QCOMPARE(slowQueries[0].value("connectionName").toString(), QDjango::database().connectionName());
+    QCOMPARE(slowQueries[0].value("plan").toString(), filtered.explain());
+
+    // saves are captured too
+    QDjango::clearSlowQueries();
+    QDjango::setSlowQueryThreshold(0);
+    User user;
+    user.setUsername("slowuser");
+    user.setPassword("slowpass");
+    QCOMPARE(user.save(), true);
+    QDjango::setSlowQueryThreshold(-1);
+    QCOMPARE(QDjango::slowQueries().size(), 1);
+    QVERIFY(QDjango::slowQueries()[0].value("sql").toString().startsWith("INSERT "));
+
+    // the plan is not captured within a transaction
+    QDjango::clearSlowQueries();
+    QCOMPARE(QDjango::transaction(), true);
+    QDjango::setSlowQueryThreshold(0);
+    QCOMPARE(users.filter(QDjangoWhere("username", QDjangoWhere::Equals, "foouser")).size(), 1);
+    QDjango::setSlowQueryThreshold(-1);
+    QCOMPARE(QDjango::commit(), true);
+    QCOMPARE(QDjango::slowQueries().size(), 1);
+    QCOMPARE(QDjango::slowQueries()[0].value("plan").toString(), QString());
+
+    // capture can be disabled
+    QCOMPARE(users.count(), 4);
+    QCOMPARE(QDjango::slowQueries().size(), 1);
+    QDjango::clearSlowQueries();
+}
+
+void TestUser::queryDetector()
+{
+    QCOMPARE(QDjangoQueryDetector::fingerprint("SELECT  \"id\" FROM \"user\" WHERE \"id\" IN (1, 2, 3) AND \"username\" = 'it''s' LIMIT 10"),
+        QString("SELECT \"id\" FROM \"user\" WHERE \"id\" IN (?) AND \"username\" = ? LIMIT ?"));
+
+    loadFixtures();
+    const QDjangoQuerySet<User> users;
+    const QStringList names = QStringList() << "foouser" << "baruser" << "wizuser";
+
+    QDjangoQueryDetector detector(3);
+
+    // statements under the threshold are not reported
+    detector.begin("lookups");
+    foreach (const QString &name, names) {
+        User *user = users.get(QDjangoWhere("username", QDjangoWhere::Equals, name));
+        QVERIFY(user != 0);
+        delete user;
+    }
+    QCOMPARE(detector.end(), QStringList());
+
+    // repeated statements are reported once
+    detector.begin("lookups");
+    for (int i = 0; i < 5; ++i) {
+        User *user = users.get(QDjangoWhere("username", QDjangoWhere::Equals, names[i % names.size()]));
+        QVERIFY(user != 0);
+        delete user;
+    }
+    const QStringList reports = detector.end();
+    QCOMPARE(reports.size(), 1);
+    QVERIFY(reports[0].contains(" in lookups: SELECT "));
+    QVERIFY(reports[0].contains("selectRelated()"));
+
+    // statements outside a unit of work are ignored
+    for (int i = 0; i < 5; ++i)
+        QCOMPARE(users.count(), 3);
+    QCOMPARE(detector.end(), QStringList());
+}
+
+/** Test saving users through a write queue.
+ */
+void TestUser::writeQueue()
+{
+    if (QDjango::database().databaseName() == QLatin1String(":memory:"))
+        QSKIP("Queued writes need a database shared between threads", SkipSingle);
+
+    loadFixtures();
+
+    const QDjangoQuerySet<User> users;
+    User *foo = users.get(QDjangoWhere("username", QDjangoWhere::Equals, "foouser"));
+    QVERIFY(foo != 0);
+
+    QDjangoWriteQueue queue;
+    queue.setBatchSize(10);
+
+    // successive saves of the same user are coalesced
+    foo->setPassword("foopass2");
+    queue.save(foo);
+    foo->setPassword("foopass3");
+    queue.save(foo);
+    QCOMPARE(queue.pendingCount(), 1);
+
+    // new users are always inserted
+    User wiz2;
+    wiz2.setUsername("wizuser2");
+    wiz2.setPassword("wizpass2");
+    queue.save(&wiz2);
+    QCOMPARE(queue.pendingCount(), 2);
+    delete foo;
+
+    queue.flush();
+    QCOMPARE(queue.pendingCount(), 0);
+    QCOMPARE(queue.peakPendingCount(), 2);
+    QCOMPARE(queue.writtenCount(), qint64(2));
+    QCOMPARE(queue.failedCount(), qint64(0));
+
+    QCOMPARE(users.all().size(), 4);
+    foo = users.get(QDjangoWhere("username", QDjangoWhere::Equals, "foouser"));
+    QVERIFY(foo != 0);
+    QCOMPARE(foo->password(), QLatin1String("foopass3"));
+    delete foo;
+
+    // a single snapshot is written once the flush interval elapses
+    queue.setFlushInterval(100);
+    User wiz3;
+    wiz3.setUsername("wizuser3");
+    wiz3.setPassword("wizpass3");
+    queue.save(&wiz3);
+    for (int i = 0; i < 40 && queue.writtenCount() < 3; ++i)
+        QTest::qWait(50);
+    QCOMPARE(queue.writtenCount(), qint64(3));
+    QCOMPARE(queue.pendingCount(), 0);
+    QCOMPARE(users.all().size(), 5);
+
+    // a failing snapshot does not prevent the rest of its batch from
+    // being written, here the group table does not exist
+    User wiz4;
+    wiz4.setUsername("wizuser4");
+    wiz4.setPassword("wizpass4");
+    queue.save(&wiz4);
+    Group group;
+    group.setName("nogroup");
+    queue.save(&group);
+    User wiz5;
+    wiz5.setUsername("wizuser5");
+    wiz5.setPassword("wizpass5");
+    queue.save(&wiz5);
+    queue.flush();
+    QCOMPARE(queue.writtenCount(), qint64(5));
+    QCOMPARE(queue.failedCount(), qint64(1));
+    QCOMPARE(users.all().size(), 7);
+}
+
+/** Test running queries on the database thread pool.
+ */
+void TestUser::async()
+{
+    if (QDjango::database().databaseName() == QLatin1String(":memory:"))
+        QSKIP("Asynchronous queries need a database shared between threads", SkipSingle);
+
+    loadFixtures();
+
+    const QDjangoQuerySet<User> users;
+    QFuture<int> count = users.filter(QDjangoWhere("username", QDjangoWhere::StartsWith, "f")).countAsync();
+    QFuture<QDjangoQuerySet<User> > fetch = users.orderBy(QStringList("username")).fetchAsync();
+
+    QCOMPARE(count.result(), 1);
+    QDjangoQuerySet<User> fetched = fetch.result();
+    QCOMPARE(fetched.size(), 3);
+    User *other = fetched.at(0);
+    QVERIFY(other != 0);
+    QCOMPARE(other->username(), QLatin1String("baruser"));
+    delete other;
+
+    // save a snapshot, then modify the model
+    User user;
+    user.setUsername("asyncuser");
+    user.setPassword("asyncpass");
+    QFuture<QVariant> save = user.saveAsync();
+    user.setUsername("changed");
+
+    const QVariant pk = save.result();
+    QVERIFY(pk.isValid());
+    other = users.get(QDjangoWhere("pk", QDjangoWhere::Equals, pk));
+    QVERIFY(other != 0);
+    QCOMPARE(other->username(), QLatin1String("asyncuser"));
+    delete other;
+
+    // the generated key is only stored in the model on request
+    QVERIFY(user.pk() != pk);
+    user.setPk(pk);
+    QCOMPARE(user.save(), true);
+    QCOMPARE(users.filter(QDjangoWhere("username", QDjangoWhere::Equals, "changed")).count(), 1);
+    QCOMPARE(users.filter(QDjangoWhere("username", QDjangoWhere::Equals, "asyncuser")).count(), 0);
+}
 
 /** Clear database table after each test.
  */
@@ -645,6 +1021,49 @@ void TestRelated::filterRelated()
     delete msg;
 }
 
+/** Remove objects using a filter on a foreign field.
+ */
+void TestRelated::removeRelated()
+{
+    const QDjangoQuerySet<Message> messages;
+    // load fixtures
+    {
+        User *foo = new User;
+        foo->setUsername("foouser");
+        foo->setPassword("foopass");
+        QCOMPARE(foo->save(), true);
+
+        User *bar = new User;
+        bar->setUsername("baruser");
+        bar->setPassword("barpass");
+        QCOMPARE(bar->save(), true);
+
+        Message message1;
+        message1.setUser(foo);
+        message1.setText("foo message");
+        QCOMPARE(message1.save(), true);
+
+        Message message2;
+        message2.setUser(bar);
+        message2.setText("bar message");
+        QCOMPARE(message2.save(), true);
+    }
+    QCOMPARE(messages.count(), 2);
+
+    // remove messages for "foouser"
+    QDjangoQuerySet<Message> qs = messages.filter(
+        QDjangoWhere("user__username", QDjangoWhere::Equals, "foouser"));
+    QCOMPARE(qs.remove(), true);
+
+    // check remaining message
+    qs = messages.all();
+    QCOMPARE(qs.size(), 1);
+    Message *msg = qs.at(0);
+    QVERIFY(msg != 0);
+    QCOMPARE(msg->text(), QLatin1String("bar message"));
+    delete msg;
+}
+
 /** Test many-to-many relationships using an intermediate table.
  */
 void TestRelated::testGroups()
@@ -31,6 +31,8 @@ private slots:
     void remove();
     void removeFilter();
     void removeLimit();
+    void removeByIds();
+    void bulkLoader();
     void get();
     void filter();
     void filterLike();
@@ -40,6 +42,12 @@ private slots:
     void values();
     void valuesList();
     void constIterator();
+    void queryBatch();
+    void queryCache();
+    void explain();
+    void queryDetector();
+    void writeQueue();
+    void async();
     void cleanup();
     void cleanupTestCase();
 
@@ -56,6 +64,7 @@ private slots:
     void testGroups();
     void testRelated();
     void filterRelated();
+    void removeRelated();
     void cleanup();
     void cleanupTestCase();
 };
@@ -0,0 +1,361 @@
+/*
+ * QDjango
+ * Copyright (C) 2010-2011 Bolloré telecom
+ * See AUTHORS file for a full list of contributors.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <cstdlib>
+
+#include <QCoreApplication>
+#include <QFile>
+#include <QSqlDatabase>
+#include <QStringList>
+#include <QTextStream>
+#include <QtTest>
+
+#include "QDjango.h"
+#include "QDjangoAllocCounter.h"
+#include "QDjangoBulkLoader.h"
+#include "QDjangoQuerySet.h"
+#include "QDjangoWhere.h"
+
+#include "bench.h"
+#include "auth/models.h"
+
+static QTextStream *allocationsOutput = 0;
+
+/** Writes the allocations per operation of the current benchmark as a CSV
+ *  row, when an output file was given and QDjango is built with
+ *  QDJANGO_ALLOC_ACCOUNTING.
+ *
+ *  The rows are kept out of the QTest output so that it stays parseable.
+ */
+static void reportAllocations(const QDjangoAllocCounter &counter, qint64 operations)
+{
+    if (!allocationsOutput || !QDjangoAllocCounter::isAvailable() || operations <= 0)
+        return;
+
+    *allocationsOutput << QTest::currentTestFunction() << ','
+                       << QString::fromLatin1(QTest::currentDataTag()) << ','
+                       << double(counter.allocations()) / operations << ','
+                       << double(counter.bytes()) / operations << '\n';
+    allocationsOutput->flush();
+}
+
+/** Adds users until the table holds the given number of rows.
+ */
+void tst_Bench::populate(int count)
+{
+    if (m_userCount >= count)
+        return;
+
+    QDjangoBulkLoader<User> loader;
+    QVERIFY(loader.begin());
+    for (int i = m_userCount; i < count; ++i) {
+        User user;
+        user.setUsername(QString("user%1").arg(i));
+        user.setEmail(QString("user%1@example.com").arg(i));
+        user.setPassword("password");
+        user.setDateJoined(QDateTime::currentDateTime());
+        QVERIFY(loader.append(&user));
+    }
+    QVERIFY(loader.finish());
+    m_userCount = count;
+}
+
+void tst_Bench::initTestCase()
+{
+    QVERIFY(QDjango::createTables());
+    m_userCount = 0;
+
+    // messages spread over 100 users, for the related object benchmarks
+    populate(100);
+    const QList<QVariantList> users = QDjangoQuerySet<User>().valuesList(QStringList() << "id");
+    QDjangoBulkLoader<Message> loader;
+    QVERIFY(loader.begin());
+    for (int i = 0; i < 1000; ++i) {
+        Message message;
+        message.setText(QString("message %1").arg(i));
+        message.setProperty("user_id", users.at(i % users.size()).first());
+        QVERIFY(loader.append(&message));
+    }
+    QVERIFY(loader.finish());
+}
+
+/** Measures the generation of a SELECT statement with joins.
+ */
+void tst_Bench::compilerSql()
+{
+    const QSqlDatabase db = QDjango::database();
+    QDjangoAllocCounter counter;
+    int iterations = 0;
+    QBENCHMARK {
+        QDjangoCompiler compiler("Message", db);
+        QDjangoWhere where("user__username", QDjangoWhere::Equals, "user1");
+        compiler.resolve(where);
+        const QString sql = QLatin1String("SELECT ") + compiler.fieldNames(true).join(", ") +
+            QLatin1String(" FROM ") + compiler.fromSql() +
+            QLatin1String(" WHERE ") + where.sql() +
+            compiler.orderLimitSql(QStringList() << "-id", 0, 10);
+        Q_UNUSED(sql);
+        iterations++;
+    }
+    reportAllocations(counter, iterations);
+}
+
+/** Measures the rendering and binding of a compound WHERE clause.
+ */
+void tst_Bench::whereSql()
+{
+    const QSqlDatabase db = QDjango::database();
+    const QDjangoWhere where =
+        (QDjangoWhere("id", QDjangoWhere::GreaterThan, 10) &&
+         QDjangoWhere("username", QDjangoWhere::StartsWith, "user")) ||
+        QDjangoWhere("id", QDjangoWhere::IsIn, QVariantList() << 1 << 2 << 3);
+    QDjangoAllocCounter counter;
+    int iterations = 0;
+    QBENCHMARK {
+        QDjangoQuery query(db);
+        query.prepare(where.sql());
+        where.bindValues(query);
+        iterations++;
+    }
+    reportAllocations(counter, iterations);
+}
+
+/** Measures saving new objects.
+ */
+void tst_Bench::saveInsert()
+{
+    QDjangoAllocCounter counter;
+    int iterations = 0;
+    QBENCHMARK {
+        User user;
+        user.setUsername("inserted");
+        user.setPassword("password");
+        QVERIFY(user.save());
+        iterations++;
+    }
+    reportAllocations(counter, iterations);
+    QDjangoQuerySet<User>().filter(QDjangoWhere("username", QDjangoWhere::Equals, "inserted")).remove();
+}
+
+/** Measures saving existing objects.
+ */
+void tst_Bench::saveUpdate()
+{
+    User user;
+    user.setUsername("updated");
+    user.setPassword("password");
+    QVERIFY(user.save());
+
+    int i = 0;
+    QDjangoAllocCounter counter;
+    int iterations = 0;
+    QBENCHMARK {
+        user.setEmail(QString("updated%1@example.com").arg(i++));
+        QVERIFY(user.save());
+        iterations++;
+    }
+    reportAllocations(counter, iterations);
+    QVERIFY(user.remove());
+}
+
+void tst_Bench::fetch_data()
+{
+    QTest::addColumn<int>("rows");
+
+    QTest::newRow("1k") << 1000;
+    QTest::newRow("100k") << 100000;
+    QTest::newRow("1M") << 1000000;
+}
+
+/** Measures fetching rows and loading them into model instances.
+ */
+void tst_Bench::fetch()
+{
+    QFETCH(int, rows);
+    populate(rows);
+
+    const QDjangoQuerySet<User> users = QDjangoQuerySet<User>().limit(0, rows);
+    QDjangoAllocCounter counter;
+    int iterations = 0;
+    QBENCHMARK {
+        User user;
+        QDjangoQuerySet<User> qs = users.all();
+        const int size = qs.size();
+        for (int i = 0; i < size; ++i)
+            qs.at(i, &user);
+        QCOMPARE(size, rows);
+        iterations++;
+    }
+    reportAllocations(counter, iterations * rows);
+}
+
+void tst_Bench::values_data()
+{
+    fetch_data();
+}
+
+/** Measures fetching rows as maps.
+ */
+void tst_Bench::values()
+{
+    QFETCH(int, rows);
+    populate(rows);
+
+    const QStringList fields = QStringList() << "id" << "username" << "email";
+    QDjangoAllocCounter counter;
+    int iterations = 0;
+    QBENCHMARK {
+        QCOMPARE(QDjangoQuerySet<User>().limit(0, rows).values(fields).size(), rows);
+        iterations++;
+    }
+    reportAllocations(counter, iterations * rows);
+}
+
+void tst_Bench::valuesList_data()
+{
+    fetch_data();
+}
+
+/** Measures fetching rows as lists.
+ */
+void tst_Bench::valuesList()
+{
+    QFETCH(int, rows);
+    populate(rows);
+
+    const QStringList fields = QStringList() << "id" << "username" << "email";
+    QDjangoAllocCounter counter;
+    int iterations = 0;
+    QBENCHMARK {
+        QCOMPARE(QDjangoQuerySet<User>().limit(0, rows).valuesList(fields).size(), rows);
+        iterations++;
+    }
+    reportAllocations(counter, iterations * rows);
+}
+
+/** Measures fetching objects along with their related objects in a
+ *  single query.
+ */
+void tst_Bench::selectRelated()
+{
+    QDjangoAllocCounter counter;
+    qint64 rows = 0;
+    QBENCHMARK {
+        Message message;
+        QDjangoQuerySet<Message> qs = QDjangoQuerySet<Message>().selectRelated();
+        const int size = qs.size();
+        for (int i = 0; i < size; ++i) {
+            qs.at(i, &message);
+            QVERIFY(message.user() != 0);
+        }
+        rows += size;
+    }
+    reportAllocations(counter, rows);
+}
+
+/** Measures loading related objects on demand, one query per object.
+ */
+void tst_Bench::foreignKey()
+{
+    QDjangoAllocCounter counter;
+    qint64 rows = 0;
+    QBENCHMARK {
+        QDjangoQuerySet<Message> qs;
+        const int size = qs.size();
+        for (int i = 0; i < size; ++i) {
+            Message message;
+            qs.at(i, &message);
+            QVERIFY(message.user() != 0);
+        }
+        rows += size;
+    }
+    reportAllocations(counter, rows);
+}
+
+void tst_Bench::cleanupTestCase()
+{
+    QVERIFY(QDjango::dropTables());
+}
+
+/** Display program usage.
+ */
+static void usage()
+{
+    fprintf(stderr, "Usage: qdjango-bench [-n <database>] [-a <allocations.csv>] [QTest options]\n");
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+
+    // the database defaults to in-memory SQLite, remaining arguments are
+    // given to QTest, for instance "-xml -o results.xml"
+    QString databaseName = ":memory:";
+    QString allocationsName;
+    QStringList args;
+    args << app.arguments().first();
+    for (int i = 1; i < argc; ++i) {
+        if (!strcmp(argv[i], "-n") || !strcmp(argv[i], "-a")) {
+            if (i == argc - 1) {
+                usage();
+                return EXIT_FAILURE;
+            }
+            if (!strcmp(argv[i], "-n"))
+                databaseName = QString::fromLocal8Bit(argv[++i]);
+            else
+                allocationsName = QString::fromLocal8Bit(argv[++i]);
+        } else {
+            args << QString::fromLocal8Bit(argv[i]);
+        }
+    }
+
+    QSqlDatabase db = QSqlDatabase::addDatabase("QSQLITE");
+    db.setDatabaseName(databaseName);
+    if (!db.open()) {
+        fprintf(stderr, "Could not access database\n");
+        return EXIT_FAILURE;
+    }
+    QDjango::setDatabase(db);
+
+    QDjango::registerModel<User>();
+    QDjango::registerModel<Group>();
+    QDjango::registerModel<Message>();
+    QDjango::registerModel<UserGroups>();
+
+    // allocations are written to a separate CSV file
+    QFile allocationsFile(allocationsName);
+    QTextStream allocationsStream;
+    if (!allocationsName.isEmpty()) {
+        if (!QDjangoAllocCounter::isAvailable())
+            fprintf(stderr, "Allocation accounting is not available in this build\n");
+        if (!allocationsFile.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+            fprintf(stderr, "Could not open %s\n", qPrintable(allocationsName));
+            return EXIT_FAILURE;
+        }
+        allocationsStream.setDevice(&allocationsFile);
+        allocationsStream << "function,tag,allocations_per_op,bytes_per_op\n";
+        allocationsOutput = &allocationsStream;
+    }
+
+    tst_Bench bench;
+    const int ret = QTest::qExec(&bench, args);
+    allocationsOutput = 0;
+    return ret;
+}
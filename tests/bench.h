@@ -0,0 +1,49 @@
+/*
+ * QDjango
+ * Copyright (C) 2010-2011 Bolloré telecom
+ * See AUTHORS file for a full list of contributors.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <QObject>
+
+/** Benchmarks for the ORM's hot paths.
+ */
+class tst_Bench : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void initTestCase();
+    void compilerSql();
+    void whereSql();
+    void saveInsert();
+    void saveUpdate();
+    void fetch_data();
+    void fetch();
+    void values_data();
+    void values();
+    void valuesList_data();
+    void valuesList();
+    void selectRelated();
+    void foreignKey();
+    void cleanupTestCase();
+
+private:
+    void populate(int count);
+
+    int m_userCount;
+};
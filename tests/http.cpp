@@ -27,6 +27,8 @@
 #include "QDjangoHttpRequest.h"
 #include "QDjangoHttpResponse.h"
 #include "QDjangoHttpServer.h"
+#include "QDjangoMetrics.h"
+#include "QDjangoMetricsController.h"
 
 #include "http.h"
 
@@ -48,6 +50,19 @@ QDjangoHttpResponse *TestController::respondToRequest(const QDjangoHttpRequest &
     return serveNotFound(request);
 }
 
+TestHttpReceiver::TestHttpReceiver()
+    : wrongThread(false)
+{
+}
+
+void TestHttpReceiver::requestFinished(QDjangoHttpRequest *request, QDjangoHttpResponse *response)
+{
+    if (QThread::currentThread() != thread())
+        wrongThread = true;
+    paths << request->path();
+    statusCodes << response->statusCode();
+}
+
 void TestHttp::cleanupTestCase()
 {
     delete httpServer;
@@ -97,3 +112,119 @@ void TestHttp::testGet()
     delete reply;
 }
 
+
+void TestHttp::testMetrics()
+{
+    QDjangoMetricsController metricsController(httpController);
+    httpServer->setController(&metricsController);
+
+    QNetworkAccessManager network;
+    QEventLoop loop;
+
+    // other paths are served by the next controller
+    QNetworkReply *reply = network.get(QNetworkRequest(QUrl("http://127.0.0.1:8123/")));
+    QObject::connect(reply, SIGNAL(finished()), &loop, SLOT(quit()));
+    loop.exec();
+    QCOMPARE(reply->readAll(), QByteArray("hello"));
+    delete reply;
+
+    reply = network.get(QNetworkRequest(QUrl("http://127.0.0.1:8123/metrics")));
+    QObject::connect(reply, SIGNAL(finished()), &loop, SLOT(quit()));
+    loop.exec();
+    QCOMPARE(int(reply->error()), int(QNetworkReply::NoError));
+    QVERIFY(reply->header(QNetworkRequest::ContentTypeHeader).toString().startsWith("text/plain; version=0.0.4"));
+    const QString body = QString::fromUtf8(reply->readAll());
+    QVERIFY(body.contains("# TYPE qdjango_http_connections_total counter\n"));
+    QVERIFY(body.contains("# TYPE qdjango_http_connections_active gauge\n"));
+    QVERIFY(body.contains("# TYPE qdjango_http_request_duration_seconds histogram\n"));
+    QVERIFY(body.contains("# TYPE qdjango_http_pending_jobs histogram\n"));
+    QVERIFY(!body.contains("qdjango_http_pending_jobs_count 0\n"));
+    QVERIFY(!body.contains("qdjango_http_responses_total{code=\"2xx\"} 0\n"));
+    delete reply;
+
+    httpServer->setController(httpController);
+}
+
+void TestHttp::testWorkers_data()
+{
+    QTest::addColumn<int>("policy");
+
+    QTest::newRow("round-robin") << int(QDjangoHttpServer::RoundRobin);
+    QTest::newRow("least-connections") << int(QDjangoHttpServer::LeastConnections);
+}
+
+void TestHttp::testWorkers()
+{
+    QFETCH(int, policy);
+
+    httpServer->setWorkerPolicy(QDjangoHttpServer::WorkerPolicy(policy));
+    httpServer->setWorkerCount(2);
+    QCOMPARE(httpServer->workerCount(), 2);
+
+    QDjangoCounter responses("qdjango_http_responses_total{code=\"2xx\"}", QString());
+    const double before = responses.value();
+
+    // the receiver lives in this thread and uses an automatic connection
+    TestHttpReceiver receiver;
+    QObject::connect(httpServer, SIGNAL(requestFinished(QDjangoHttpRequest*,QDjangoHttpResponse*)),
+                     &receiver, SLOT(requestFinished(QDjangoHttpRequest*,QDjangoHttpResponse*)));
+
+    // requests are sent over several connections at once
+    QNetworkAccessManager network;
+    QList<QNetworkReply*> replies;
+    for (int i = 0; i < 4; ++i)
+        replies << network.get(QNetworkRequest(QUrl("http://127.0.0.1:8123/")));
+    foreach (QNetworkReply *reply, replies) {
+        if (!reply->isFinished()) {
+            QEventLoop loop;
+            QObject::connect(reply, SIGNAL(finished()), &loop, SLOT(quit()));
+            loop.exec();
+        }
+        QCOMPARE(int(reply->error()), int(QNetworkReply::NoError));
+        QCOMPARE(reply->readAll(), QByteArray("hello"));
+    }
+    qDeleteAll(replies);
+    QCOMPARE(responses.value() - before, 4.0);
+
+    // requestFinished is delivered in the server's thread
+    for (int i = 0; i < 50 && receiver.paths.size() < 4; ++i)
+        QTest::qWait(10);
+    QCOMPARE(receiver.paths, QStringList() << "/" << "/" << "/" << "/");
+    QCOMPARE(receiver.statusCodes, QList<int>() << 200 << 200 << 200 << 200);
+    QCOMPARE(receiver.wrongThread, false);
+
+    httpServer->setWorkerCount(0);
+    QCOMPARE(httpServer->workerCount(), 0);
+    httpServer->setWorkerPolicy(QDjangoHttpServer::RoundRobin);
+}
+
+void TestHttp::testReusePort()
+{
+    QDjangoHttpServer server1;
+    server1.setController(httpController);
+    if (!server1.listenReusePort(QHostAddress::LocalHost, 0))
+        QSKIP("SO_REUSEPORT is not supported", SkipSingle);
+
+    // a second server shares the port, with a listener per worker
+    QDjangoHttpServer server2;
+    server2.setController(httpController);
+    server2.setWorkerCount(2);
+    QCOMPARE(server2.listenReusePort(QHostAddress::LocalHost, server1.serverPort()), true);
+    QCOMPARE(server2.serverPort(), server1.serverPort());
+
+    QNetworkAccessManager network;
+    const QUrl url(QString("http://127.0.0.1:%1/").arg(server1.serverPort()));
+    for (int i = 0; i < 4; ++i) {
+        QNetworkRequest request(url);
+        request.setRawHeader("Connection", "close");
+        QNetworkReply *reply = network.get(request);
+
+        QEventLoop loop;
+        QObject::connect(reply, SIGNAL(finished()), &loop, SLOT(quit()));
+        loop.exec();
+
+        QCOMPARE(int(reply->error()), int(QNetworkReply::NoError));
+        QCOMPARE(reply->readAll(), QByteArray("hello"));
+        delete reply;
+    }
+}
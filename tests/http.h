@@ -19,9 +19,30 @@
 
 #include <QObject>
 
+#include <QStringList>
+
 class QDjangoHttpController;
+class QDjangoHttpRequest;
+class QDjangoHttpResponse;
 class QDjangoHttpServer;
 
+/** Records the requests reported by QDjangoHttpServer::requestFinished().
+ */
+class TestHttpReceiver : public QObject
+{
+    Q_OBJECT
+
+public:
+    TestHttpReceiver();
+
+    QStringList paths;
+    QList<int> statusCodes;
+    bool wrongThread;
+
+public slots:
+    void requestFinished(QDjangoHttpRequest *request, QDjangoHttpResponse *response);
+};
+
 /** Test QDjangoServer class.
  */
 class TestHttp : public QObject
@@ -33,6 +54,10 @@ private slots:
     void initTestCase();
     void testGet_data();
     void testGet();
+    void testMetrics();
+    void testWorkers_data();
+    void testWorkers();
+    void testReusePort();
 
 private:
     QDjangoHttpController *httpController;
@@ -20,12 +20,19 @@
 #include <cstdlib>
 
 #include <QCoreApplication>
+#include <QDir>
+#include <QFile>
 #include <QSqlDatabase>
+#include <QThread>
 #include <QVariant>
 #include <QtTest>
 
 #include "QDjango.h"
+#include "QDjangoAllocCounter.h"
+#include "QDjangoMetrics.h"
+#include "QDjangoQueryObserver.h"
 #include "QDjangoQuerySet.h"
+#include "QDjangoTracer.h"
 #include "QDjangoWhere.h"
 
 #include "main.h"
@@ -125,6 +132,620 @@ void Owner::setItem2(Item *item2)
     setForeignKey("item2", item2);
 }
 
+Account::Account(QObject *parent)
+    : QDjangoModel(parent),
+    m_owner(0),
+    m_balance(0)
+{
+}
+
+int Account::owner() const
+{
+    return m_owner;
+}
+
+void Account::setOwner(int owner)
+{
+    m_owner = owner;
+}
+
+int Account::balance() const
+{
+    return m_balance;
+}
+
+void Account::setBalance(int balance)
+{
+    m_balance = balance;
+}
+
+Session::Session(QObject *parent)
+    : QDjangoModel(parent)
+{
+}
+
+QString Session::key() const
+{
+    return m_key;
+}
+
+void Session::setKey(const QString &key)
+{
+    m_key = key;
+}
+
+Event::Event(QObject *parent)
+    : QDjangoModel(parent)
+{
+}
+
+QDateTime Event::date() const
+{
+    return m_date;
+}
+
+void Event::setDate(const QDateTime &date)
+{
+    m_date = date;
+}
+
+QString Event::message() const
+{
+    return m_message;
+}
+
+void Event::setMessage(const QString &message)
+{
+    m_message = message;
+}
+
+static QVariant sqliteCacheSize(const QSqlDatabase &db)
+{
+    QSqlQuery query(db);
+    if (query.exec("PRAGMA cache_size") && query.next())
+        return query.value(0);
+    return QVariant();
+}
+
+class ProfileThread : public QThread
+{
+public:
+    void run()
+    {
+        cacheSize = sqliteCacheSize(QDjango::database());
+    }
+
+    QVariant cacheSize;
+};
+
+/** Runs a count query from another thread, which opens a connection for
+ *  that thread.
+ */
+template <class T>
+class CountThread : public QThread
+{
+public:
+    CountThread(const QString &alias = QString())
+        : m_alias(alias)
+    {
+    }
+
+    void run()
+    {
+        QDjangoQuerySet<T> objects;
+        if (!m_alias.isEmpty())
+            objects = objects.usingDatabase(m_alias);
+        objects.count();
+    }
+
+private:
+    QString m_alias;
+};
+
+/** Test tuning profiles are applied to all connections.
+ */
+void tst_QDjango::connectionProfile()
+{
+    QSqlDatabase db = QDjango::database();
+    if (db.driverName() != QLatin1String("QSQLITE"))
+        QSKIP("Connection profile test requires SQLite", SkipSingle);
+
+    const QVariant defaultCacheSize = sqliteCacheSize(db);
+    QCOMPARE(QDjango::connectionProfile("QSQLITE"), QVariantMap());
+
+    // the main connection is tuned immediately
+    QVariantMap profile;
+    profile.insert("cache_size", -4321);
+    QDjango::setConnectionProfile("QSQLITE", profile);
+    QCOMPARE(QDjango::connectionProfile("QSQLITE"), profile);
+    QCOMPARE(sqliteCacheSize(db).toInt(), -4321);
+
+    // per-thread connections are tuned when they are opened
+    ProfileThread thread;
+    thread.start();
+    QVERIFY(thread.wait());
+    QCOMPARE(thread.cacheSize.toInt(), -4321);
+
+    // restore defaults
+    QDjango::setConnectionProfile("QSQLITE", QVariantMap());
+    QSqlQuery query(db);
+    QVERIFY(query.exec("PRAGMA cache_size = " + defaultCacheSize.toString()));
+}
+
+/** Test reads are routed to replicas.
+ */
+void tst_QDjango::replicas()
+{
+    if (QDjango::database().driverName() != QLatin1String("QSQLITE"))
+        QSKIP("Replica test requires SQLite", SkipSingle);
+
+    const QDjangoMetaModel metaModel = QDjango::registerModel<Item>();
+    QCOMPARE(metaModel.createTable(), true);
+
+    {
+        // the replica is a separate database with different contents
+        QSqlDatabase replica = QSqlDatabase::addDatabase("QSQLITE", "_test_replica");
+        replica.setDatabaseName(":memory:");
+        QVERIFY(replica.open());
+        QSqlQuery query(replica);
+        QVERIFY(query.exec("CREATE TABLE \"item\" (\"id\" integer NOT NULL PRIMARY KEY AUTOINCREMENT, \"name\" varchar(255) NOT NULL)"));
+        QVERIFY(query.exec("INSERT INTO \"item\" (\"name\") VALUES ('replica')"));
+        QDjango::addReplica(replica);
+    }
+    QDjango::setReplicaPolicy(QDjango::LeastLoaded);
+    QDjango::setReadYourWritesWindow(0);
+
+    // reads go to the replica
+    const QDjangoQuerySet<Item> items;
+    QCOMPARE(items.count(), 1);
+    QDjangoQuerySet<Item> all = items.all();
+    QCOMPARE(all.size(), 1);
+    Item *item = all.at(0);
+    QVERIFY(item != 0);
+    QCOMPARE(item->name(), QLatin1String("replica"));
+    delete item;
+
+    // writes go to the primary
+    Item primaryItem;
+    primaryItem.setName("primary");
+    QCOMPARE(primaryItem.save(), true);
+    QCOMPARE(items.count(), 1);
+
+    // reads within a transaction go to the primary
+    QVERIFY(QDjango::transaction());
+    all = items.all();
+    QCOMPARE(all.size(), 1);
+    item = all.at(0);
+    QVERIFY(item != 0);
+    QCOMPARE(item->name(), QLatin1String("primary"));
+    delete item;
+    QVERIFY(QDjango::commit());
+    all = items.all();
+    QCOMPARE(all.size(), 1);
+    item = all.at(0);
+    QVERIFY(item != 0);
+    QCOMPARE(item->name(), QLatin1String("replica"));
+    delete item;
+
+    // reads follow writes to the primary
+    QDjango::setReadYourWritesWindow(60000);
+    QCOMPARE(primaryItem.save(), true);
+    QCOMPARE(items.count(), 1);
+    all = items.all();
+    QCOMPARE(all.size(), 1);
+    item = all.at(0);
+    QVERIFY(item != 0);
+    QCOMPARE(item->name(), QLatin1String("primary"));
+    delete item;
+
+    const QList<QVariantMap> statistics = QDjango::replicaStatistics();
+    QCOMPARE(statistics.size(), 1);
+    QCOMPARE(statistics[0].value("connectionName").toString(), QLatin1String("_test_replica"));
+    QCOMPARE(statistics[0].value("queryCount").toInt(), 4);
+    QCOMPARE(statistics[0].value("errorCount").toInt(), 0);
+    QCOMPARE(statistics[0].value("activeQueries").toInt(), 0);
+
+    // removing the replicas closes the connections they opened for other
+    // threads, even if the threads' finished signal was not delivered yet
+    QDjango::setReadYourWritesWindow(0);
+    all = items.all();
+    QCOMPARE(all.size(), 1);
+    const QStringList connectionNames = QSqlDatabase::connectionNames();
+    CountThread<Item> thread;
+    thread.start();
+    QVERIFY(thread.wait());
+    QVERIFY(QSqlDatabase::connectionNames().size() > connectionNames.size());
+    QDjango::clearReplicas();
+    QCoreApplication::processEvents();
+    QCOMPARE(QSqlDatabase::connectionNames().toSet(), connectionNames.toSet());
+
+    // querysets which read from a replica no longer use it
+    QVERIFY(!all.explain().isEmpty());
+
+    // restore defaults
+    QDjango::setReplicaPolicy(QDjango::RoundRobin);
+    QDjango::setReadYourWritesWindow(1000);
+    QSqlDatabase::removeDatabase("_test_replica");
+    QCOMPARE(metaModel.dropTable(), true);
+}
+
+static int shardByParity(const QVariant &key, int shardCount)
+{
+    return key.toInt() % shardCount;
+}
+
+void tst_QDjango::shards()
+{
+    if (QDjango::database().driverName() != QLatin1String("QSQLITE"))
+        QSKIP("Shard test requires SQLite", SkipSingle);
+
+    // shards are stored in files so that worker threads see the same data
+    QStringList paths;
+    for (int i = 0; i < 2; ++i) {
+        paths << QDir::temp().filePath(QString("qdjango_shard%1.db").arg(i));
+        QFile::remove(paths[i]);
+        QSqlDatabase shard = QSqlDatabase::addDatabase("QSQLITE", QString("_test_shard%1").arg(i));
+        shard.setDatabaseName(paths[i]);
+        QVERIFY(shard.open());
+        QDjango::addShard(shard);
+    }
+    QDjango::setShardFunction(shardByParity);
+    QCOMPARE(QDjango::shardCount(), 2);
+
+    const QDjangoMetaModel metaModel = QDjango::registerModel<Account>();
+    QCOMPARE(metaModel.createTable(), true);
+    for (int i = 0; i < 6; ++i) {
+        Account account;
+        account.setOwner(i);
+        account.setBalance(10 * i);
+        QCOMPARE(account.save(), true);
+    }
+
+    {
+        // each shard holds its own rows
+        QSqlQuery query(QSqlDatabase::database("_test_shard1"));
+        QVERIFY(query.exec("SELECT \"owner\" FROM \"account\" ORDER BY \"owner\""));
+        QVariantList owners;
+        while (query.next())
+            owners << query.value(0).toInt();
+        QCOMPARE(owners, QVariantList() << 1 << 3 << 5);
+    }
+
+    // lookups on the shard key go to a single shard
+    const QDjangoQuerySet<Account> accounts;
+    QDjangoQuerySet<Account> single = accounts.filter(QDjangoWhere("owner", QDjangoWhere::Equals, 3));
+    QCOMPARE(single.count(), 1);
+    QCOMPARE(single.valuesList(QStringList() << "balance"), QList<QVariantList>() << (QVariantList() << 30));
+
+    // other querysets are merged across the shards
+    QCOMPARE(accounts.count(), 6);
+    QDjangoQuerySet<Account> sorted = accounts.orderBy(QStringList() << "-balance").limit(1, 3);
+    QCOMPARE(sorted.count(), 3);
+    QCOMPARE(sorted.valuesList(QStringList() << "owner"), QList<QVariantList>()
+        << (QVariantList() << 4)
+        << (QVariantList() << 3)
+        << (QVariantList() << 2));
+
+    // deletes are applied to every shard
+    QCOMPARE(accounts.filter(QDjangoWhere("balance", QDjangoWhere::GreaterOrEquals, 30)).remove(), true);
+    QCOMPARE(accounts.count(), 3);
+
+    // removals by id are only committed if every shard succeeds
+    QVariantList ids;
+    foreach (const QVariantList &row, accounts.valuesList(QStringList() << "id"))
+        ids << row[0];
+    {
+        QSqlQuery query(QSqlDatabase::database("_test_shard1"));
+        QVERIFY(query.exec("ALTER TABLE \"account\" RENAME TO \"account_moved\""));
+        QCOMPARE(metaModel.removeByIds(ids), -1);
+        QVERIFY(query.exec("ALTER TABLE \"account_moved\" RENAME TO \"account\""));
+    }
+    QCOMPARE(accounts.count(), 3);
+
+    // other threads, including the pooled ones which never finish, open
+    // their own connections to the shards
+    CountThread<Account> thread;
+    thread.start();
+    QVERIFY(thread.wait());
+
+    // restore defaults
+    QCOMPARE(metaModel.dropTable(), true);
+    QDjango::clearShards();
+    QDjango::setShardFunction(0);
+    for (int i = 0; i < paths.size(); ++i) {
+        QSqlDatabase::removeDatabase(QString("_test_shard%1").arg(i));
+        QFile::remove(paths[i]);
+    }
+
+    // removing the shards closed those connections
+    foreach (const QString &connectionName, QSqlDatabase::connectionNames())
+        QVERIFY(!paths.contains(QSqlDatabase::database(connectionName, false).databaseName()));
+}
+
+void tst_QDjango::aliases()
+{
+    {
+        QSqlDatabase sessions = QSqlDatabase::addDatabase("QSQLITE", "_test_sessions");
+        sessions.setDatabaseName(":memory:");
+        QVERIFY(sessions.open());
+        QDjango::setDatabase("sessions", sessions);
+    }
+    QCOMPARE(QDjango::databaseAliases(), QStringList() << "sessions");
+
+    // the model is stored in its aliased database
+    const QDjangoMetaModel metaModel = QDjango::registerModel<Session>();
+    QCOMPARE(metaModel.createTable(), true);
+    QVERIFY(QDjango::database("sessions").tables().contains("session"));
+    QVERIFY(!QDjango::database().tables().contains("session"));
+
+    Session session;
+    session.setKey("abc");
+    QCOMPARE(session.save(), true);
+    const QDjangoQuerySet<Session> sessions;
+    QCOMPARE(sessions.count(), 1);
+    QCOMPARE(sessions.filter(QDjangoWhere("key", QDjangoWhere::Equals, "abc")).remove(), true);
+    QCOMPARE(sessions.count(), 0);
+
+    // querysets can be run on another database
+    const QDjangoMetaModel itemModel = QDjango::registerModel<Item>();
+    QCOMPARE(itemModel.createTable(), true);
+    {
+        QSqlQuery query(QDjango::database("sessions"));
+        QVERIFY(query.exec("CREATE TABLE \"item\" (\"id\" integer NOT NULL PRIMARY KEY AUTOINCREMENT, \"name\" varchar(255) NOT NULL)"));
+        QVERIFY(query.exec("INSERT INTO \"item\" (\"name\") VALUES ('aliased')"));
+    }
+    const QDjangoQuerySet<Item> items;
+    QCOMPARE(items.count(), 0);
+    QCOMPARE(items.usingDatabase("sessions").count(), 1);
+    QCOMPARE(items.usingDatabase("sessions").valuesList(QStringList() << "name"),
+        QList<QVariantList>() << (QVariantList() << QString("aliased")));
+
+    // removing the alias closes the connections it opened for other
+    // threads, even if the threads' finished signal was not delivered yet
+    const QStringList connectionNames = QSqlDatabase::connectionNames();
+    CountThread<Item> thread("sessions");
+    thread.start();
+    QVERIFY(thread.wait());
+    QVERIFY(QSqlDatabase::connectionNames().size() > connectionNames.size());
+
+    // restore defaults
+    QCOMPARE(itemModel.dropTable(), true);
+    QCOMPARE(metaModel.dropTable(), true);
+    QDjango::removeDatabase("sessions");
+    QCoreApplication::processEvents();
+    QCOMPARE(QSqlDatabase::connectionNames().toSet(), connectionNames.toSet());
+    QSqlDatabase::removeDatabase("_test_sessions");
+    QCOMPARE(QDjango::databaseAliases(), QStringList());
+}
+
+void tst_QDjango::partitions()
+{
+    const QDjangoMetaModel metaModel = QDjango::registerModel<Event>();
+    QCOMPARE(metaModel.createTable(), true);
+    QCOMPARE(metaModel.createPartitions(2), true);
+
+    // on PostgreSQL, backdated and future rows go to the default partition
+    const QDateTime now = QDateTime::currentDateTime();
+    for (int i = 0; i < 3; ++i) {
+        Event event;
+        event.setDate(now.addDays(-10 * i));
+        event.setMessage(QString("event %1").arg(i));
+        QCOMPARE(event.save(), true);
+    }
+    Event future;
+    future.setDate(now.addDays(5));
+    future.setMessage("future");
+    QCOMPARE(future.save(), true);
+    const QDjangoQuerySet<Event> events;
+    QCOMPARE(events.count(), 4);
+
+    // new partitions take over the rows of the default partition
+    QCOMPARE(metaModel.createPartitions(6), true);
+    QCOMPARE(events.count(), 4);
+    if (QDjango::database().driverName() == QLatin1String("QPSQL")) {
+        QSqlQuery query(QDjango::database());
+        QVERIFY(query.exec("SELECT COUNT(*) FROM \"event_default\""));
+        QVERIFY(query.next());
+        QCOMPARE(query.value(0).toInt(), 2);
+    }
+
+    // expired rows are removed, including those of the default partition
+    QCOMPARE(metaModel.dropPartitions(now.addDays(-5)), true);
+    QCOMPARE(events.count(), 2);
+    QCOMPARE(events.orderBy(QStringList() << "date").valuesList(QStringList() << "message"),
+        QList<QVariantList>()
+            << (QVariantList() << QString("event 0"))
+            << (QVariantList() << QString("future")));
+
+    QCOMPARE(metaModel.dropTable(), true);
+}
+
+class QueryRecorder : public QDjangoQueryObserver
+{
+public:
+    void queryExecuted(const QDjangoQueryEvent &event)
+    {
+        events << event;
+    }
+
+    QList<QDjangoQueryEvent> events;
+};
+
+void tst_QDjango::queryObserver()
+{
+    const QDjangoMetaModel metaModel = QDjango::registerModel<Item>();
+    QCOMPARE(metaModel.createTable(), true);
+
+    QueryRecorder recorder;
+    QDjango::addQueryObserver(&recorder);
+
+    Item item;
+    item.setName("observed");
+    QCOMPARE(item.save(), true);
+    QCOMPARE(recorder.events.size(), 1);
+    QVERIFY(recorder.events[0].sql.startsWith("INSERT INTO "));
+    QCOMPARE(recorder.events[0].values, QVariantList() << QString("observed"));
+    QCOMPARE(recorder.events[0].connectionName, QDjango::database().connectionName());
+    QCOMPARE(recorder.events[0].thread, QThread::currentThread());
+    QCOMPARE(recorder.events[0].rowCount, 1);
+    QVERIFY(recorder.events[0].duration >= 0);
+    QVERIFY(!recorder.events[0].error.isValid());
+
+    // failed statements carry the error
+    QDjangoQuery query(QDjango::database());
+    query.prepare("SELECT * FROM no_such_table");
+    QCOMPARE(query.exec(), false);
+    QCOMPARE(recorder.events.size(), 2);
+    QVERIFY(recorder.events[1].error.isValid());
+    QCOMPARE(recorder.events[1].rowCount, -1);
+
+    // removed observers are no longer notified
+    QDjango::removeQueryObserver(&recorder);
+    QCOMPARE(QDjangoQuerySet<Item>().count(), 1);
+    QCOMPARE(recorder.events.size(), 2);
+
+    QCOMPARE(metaModel.dropTable(), true);
+}
+
+class MetricsThread : public QThread
+{
+public:
+    MetricsThread(QDjangoCounter *counter)
+        : m_counter(counter)
+    {
+    }
+
+    void run()
+    {
+        for (int i = 0; i < 1000; ++i)
+            m_counter->increment();
+    }
+
+private:
+    QDjangoCounter *m_counter;
+};
+
+void tst_QDjango::metrics()
+{
+    // counters sum the values of all threads, including finished ones
+    QDjangoCounter counter("test_events_total", "Number of test events.");
+    counter.increment(5);
+    MetricsThread thread1(&counter);
+    MetricsThread thread2(&counter);
+    thread1.start();
+    thread2.start();
+    thread1.wait();
+    thread2.wait();
+    QCOMPARE(counter.value(), 2005.0);
+    QCOMPARE(QDjangoCounter("test_events_total", QString()).value(), 2005.0);
+
+    QDjangoCounter labelled("test_requests_total{method=\"GET\"}", "Number of test requests.");
+    labelled.increment();
+
+    QDjangoGauge gauge("test_connections", "Number of test connections.");
+    gauge.setValue(3);
+    gauge.increment();
+    gauge.decrement(2);
+    QCOMPARE(gauge.value(), 2);
+
+    QDjangoHistogram histogram("test_latency_seconds", "Test latency.", QList<double>() << 1.0 << 5.0);
+    histogram.observe(0.5);
+    histogram.observe(3.0);
+    histogram.observe(10.0);
+    QCOMPARE(histogram.count(), qint64(3));
+    QCOMPARE(histogram.sum(), 13.5);
+
+    // metrics are exported along with QDjango's own
+    const QString output = QDjangoMetrics::toPrometheus();
+    QVERIFY(output.contains("# HELP test_events_total Number of test events.\n"
+                            "# TYPE test_events_total counter\n"
+                            "test_events_total 2005\n"));
+    QVERIFY(output.contains("# TYPE test_requests_total counter\n"
+                            "test_requests_total{method=\"GET\"} 1\n"));
+    QVERIFY(output.contains("# TYPE test_connections gauge\n"
+                            "test_connections 2\n"));
+    QVERIFY(output.contains("# TYPE test_latency_seconds histogram\n"
+                            "test_latency_seconds_bucket{le=\"1\"} 1\n"
+                            "test_latency_seconds_bucket{le=\"5\"} 2\n"
+                            "test_latency_seconds_bucket{le=\"+Inf\"} 3\n"
+                            "test_latency_seconds_sum 13.5\n"
+                            "test_latency_seconds_count 3\n"));
+    QVERIFY(output.contains("# TYPE qdjango_queries_total counter\n"));
+
+    // every statement QDjango runs is counted
+    QDjangoCounter queries("qdjango_queries_total", "Number of SQL queries executed.");
+    const double before = queries.value();
+    QDjangoQuery query(QDjango::database());
+    query.prepare("SELECT 1");
+    QVERIFY(query.exec());
+    QCOMPARE(queries.value(), before + 1);
+}
+
+void tst_QDjango::tracing()
+{
+    const QDjangoMetaModel metaModel = QDjango::registerModel<Item>();
+    QCOMPARE(metaModel.createTable(), true);
+
+    // nothing is recorded while tracing is disabled
+    QDjangoTracer::clear();
+    {
+        QDjangoTraceSpan span("test.disabled");
+        QCOMPARE(span.isActive(), false);
+        QCOMPARE(QDjangoQuerySet<Item>().count(), 0);
+    }
+    QVERIFY(!QDjangoTracer::toChromeTrace().contains("\"name\""));
+
+    // queries are recorded as nested spans
+    QDjangoTracer::setEnabled(true);
+    {
+        QDjangoTraceSpan span("test.request");
+        QCOMPARE(span.isActive(), true);
+        QCOMPARE(QDjangoQuerySet<Item>().count(), 0);
+    }
+    QByteArray trace = QDjangoTracer::toChromeTrace();
+    QVERIFY(trace.startsWith("{\"traceEvents\":["));
+    QVERIFY(trace.contains("{\"name\":\"test.request\",\"cat\":\"qdjango\",\"ph\":\"X\""));
+    QVERIFY(trace.contains("{\"name\":\"sql.exec\",\"cat\":\"sql\",\"ph\":\"X\""));
+    QVERIFY(trace.contains("\"args\":{\"detail\":\"SELECT COUNT(*) FROM "));
+
+    // one in two top-level spans is sampled, along with its nested spans
+    QDjangoTracer::clear();
+    QDjangoTracer::setSampleInterval(2);
+    for (int i = 0; i < 4; ++i) {
+        QDjangoTraceSpan span("test.sampled");
+        QDjangoTraceSpan nested("test.nested");
+    }
+    trace = QDjangoTracer::toChromeTrace();
+    QCOMPARE(trace.count("\"test.sampled\""), 2);
+    QCOMPARE(trace.count("\"test.nested\""), 2);
+    QDjangoTracer::setSampleInterval(1);
+
+    // only the most recent spans are kept
+    QDjangoTracer::setBufferSize(3);
+    for (int i = 0; i < 5; ++i)
+        QDjangoTraceSpan span("test.ring");
+    QCOMPARE(QDjangoTracer::toChromeTrace().count("\"test.ring\""), 3);
+
+    QDjangoTracer::setBufferSize(4096);
+    QDjangoTracer::setEnabled(false);
+    QCOMPARE(metaModel.dropTable(), true);
+}
+
+void tst_QDjango::allocCounter()
+{
+    if (!QDjangoAllocCounter::isAvailable())
+        QSKIP("QDjango was built without QDJANGO_ALLOC_ACCOUNTING", SkipSingle);
+
+    QDjangoAllocCounter counter;
+    const QByteArray data(1000, 'x');
+    QVERIFY(counter.allocations() >= 1);
+    QVERIFY(counter.bytes() >= 1000);
+
+    counter.reset();
+    QCOMPARE(counter.allocations(), qint64(0));
+    QCOMPARE(counter.bytes(), qint64(0));
+}
+
 void tst_QDjangoCompiler::initTestCase()
 {
     QDjango::registerModel<Item>();
@@ -229,6 +850,14 @@ void tst_QDjangoMetaModel::options()
     QCOMPARE(metaModel.m_localFields[2].index, true);
     QCOMPARE(metaModel.m_localFields[2].maxLength, 0);
     QCOMPARE(metaModel.m_localFields[2].primaryKey, false);
+    QCOMPARE(metaModel.m_indexes.size(), 2);
+    QCOMPARE(metaModel.m_indexes[0].name, QLatin1String("foo_table_bar_foo"));
+    QCOMPARE(metaModel.m_indexes[0].fields, QList<QByteArray>() << "bar" << "foo");
+    QCOMPARE(metaModel.m_indexes[0].unique, false);
+    QCOMPARE(metaModel.m_indexes[1].name, QLatin1String("foo_table_partial"));
+    QCOMPARE(metaModel.m_indexes[1].fields, QList<QByteArray>() << "foo");
+    QCOMPARE(metaModel.m_indexes[1].where, QLatin1String("bar > 0"));
+    QCOMPARE(metaModel.m_indexes[1].unique, true);
 }
 
 void tst_QDjangoMetaModel::save()
@@ -240,6 +869,96 @@ void tst_QDjangoMetaModel::save()
     QCOMPARE(obj.property("id"), QVariant(1));
 }
 
+void tst_QDjangoMetaModel::bulkInsert()
+{
+    QList<QObject*> objects;
+    for (int i = 0; i < 3; ++i) {
+        Object *obj = new Object;
+        obj->setFoo(QString("bulk string %1").arg(i));
+        obj->setBar(i);
+        objects << obj;
+    }
+    QCOMPARE(metaModel.bulkInsert(objects), true);
+    QCOMPARE(objects[0]->property("id"), QVariant(2));
+    QCOMPARE(objects[1]->property("id"), QVariant(3));
+    QCOMPARE(objects[2]->property("id"), QVariant(4));
+
+    // each object received the key of its own row
+    QSqlQuery query(QDjango::database());
+    foreach (QObject *obj, objects) {
+        QVERIFY(query.prepare("SELECT \"bar\" FROM \"foo_table\" WHERE \"id\" = ?"));
+        query.addBindValue(obj->property("id"));
+        QVERIFY(query.exec());
+        QVERIFY(query.next());
+        QCOMPARE(query.value(0).toInt(), obj->property("bar").toInt());
+    }
+    qDeleteAll(objects);
+}
+
+void tst_QDjangoMetaModel::tableExists()
+{
+    QCOMPARE(metaModel.tableExists(), true);
+
+    // changes made through QDjango update the schema snapshot
+    QCOMPARE(metaModel.dropTable(), true);
+    QCOMPARE(metaModel.tableExists(), false);
+    QCOMPARE(metaModel.createTable(), true);
+    QCOMPARE(metaModel.tableExists(), true);
+
+    // other changes require invalidating the snapshot
+    QSqlQuery query(QDjango::database());
+    QVERIFY(query.exec("DROP TABLE \"foo_table\""));
+    QCOMPARE(metaModel.tableExists(), true);
+    QDjango::invalidateSchema();
+    QCOMPARE(metaModel.tableExists(), false);
+
+    QCOMPARE(metaModel.createTable(), true);
+    QCOMPARE(metaModel.tableExists(), true);
+}
+
+void tst_QDjangoMetaModel::indexes()
+{
+    QDjangoMetaIndex index;
+    index.name = "foo_table_covering";
+    index.fields << "bar";
+    index.include << "foo";
+
+    const QSqlDatabase db = QDjango::database();
+    const QString driverName = db.driverName();
+    bool partial = false;
+    if (driverName == QLatin1String("QPSQL")) {
+        QCOMPARE(metaModel.indexSql(db, index), QLatin1String("CREATE INDEX \"foo_table_covering\" ON \"foo_table\" (\"bar\") INCLUDE (\"foo\")"));
+        partial = true;
+    } else if (driverName == QLatin1String("QSQLITE")) {
+        QCOMPARE(metaModel.indexSql(db, index), QLatin1String("CREATE INDEX \"foo_table_covering\" ON \"foo_table\" (\"bar\", \"foo\")"));
+
+        // the declared indexes were created
+        QSqlQuery query(db);
+        QVERIFY(query.exec("SELECT name FROM sqlite_master WHERE type = 'index' AND tbl_name = 'foo_table'"));
+        QStringList names;
+        while (query.next())
+            names << query.value(0).toString();
+        QVERIFY(names.contains("foo_table_bar_foo"));
+        partial = names.contains("foo_table_partial");
+    }
+
+    // the partial unique index only applies to some rows
+    Object first;
+    first.setFoo("unique string");
+    first.setBar(0);
+    QCOMPARE(metaModel.save(&first), true);
+    Object second;
+    second.setFoo("unique string");
+    second.setBar(1);
+    QCOMPARE(metaModel.save(&second), true);
+    if (partial) {
+        Object third;
+        third.setFoo("unique string");
+        third.setBar(2);
+        QCOMPARE(metaModel.save(&third), false);
+    }
+}
+
 void tst_QDjangoMetaModel::cleanupTestCase()
 {
     metaModel.dropTable();
@@ -623,6 +1342,9 @@ int main(int argc, char *argv[])
 
     for (int i = 0; i < count; ++i)
     {
+        tst_QDjango testQDjango;
+        errors += QTest::qExec(&testQDjango);
+
         tst_QDjangoWhere testWhere;
         errors += QTest::qExec(&testWhere);
 
@@ -20,6 +20,7 @@
 #include "QDjango.h"
 #include "QDjangoModel.h"
 
+#include <QDateTime>
 #include <QObject>
 
 #define CHECKWHERE(_where, s, v) { \
@@ -38,7 +39,8 @@ class Object : public QObject
     Q_PROPERTY(int bar READ bar WRITE setBar)
     Q_PROPERTY(int wiz READ wiz WRITE setWiz)
 
-    Q_CLASSINFO("__meta__", "db_table=foo_table")
+    Q_CLASSINFO("__meta__", "db_table=foo_table index_together=bar,foo")
+    Q_CLASSINFO("__index__", "name=foo_table_partial fields=foo unique=true where=\"bar > 0\"")
     Q_CLASSINFO("foo", "max_length=255")
     Q_CLASSINFO("bar", "db_index=true")
     Q_CLASSINFO("wiz", "ignore_field=true")
@@ -99,6 +101,85 @@ private:
     QString m_name;
 };
 
+class Account : public QDjangoModel
+{
+    Q_OBJECT
+    Q_PROPERTY(int owner READ owner WRITE setOwner)
+    Q_PROPERTY(int balance READ balance WRITE setBalance)
+
+    Q_CLASSINFO("__meta__", "shard_key=owner")
+
+public:
+    Account(QObject *parent = 0);
+
+    int owner() const;
+    void setOwner(int owner);
+
+    int balance() const;
+    void setBalance(int balance);
+
+private:
+    int m_owner;
+    int m_balance;
+};
+
+class Session : public QDjangoModel
+{
+    Q_OBJECT
+    Q_PROPERTY(QString key READ key WRITE setKey)
+
+    Q_CLASSINFO("__meta__", "db_alias=sessions")
+
+public:
+    Session(QObject *parent = 0);
+
+    QString key() const;
+    void setKey(const QString &key);
+
+private:
+    QString m_key;
+};
+
+class Event : public QDjangoModel
+{
+    Q_OBJECT
+    Q_PROPERTY(QDateTime date READ date WRITE setDate)
+    Q_PROPERTY(QString message READ message WRITE setMessage)
+
+    Q_CLASSINFO("__meta__", "partition_by=range(date) partition_interval=day")
+
+public:
+    Event(QObject *parent = 0);
+
+    QDateTime date() const;
+    void setDate(const QDateTime &date);
+
+    QString message() const;
+    void setMessage(const QString &message);
+
+private:
+    QDateTime m_date;
+    QString m_message;
+};
+
+/** Test QDjango class.
+ */
+class tst_QDjango : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void connectionProfile();
+    void replicas();
+    void shards();
+    void aliases();
+    void partitions();
+    void queryObserver();
+    void metrics();
+    void tracing();
+    void allocCounter();
+};
+
 class tst_QDjangoCompiler : public QObject
 {
     Q_OBJECT
@@ -121,6 +202,9 @@ private slots:
     void initTestCase();
     void options();
     void save();
+    void bulkInsert();
+    void tableExists();
+    void indexes();
     void cleanupTestCase();
 
 private: